@@ -0,0 +1,704 @@
+#include "crc32.h"
+#include "png_internal.h"
+#include "../common/return_codes.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint32_t (*crc_function_t)(uint32_t crc, const void* data, size_t length);
+
+static double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static uint32_t zlib_crc(uint32_t crc, const void* data, size_t length)
+{
+	return crc32(crc, data, length);
+}
+
+// checks the stream chunk by chunk, the way read_chunk does; returns seconds per pass
+static double time_crc(crc_function_t function, const uint8_t* data, size_t length, size_t chunk_length, int repeats)
+{
+	double best = 1e30;
+	volatile uint32_t sink = 0;
+	for (int r = 0; r < repeats; r++)
+	{
+		double start = now();
+		for (size_t offset = 0; offset < length; offset += chunk_length)
+		{
+			size_t size = length - offset < chunk_length ? length - offset : chunk_length;
+			sink ^= function(0, data + offset, size);
+		}
+		double elapsed = now() - start;
+		if (elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+static double time_inflate(const uint8_t* compressed, size_t compressed_length, uint8_t* output, size_t length, int repeats)
+{
+	double best = 1e30;
+	for (int r = 0; r < repeats; r++)
+	{
+		uLongf output_length = length;
+		double start = now();
+		if (uncompress(output, &output_length, compressed, compressed_length) != Z_OK)
+			return -1;
+		double elapsed = now() - start;
+		if (elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+static int benchmark_crc(size_t megabytes)
+{
+	int repeats = 5;
+	if (!megabytes)
+	{
+		fprintf(stderr, "Wrong size");
+		return ERROR_INVALID_PARAMETER;
+	}
+	size_t length = megabytes << 20;
+
+	// image-like data: gradients with low bit noise
+	uint8_t* data = malloc(length);
+	uint8_t* output = malloc(length);
+	uLongf compressed_length = compressBound(length);
+	uint8_t* compressed = malloc(compressed_length);
+	if (!data || !output || !compressed)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		free(data);
+		free(output);
+		free(compressed);
+		return ERROR_MEMORY;
+	}
+	uint32_t seed = 1;
+	for (size_t i = 0; i < length; i++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		data[i] = (uint8_t)((i & 0xFF) + ((seed >> 16) & 0x03));
+	}
+	if (compress2(compressed, &compressed_length, data, length, 6) != Z_OK)
+	{
+		fprintf(stderr, "compress failed");
+		free(data);
+		free(output);
+		free(compressed);
+		return ERROR_UNKNOWN;
+	}
+
+	double inflate_time = time_inflate(compressed, compressed_length, output, length, repeats);
+	if (inflate_time < 0)
+	{
+		fprintf(stderr, "uncompress failed");
+		free(data);
+		free(output);
+		free(compressed);
+		return ERROR_UNKNOWN;
+	}
+	printf("inflate: %.1f MB/s of output (%zu MB, ratio %.2f)\n",
+		   length / inflate_time / 1e6,
+		   megabytes,
+		   (double)length / compressed_length);
+
+	struct
+	{
+		const char* m_name;
+		crc_function_t m_function;
+	} kernels[] = {
+		{ "slice-by-8", crc32_slice_by_8 },
+		{ "pclmul", crc32_has_pclmul() ? crc32_pclmul : 0 },
+		{ "zlib", zlib_crc },
+		{ "dispatched", crc32_calculate },
+	};
+	size_t chunk_lengths[] = { 8192, 65536, 1 << 20 };
+
+	// the CRC runs over the compressed IDAT payload, so overhead is relative to inflating it
+	printf("%-12s %10s %12s %22s\n", "kernel", "chunk", "MB/s", "overhead vs inflate");
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+	{
+		if (!kernels[k].m_function)
+		{
+			printf("%-12s %10s\n", kernels[k].m_name, "unsupported");
+			continue;
+		}
+		for (size_t c = 0; c < sizeof(chunk_lengths) / sizeof(chunk_lengths[0]); c++)
+		{
+			double crc_time = time_crc(kernels[k].m_function, compressed, compressed_length, chunk_lengths[c], repeats);
+			printf("%-12s %10zu %12.1f %21.2f%%\n",
+				   kernels[k].m_name,
+				   chunk_lengths[c],
+				   compressed_length / crc_time / 1e6,
+				   100.0 * crc_time / inflate_time);
+		}
+	}
+
+	free(data);
+	free(output);
+	free(compressed);
+	return ERROR_SUCCESS;
+}
+
+static uint8_t* append_chunk(uint8_t* out, const char* type, const uint8_t* data, uint32_t length)
+{
+	uint8_t header[8] = { length >> 24, length >> 16, length >> 8, length, type[0], type[1], type[2], type[3] };
+	memcpy(out, header, 8);
+	if (length)
+		memcpy(out + 8, data, length);
+	uint32_t crc = crc32_calculate(0, out + 4, length + 4);
+	uint8_t trailer[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+	memcpy(out + 8 + length, trailer, 4);
+	return out + 12 + length;
+}
+
+// RGBA icon with Sub filtered rows; returns the PNG length or 0
+static size_t make_icon(uint8_t* out, size_t capacity, uint32_t size, uint32_t seed)
+{
+	size_t raw_length = (size_t)size * (size * 4 + 1);
+	uint8_t* raw = malloc(raw_length);
+	uLongf compressed_length = compressBound(raw_length);
+	if (!raw || capacity < compressed_length + 57)
+	{
+		free(raw);
+		return 0;
+	}
+	for (size_t i = 0; i < raw_length; i++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		raw[i] = i % (size * 4 + 1) ? (uint8_t)((seed >> 16) & 0x07) : 1;
+	}
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint8_t ihdr[13] = { size >> 24, size >> 16, size >> 8, size, size >> 24, size >> 16, size >> 8, size, 8, 6, 0, 0, 0 };
+	uint8_t* cursor = out;
+	memcpy(cursor, signature, 8);
+	cursor = append_chunk(cursor + 8, "IHDR", ihdr, 13);
+	if (compress2(cursor + 8, &compressed_length, raw, raw_length, 9) != Z_OK)
+	{
+		free(raw);
+		return 0;
+	}
+	// the payload is compressed in place, so append_chunk copies it onto itself
+	cursor = append_chunk(cursor, "IDAT", cursor + 8, compressed_length);
+	cursor = append_chunk(cursor, "IEND", 0, 0);
+	free(raw);
+	return cursor - out;
+}
+
+// per-image latency of a long-lived decoder against a fresh decoder and image per call
+static int benchmark_decode(size_t count)
+{
+	uint32_t sizes[] = { 16, 32, 64 };
+	size_t capacity = 1 << 16;
+	uint8_t* file = malloc(capacity);
+	png_options_t options;
+	png_default_options(&options);
+	if (!file)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+
+	printf("%-6s %8s %16s %16s\n", "icon", "bytes", "reused us", "per-call us");
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		size_t length = make_icon(file, capacity, sizes[s], (uint32_t)s + 1);
+		if (!length)
+		{
+			fprintf(stderr, "cannot build the test image");
+			free(file);
+			return ERROR_UNKNOWN;
+		}
+		png_decoder_t* decoder;
+		size_t code = png_decoder_create(&decoder, &options);
+		if (code)
+		{
+			free(file);
+			return (int)code;
+		}
+
+		double start = now();
+		for (size_t i = 0; i < count && !code; i++)
+		{
+			png_t png;
+			code = png_decode_memory(decoder, &png, file, length);
+			png_release_image(decoder, &png);
+		}
+		double reused = now() - start;
+		png_decoder_destroy(decoder);
+
+		start = now();
+		for (size_t i = 0; i < count && !code; i++)
+		{
+			png_t png;
+			code = png_decoder_create(&decoder, &options);
+			if (code)
+				break;
+			code = png_decode_memory(decoder, &png, file, length);
+			png_release_image(decoder, &png);
+			png_decoder_destroy(decoder);
+		}
+		double fresh = now() - start;
+		if (code)
+		{
+			fprintf(stderr, "decoding failed");
+			free(file);
+			return (int)code;
+		}
+
+		printf("%2ux%-3u %8zu %16.2f %16.2f\n", sizes[s], sizes[s], length, reused / count * 1e6, fresh / count * 1e6);
+	}
+
+	free(file);
+	return ERROR_SUCCESS;
+}
+
+// side x side RGB of smooth gradients with a little noise, something between flat art and sensor data
+static size_t make_photo(png_t* png, size_t side)
+{
+	memset(png, 0, sizeof(*png));
+	png->m_width = (uint32_t)side;
+	png->m_height = (uint32_t)side;
+	png->m_bit_depth = 8;
+	png->m_color_type = 2;
+	png->m_channels = 3;
+	png->m_sample_bytes = 1;
+	png->m_max_value = 0xFF;
+	png->m_image_data = malloc(side * side * 3);
+	if (!png->m_image_data)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	uint32_t seed = 1;
+	for (size_t y = 0; y < side; y++)
+	{
+		for (size_t x = 0; x < side; x++)
+		{
+			uint8_t* pixel = png->m_image_data + (y * side + x) * 3;
+			seed = seed * 1103515245u + 12345u;
+			pixel[0] = (uint8_t)(x * 255 / side + ((seed >> 16) & 0x03));
+			pixel[1] = (uint8_t)(y * 255 / side + ((seed >> 20) & 0x03));
+			pixel[2] = (uint8_t)((x + y) * 127 / side + ((seed >> 24) & 0x07));
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+// encodes a photo-like RGB image at every zlib level; the output is decoded back and compared
+static int benchmark_encode(size_t side)
+{
+	int repeats = 3;
+	png_t png;
+	size_t length = side * side * 3;
+	png_decoder_t* decoder = 0;
+	png_options_t options;
+	png_default_options(&options);
+	FILE* file = tmpfile();
+	if (make_photo(&png, side) || !file || png_decoder_create(&decoder, &options))
+	{
+		fprintf(stderr, "cannot allocate memory");
+		free(png.m_image_data);
+		if (file)
+			fclose(file);
+		if (decoder)
+			png_decoder_destroy(decoder);
+		return ERROR_MEMORY;
+	}
+
+	int code = ERROR_SUCCESS;
+	printf("%dx%d RGB, %.1f MB\n", (int)side, (int)side, length / 1e6);
+	printf("%-6s %12s %12s %10s\n", "level", "MB/s", "bytes", "ratio");
+	for (int32_t level = 0; level <= 9 && !code; level++)
+	{
+		png_encoder_options_t encoder_options;
+		png_default_encoder_options(&encoder_options);
+		encoder_options.m_level = level;
+
+		double best = 1e30;
+		for (int r = 0; r < repeats && !code; r++)
+		{
+			rewind(file);
+			if (ftruncate(fileno(file), 0))
+			{
+				code = ERROR_UNKNOWN;
+				break;
+			}
+			double start = now();
+			code = (int)save_png_by_file_handle(&png, file, &encoder_options);
+			double elapsed = now() - start;
+			if (elapsed < best)
+				best = elapsed;
+		}
+		if (code)
+			break;
+		fseek(file, 0, SEEK_END);
+		long encoded_length = ftell(file);
+
+		png_t decoded;
+		code = (int)png_decode_file(decoder, &decoded, file);
+		if (!code && memcmp(decoded.m_image_data, png.m_image_data, length))
+		{
+			fprintf(stderr, "round trip mismatch");
+			code = ERROR_INVALID_DATA;
+		}
+		if (!code)
+			png_release_image(decoder, &decoded);
+
+		printf("%-6d %12.1f %12ld %10.2f\n", level, length / best / 1e6, encoded_length, (double)length / encoded_length);
+	}
+
+	png_decoder_destroy(decoder);
+	fclose(file);
+	free(png.m_image_data);
+	return code;
+}
+
+// encodes through a temporary file into a malloc'ed buffer
+static size_t encode_to_memory(uint8_t** data, int64_t* length, const png_t* png, const png_encoder_options_t* options)
+{
+	FILE* file = tmpfile();
+	if (!file)
+	{
+		fprintf(stderr, "tmpfile failed");
+		return ERROR_UNKNOWN;
+	}
+	size_t code = save_png_by_file_handle(png, file, options);
+	if (!code)
+		code = get_file_length(length, file);
+	if (!code)
+	{
+		*data = malloc(*length);
+		code = *data ? read_from_file(*data, *length, file) : ERROR_MEMORY;
+	}
+	fclose(file);
+	return code;
+}
+
+// read_chunk over the whole file, IDAT payloads are joined so that inflate can be timed on its own
+static size_t parse_chunks(uint8_t* compressed, int64_t* compressed_length, const uint8_t* data, int64_t length, const png_options_t* options)
+{
+	png_reader_t reader;
+	memset(&reader, 0, sizeof(reader));
+	reader.m_data = data;
+	reader.m_length = length;
+	reader.m_cursor = 8;
+	reader.m_options = options;
+	*compressed_length = 0;
+	png_chunk_t chunk;
+	do
+	{
+		size_t code = read_chunk(&chunk, &reader);
+		if (code)
+			return code;
+		if (chunk.m_type == IDAT)
+		{
+			memcpy(compressed + *compressed_length, chunk.m_data, chunk.m_length);
+			*compressed_length += chunk.m_length;
+		}
+	} while (chunk.m_type != IEND);
+	return ERROR_SUCCESS;
+}
+
+typedef struct stage_times_t_tag
+{
+	double m_parse;
+	double m_inflate;
+	double m_unfilter;
+	double m_write;
+	double m_decode;
+} stage_times_t;
+
+static void keep_best(double* best, double start)
+{
+	double elapsed = now() - start;
+	if (elapsed < *best)
+		*best = elapsed;
+}
+
+// best of repeats for every decoder stage of one PNG, with the stages run the way the decoder runs them
+static size_t time_stages(stage_times_t* times, const uint8_t* data, int64_t length, const png_t* source, png_decoder_t* decoder, FILE* output, int repeats)
+{
+	size_t code = ERROR_SUCCESS;
+	png_options_t options;
+	png_default_options(&options);
+	options.m_verify = VerifyAll;
+
+	int64_t pixel_bytes = source->m_channels;
+	int64_t byte_width = source->m_width * pixel_bytes;
+	int64_t filtered_length = (byte_width + 1) * source->m_height;
+	int64_t compressed_length = 0;
+	uint8_t* compressed = malloc(length);
+	uint8_t* filtered = malloc(filtered_length);
+	uint8_t* work = malloc(filtered_length);
+	if (!compressed || !filtered || !work)
+	{
+		free(compressed);
+		free(filtered);
+		free(work);
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+
+	times->m_parse = times->m_inflate = times->m_unfilter = times->m_write = times->m_decode = 1e30;
+	for (int r = 0; r < repeats && !code; r++)
+	{
+		double start = now();
+		code = parse_chunks(compressed, &compressed_length, data, length, &options);
+		keep_best(&times->m_parse, start);
+		if (code)
+			break;
+
+		uLongf inflated_length = filtered_length;
+		start = now();
+		if (uncompress(filtered, &inflated_length, compressed, compressed_length) != Z_OK || (int64_t)inflated_length != filtered_length)
+		{
+			fprintf(stderr, "uncompress failed");
+			code = ERROR_INVALID_DATA;
+			break;
+		}
+		keep_best(&times->m_inflate, start);
+
+		// in place, like unfilter_in_place, so every repeat starts from a fresh copy
+		memcpy(work, filtered, filtered_length);
+		start = now();
+		for (int64_t y = 0; y < source->m_height && !code; y++)
+		{
+			uint8_t* row = work + y * (byte_width + 1) + 1;
+			code = unfilter_row(row, row, y ? row - byte_width - 1 : 0, byte_width, pixel_bytes, row[-1]);
+		}
+		keep_best(&times->m_unfilter, start);
+
+		png_t png;
+		start = now();
+		code = code ? code : png_decode_memory(decoder, &png, data, length);
+		keep_best(&times->m_decode, start);
+		if (!code && memcmp(png.m_image_data, source->m_image_data, byte_width * source->m_height))
+		{
+			fprintf(stderr, "round trip mismatch");
+			code = ERROR_INVALID_DATA;
+		}
+
+		rewind(output);
+		if (!code && ftruncate(fileno(output), 0))
+			code = ERROR_UNKNOWN;
+		start = now();
+		code = code ? code : save_png_as_pnm_by_file_handle(&png, output);
+		keep_best(&times->m_write, start);
+		png_release_image(decoder, &png);
+	}
+
+	free(compressed);
+	free(filtered);
+	free(work);
+	return code;
+}
+
+// Decodes generated PNGs of several sizes, filters and levels stage by stage, in MB/s of each
+// stage's input (parse), output (inflate, unfilter) or image bytes (write, whole decode).
+// With a corpus directory every generated PNG is also saved there as a fuzzing seed.
+static int benchmark_stages(size_t side, const char* corpus)
+{
+	static const char* filter_names[] = { "adaptive", "none", "sub", "up", "average", "paeth" };
+	size_t sides[] = { side / 16 ? side / 16 : 1, side / 4 ? side / 4 : 1, side };
+	int32_t levels[] = { 1, 6, 9 };
+	int repeats = 3;
+
+	png_decoder_t* decoder = 0;
+	png_options_t options;
+	png_default_options(&options);
+	FILE* output = tmpfile();
+	if (!output || png_decoder_create(&decoder, &options))
+	{
+		fprintf(stderr, "cannot set up the benchmark");
+		if (output)
+			fclose(output);
+		return ERROR_UNKNOWN;
+	}
+
+	size_t code = ERROR_SUCCESS;
+	printf("%-6s %-6s %-9s %10s %10s %10s %10s %10s %10s\n", "side", "level", "filter", "ratio", "parse", "inflate", "unfilter", "write", "decode");
+	for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]) && !code; s++)
+	{
+		png_t png;
+		code = make_photo(&png, sides[s]);
+		double image_length = (double)sides[s] * sides[s] * 3;
+		double filtered_length = (double)(sides[s] * 3 + 1) * sides[s];
+		for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]) && !code; l++)
+		{
+			for (int32_t filter = -1; filter <= 4 && !code; filter++)
+			{
+				png_encoder_options_t encoder_options;
+				png_default_encoder_options(&encoder_options);
+				encoder_options.m_level = levels[l];
+				encoder_options.m_filter = filter;
+				uint8_t* data = 0;
+				int64_t length;
+				code = encode_to_memory(&data, &length, &png, &encoder_options);
+
+				stage_times_t times;
+				if (!code)
+					code = time_stages(&times, data, length, &png, decoder, output, repeats);
+				if (!code && corpus)
+				{
+					char path[4096];
+					snprintf(path, sizeof(path), "%s/%zu_%d_%s.png", corpus, sides[s], levels[l], filter_names[filter + 1]);
+					FILE* seed = fopen(path, "wb");
+					if (!seed || fwrite(data, 1, length, seed) != (size_t)length)
+					{
+						fprintf(stderr, "Can't write %s", path);
+						code = ERROR_NOT_FOUND;
+					}
+					if (seed)
+						fclose(seed);
+				}
+				free(data);
+				if (code)
+					break;
+
+				printf("%-6zu %-6d %-9s %10.2f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+					   sides[s],
+					   levels[l],
+					   filter_names[filter + 1],
+					   image_length / length,
+					   length / times.m_parse / 1e6,
+					   filtered_length / times.m_inflate / 1e6,
+					   filtered_length / times.m_unfilter / 1e6,
+					   image_length / times.m_write / 1e6,
+					   image_length / times.m_decode / 1e6);
+			}
+		}
+		free(png.m_image_data);
+	}
+
+	png_decoder_destroy(decoder);
+	fclose(output);
+	return (int)code;
+}
+
+// Decodes a photo-like RGB image into every layout, in MB/s of packed image bytes: the whole decode
+// with the conversion fused into the row loop, and convert_row alone over an already decoded image
+static int benchmark_layouts(size_t side)
+{
+	static const char* layout_names[] = { "packed", "planar", "rgba32", "float" };
+	int repeats = 5;
+
+	png_t source;
+	size_t code = make_photo(&source, side);
+	png_encoder_options_t encoder_options;
+	png_default_encoder_options(&encoder_options);
+	encoder_options.m_level = 1;
+	uint8_t* data = 0;
+	int64_t length;
+	if (!code)
+		code = encode_to_memory(&data, &length, &source, &encoder_options);
+	uint8_t* converted = malloc(side * side * 3 * sizeof(float));
+	uint8_t* scratch = malloc(side * 3);
+	if (!code && (!converted || !scratch))
+	{
+		fprintf(stderr, "cannot allocate memory");
+		code = ERROR_MEMORY;
+	}
+
+	double image_length = (double)side * side * 3;
+	printf("%-8s %10s %10s\n", "layout", "decode", "convert");
+	for (png_layout_t layout = LayoutPacked; layout <= LayoutFloat && !code; layout++)
+	{
+		png_options_t options;
+		png_default_options(&options);
+		options.m_layout = layout;
+		png_decoder_t* decoder;
+		code = png_decoder_create(&decoder, &options);
+		if (code)
+			break;
+		double decode = 1e30;
+		for (int r = 0; r < repeats && !code; r++)
+		{
+			png_t png;
+			double start = now();
+			code = png_decode_memory(decoder, &png, data, length);
+			keep_best(&decode, start);
+			png_release_image(decoder, &png);
+		}
+		png_decoder_destroy(decoder);
+
+		double convert = 1e30;
+		for (int r = 0; r < repeats && !code; r++)
+		{
+			double start = now();
+			for (size_t y = 0; y < side; y++)
+				convert_row(converted, source.m_image_data + y * side * 3, (int64_t)y, &source, layout, scratch);
+			keep_best(&convert, start);
+		}
+		if (!code)
+			printf("%-8s %10.1f %10.1f\n", layout_names[layout], image_length / decode / 1e6, image_length / convert / 1e6);
+	}
+
+	free(scratch);
+	free(converted);
+	free(data);
+	free(source.m_image_data);
+	return (int)code;
+}
+
+// benchmark [crc] [MB] | benchmark decode [count] | benchmark encode [side] | benchmark stages [side] [corpus directory]
+// benchmark layouts [side]
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "decode"))
+	{
+		size_t count = argc > 2 ? strtoul(argv[2], 0, 10) : 20000;
+		if (!count)
+		{
+			fprintf(stderr, "Wrong count");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_decode(count);
+	}
+	if (argc > 1 && !strcmp(argv[1], "encode"))
+	{
+		size_t side = argc > 2 ? strtoul(argv[2], 0, 10) : 2048;
+		if (!side || side > 0xFFFF)
+		{
+			fprintf(stderr, "Wrong side");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_encode(side);
+	}
+	if (argc > 1 && !strcmp(argv[1], "stages"))
+	{
+		size_t side = argc > 2 ? strtoul(argv[2], 0, 10) : 1024;
+		if (!side || side > 0xFFFF)
+		{
+			fprintf(stderr, "Wrong side");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_stages(side, argc > 3 ? argv[3] : 0);
+	}
+	if (argc > 1 && !strcmp(argv[1], "layouts"))
+	{
+		size_t side = argc > 2 ? strtoul(argv[2], 0, 10) : 2048;
+		if (!side || side > 0xFFFF)
+		{
+			fprintf(stderr, "Wrong side");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_layouts(side);
+	}
+	if (argc > 1 && !strcmp(argv[1], "crc"))
+	{
+		argc--;
+		argv++;
+	}
+	return benchmark_crc(argc > 1 ? strtoul(argv[1], 0, 10) : 64);
+}
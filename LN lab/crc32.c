@@ -0,0 +1,184 @@
+#include "crc32.h"
+
+#if defined __x86_64__ || defined __i386__
+#	define X86_CRC32
+#	include <immintrin.h>
+#endif
+
+#if defined __unix__ || defined __APPLE__
+#	include <pthread.h>
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+#	define RUN_ONCE(function) pthread_once(&init_once, function)
+#else
+#	include <threads.h>
+static once_flag init_once = ONCE_FLAG_INIT;
+#	define RUN_ONCE(function) call_once(&init_once, function)
+#endif
+
+static uint32_t table[8][256];
+
+static void build_tables(void)
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		table[0][i] = c;
+	}
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		for (int k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+	}
+}
+
+static uint32_t slice_by_8(uint32_t crc, const uint8_t* data, size_t length)
+{
+	// crc is the raw (not inverted) register here
+	while (length >= 8)
+	{
+		uint32_t low = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		uint32_t high = (uint32_t)data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+		low ^= crc;
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+			  table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+		data += 8;
+		length -= 8;
+	}
+	while (length--)
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+	}
+	return crc;
+}
+
+static uint32_t (*implementation)(uint32_t crc, const void* data, size_t length);
+
+uint32_t crc32_slice_by_8(uint32_t crc, const void* data, size_t length)
+{
+	crc32_init();
+	return ~slice_by_8(~crc, data, length);
+}
+
+#if defined X86_CRC32
+// Folding constants for the reflected CRC-32 polynomial, see "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009)
+__attribute__((target("pclmul,sse4.1"))) static uint32_t fold_by_4(uint32_t crc, const uint8_t* data, size_t length)
+{
+	// length is a multiple of 16 and at least 64, crc is the raw register
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ll, 0x0154442bd4ll);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009ell, 0x01751997d0ll);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124ll);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641ll, 0x01db710641ll);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	data += 64;
+	length -= 64;
+
+	// four independent 128-bit lanes keep the multiplier busy
+	while (length >= 64)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+		data += 64;
+		length -= 64;
+	}
+
+	// fold the four lanes into one
+	__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (length >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)data)), x5);
+		data += 16;
+		length -= 16;
+	}
+
+	// 128 -> 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+int crc32_has_pclmul(void)
+{
+#if defined X86_CRC32
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#else
+	return 0;
+#endif
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const void* data, size_t length)
+{
+	crc32_init();
+	const uint8_t* bytes = data;
+	crc = ~crc;
+#if defined X86_CRC32
+	if (length >= 64)
+	{
+		size_t folded = length & ~(size_t)15;
+		crc = fold_by_4(crc, bytes, folded);
+		bytes += folded;
+		length -= folded;
+	}
+#endif
+	// the tail is shorter than one 128-bit block
+	return ~slice_by_8(crc, bytes, length);
+}
+
+static void initialize(void)
+{
+	build_tables();
+	implementation = crc32_has_pclmul() ? crc32_pclmul : crc32_slice_by_8;
+}
+
+void crc32_init(void)
+{
+	RUN_ONCE(initialize);
+}
+
+uint32_t crc32_calculate(uint32_t crc, const void* data, size_t length)
+{
+	crc32_init();
+	return implementation(crc, data, length);
+}
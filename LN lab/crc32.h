@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (ISO 3309, reflected polynomial 0xEDB88320) as used by PNG chunks.
+// All functions take the CRC of the preceding data (0 for none) and return the CRC
+// of the preceding data followed by the given buffer.
+
+// Builds the tables and chooses the implementation once per process, from any thread; the functions
+// below call it themselves
+void crc32_init(void);
+
+// Best implementation available on this CPU
+uint32_t crc32_calculate(uint32_t crc, const void* data, size_t length);
+
+// Portable table-driven implementation, eight bytes per step
+uint32_t crc32_slice_by_8(uint32_t crc, const void* data, size_t length);
+
+// Carry-less multiplication folding, valid only if crc32_has_pclmul() returns non zero
+uint32_t crc32_pclmul(uint32_t crc, const void* data, size_t length);
+
+int crc32_has_pclmul(void);
@@ -0,0 +1,69 @@
+// libFuzzer entry point around parse_png_data:
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -DZLIB fuzz.c png.c png_layout.c crc32.c ../common/file_io.c -lz -o fuzz
+//   ./fuzz corpus/    (seed corpus: benchmark stages 256 corpus/)
+// Built with -DFUZZ_MAIN and any compiler, it replays the given files instead, to reproduce a crash.
+#include "png.h"
+#include "../common/return_codes.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	// one decoder for the whole run, so pooled buffers from earlier inputs are exercised too
+	static png_decoder_t* decoder;
+	if (!decoder)
+	{
+		png_options_t options;
+		png_default_options(&options);
+		// mutated chunks rarely keep a valid CRC, checking it would stop most inputs at the first chunk
+		options.m_verify = VerifyOff;
+		// forged headers are refused by the limits, a tighter memory limit keeps the fuzzer under its rss limit
+		options.m_max_memory = 1ull << 28;
+		if (png_decoder_create(&decoder, &options))
+			abort();
+	}
+
+	png_t png;
+	if (!png_decode_memory(decoder, &png, data, (int64_t)size))
+	{
+		// touch every output byte so reads of uninitialized or freed memory show up
+		size_t length = (size_t)png.m_width * png.m_height * png.m_channels * png.m_sample_bytes;
+		volatile uint8_t sink = 0;
+		for (size_t i = 0; i < length; i++)
+			sink ^= png.m_image_data[i];
+	}
+	png_release_image(decoder, &png);
+	return 0;
+}
+
+#if defined FUZZ_MAIN
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		FILE* file = fopen(argv[i], "rb");
+		if (!file)
+		{
+			fprintf(stderr, "Can't open %s", argv[i]);
+			return ERROR_NOT_FOUND;
+		}
+		fseek(file, 0, SEEK_END);
+		long length = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		uint8_t* data = malloc(length > 0 ? length : 1);
+		if (!data || fread(data, 1, length, file) != (size_t)length)
+		{
+			fprintf(stderr, "Can't read %s", argv[i]);
+			free(data);
+			fclose(file);
+			return ERROR_UNKNOWN;
+		}
+		fclose(file);
+		LLVMFuzzerTestOneInput(data, length);
+		free(data);
+	}
+	return ERROR_SUCCESS;
+}
+#endif
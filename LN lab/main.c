@@ -1,609 +1,316 @@
-#include "return_codes.h"
+#include "../common/file_io.h"
+#include "png.h"
+#include "../common/return_codes.h"
 
-#include <stdint.h>
-#include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
-#if defined ZLIB
-#	include <zlib.h>
-#elif defined LIBDEFLATE
-#	error("libdeflate is not currently supported")
-#	include <libdeflate.h>
-#elif defined ISAL
-#	error("isa-l is not currently supported")
-#	include <include/igzip_lib.h>
-#else
-#	error("A deflate decoding library must be selected")
-#endif
-
-typedef struct png_t_tag
-{
-	uint32_t m_width;
-	uint32_t m_height;
-	uint8_t m_bit_depth;
-	uint8_t m_color_type;
-	uint8_t m_compression_method;
-	uint8_t m_filter_method;
-	uint8_t m_interlace_method;
-
-	uint8_t* m_image_data;
-} png_t;
-
-static size_t read_from_file(void* buffer, size_t size, FILE* file)
-{
-	size_t bytes_read = fread(buffer, 1, size, file);
-	if (bytes_read != size)
-	{
-		fprintf(stderr, "fread failed");
-		return ERROR_INVALID_DATA;
-	}
-	return ERROR_SUCCESS;
-}
-
-static size_t get_file_length(int64_t* length, FILE* file)
-{
-	if (fseek(file, 0, SEEK_END))
-	{
-		fprintf(stderr, "fseek failed");
-		return ERROR_UNKNOWN;
-	}
-	*length = ftell(file);
-	if (*length == -1)
-	{
-		fprintf(stderr, "ftell failed");
-		return ERROR_UNKNOWN;
-	}
-	if (fseek(file, 0, SEEK_SET))
-	{
-		fprintf(stderr, "fseek failed");
-		return ERROR_UNKNOWN;
-	}
-	return ERROR_SUCCESS;
-}
-
-static int32_t reverse_byte_order_32(int32_t x)
-{
-	return ((x & 0x000000FF) << 0x18) | ((x & 0x0000FF00) << 0x08) | ((x & 0x00FF0000) >> 0x08) | ((x & 0xFF000000) >> 0x18);
-}
-
-typedef enum chunk_type_t_tag
-{
-#define BYTES_TO_INT(b0, b1, b2, b3) (b0 << 0x00) | (b1 << 0x08) | (b2 << 0x10) | (b3 << 0x18)
-
-	IHDR = BYTES_TO_INT('I', 'H', 'D', 'R'),
-	PLTE = BYTES_TO_INT('P', 'L', 'T', 'E'),
-	IDAT = BYTES_TO_INT('I', 'D', 'A', 'T'),
-	IEND = BYTES_TO_INT('I', 'E', 'N', 'D'),
-#undef BYTES_TO_INT
-} chunk_type_t;
-
-static size_t is_valid_chunk_type(uint32_t chunk_type)
+// a decimal number, 0 for no limit
+static int parse_limit(uint64_t* limit, const char* text)
 {
-	for (int64_t i = 0; i < 4; i++)
-	{
-		uint32_t c = (chunk_type >> (0x08 * i)) & 0xFF;
-		if (!(((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z'))))
-			return 0;
-	}
+	char end;
+	unsigned long long value;
+	if ((*text < '0') || (*text > '9') || (sscanf(text, "%llu%c", &value, &end) != 1))
+		return 0;
+	*limit = value;
 	return 1;
 }
 
-static size_t is_critical_chunk(uint32_t chunk_type)
+// main input output [--verify=off|critical|all] [--region=x,y,width,height] [--scale=1|2|4|8]
+//                   [--layout=packed|planar|rgba32|float] [--max-pixels=N] [--max-memory=bytes] [--max-ratio=N]
+//                   [--encode] [--level=0..9] [--filter=0..4]
+// planar and float images are written raw, without a header
+static size_t parse_options(png_options_t* options, png_encoder_options_t* encoder_options, int* encode, int argc, char* argv[])
 {
-	return !(chunk_type & (1 << (8 * 3 + 5)));
-}
-
-typedef struct png_reader_t_tag
-{
-	uint8_t* m_data;
-	int64_t m_length;
-	int64_t m_cursor;
-
-	uint8_t* m_compressed_data;
-	int64_t m_compressed_data_length;
-	uint8_t* m_filtered_data;
-	int64_t m_filtered_data_length;
-} png_reader_t;
-static size_t read_it(uint8_t* buffer, int64_t length, png_reader_t* reader)
-{
-	if (reader->m_cursor + length > reader->m_length)
-	{
-		fprintf(stderr, "Input file ended");
-		return ERROR_INVALID_DATA;
-	}
-	for (int64_t i = 0; i < length; i++)
-	{
-		buffer[i] = reader->m_data[reader->m_cursor++];
+	png_default_options(options);
+	png_default_encoder_options(encoder_options);
+	*encode = 0;
+
+	uint64_t ratio;
+	for (int i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--verify=off"))
+			options->m_verify = VerifyOff;
+		else if (!strcmp(argv[i], "--verify=critical"))
+			options->m_verify = VerifyCritical;
+		else if (!strcmp(argv[i], "--verify=all"))
+			options->m_verify = VerifyAll;
+		else if (!strncmp(argv[i], "--region=", 9))
+		{
+			png_region_t* region = &options->m_region;
+			char end;
+			if (sscanf(argv[i] + 9, "%u,%u,%u,%u%c", &region->m_x, &region->m_y, &region->m_width, &region->m_height, &end) != 4)
+			{
+				fprintf(stderr, "Invalid region %s", argv[i]);
+				return ERROR_INVALID_PARAMETER;
+			}
+		}
+		else if (!strcmp(argv[i], "--scale=1") || !strcmp(argv[i], "--scale=2") || !strcmp(argv[i], "--scale=4") || !strcmp(argv[i], "--scale=8"))
+			options->m_scale = (uint8_t)(argv[i][8] - '0');
+		else if (!strcmp(argv[i], "--layout=packed"))
+			options->m_layout = LayoutPacked;
+		else if (!strcmp(argv[i], "--layout=planar"))
+			options->m_layout = LayoutPlanar;
+		else if (!strcmp(argv[i], "--layout=rgba32"))
+			options->m_layout = LayoutRgba32;
+		else if (!strcmp(argv[i], "--layout=float"))
+			options->m_layout = LayoutFloat;
+		else if (!strncmp(argv[i], "--max-pixels=", 13) && parse_limit(&options->m_max_pixels, argv[i] + 13))
+			;
+		else if (!strncmp(argv[i], "--max-memory=", 13) && parse_limit(&options->m_max_memory, argv[i] + 13))
+			;
+		else if (!strncmp(argv[i], "--max-ratio=", 12) && parse_limit(&ratio, argv[i] + 12) && (ratio <= UINT32_MAX))
+			options->m_max_inflate_ratio = (uint32_t)ratio;
+		else if (!strcmp(argv[i], "--encode"))
+			*encode = 1;
+		else if (!strncmp(argv[i], "--level=", 8) && argv[i][8] >= '0' && argv[i][8] <= '9' && !argv[i][9])
+			encoder_options->m_level = argv[i][8] - '0';
+		else if (!strncmp(argv[i], "--filter=", 9) && argv[i][9] >= '0' && argv[i][9] <= '4' && !argv[i][10])
+			encoder_options->m_filter = argv[i][9] - '0';
+		else
+		{
+			fprintf(stderr, "Unknown option %s", argv[i]);
+			return ERROR_INVALID_PARAMETER;
+		}
 	}
 	return ERROR_SUCCESS;
 }
 
-typedef struct png_chunk_t_tag
+typedef struct chunk_entry_t_tag
 {
-	uint32_t m_length;
 	uint32_t m_type;
-	uint8_t* m_data;
-	uint32_t m_crc;
-} png_chunk_t;
+	uint32_t m_length;
+	int64_t m_offset;
+} chunk_entry_t;
 
-static size_t read_chunk(png_chunk_t* chunk, png_reader_t* reader)
+typedef struct chunk_list_t_tag
 {
-	size_t code;
-
-	code = read_it(chunk, 8, reader);
-	if (code)
-		return code;
-	chunk->m_length = reverse_byte_order_32(chunk->m_length);
-	if (reader->m_cursor + chunk->m_length > reader->m_length)
-	{
-		fprintf(stderr, "Input file ended");
-		return ERROR_INVALID_DATA;
-	}
-	chunk->m_data = reader->m_data + reader->m_cursor;
-	reader->m_cursor += chunk->m_length;
-	code = read_it(&chunk->m_crc, 4, reader);
-	if (code)
-		return code;
-	chunk->m_crc = reverse_byte_order_32(chunk->m_crc);
+	chunk_entry_t* m_entries;
+	int64_t m_count;
+	int64_t m_capacity;
+	size_t m_code;
+} chunk_list_t;
 
-	switch (chunk->m_type)
+static void add_chunk(uint32_t type, uint32_t length, int64_t offset, void* context)
+{
+	chunk_list_t* list = context;
+	if (list->m_count == list->m_capacity)
 	{
-	case IHDR:
-	case PLTE:
-	case IDAT:
-	case IEND:
-		break;
-	default:
-		if (!is_valid_chunk_type(chunk->m_type))
-		{
-			fprintf(stderr, "Invalid chunk type");
-			return ERROR_INVALID_DATA;
-		}
-		if (is_critical_chunk(chunk->m_type))
+		int64_t capacity = list->m_capacity ? list->m_capacity * 2 : 64;
+		chunk_entry_t* entries = realloc(list->m_entries, capacity * sizeof(chunk_entry_t));
+		if (!entries)
 		{
-			fprintf(stderr, "Invalid critical chunk");
-			return ERROR_INVALID_DATA;
+			list->m_code = ERROR_MEMORY;
+			return;
 		}
-		break;
+		list->m_entries = entries;
+		list->m_capacity = capacity;
 	}
-	return ERROR_SUCCESS;
+	chunk_entry_t entry = { type, length, offset };
+	list->m_entries[list->m_count++] = entry;
 }
 
-static size_t inflate_png_datastream(png_reader_t* reader)
+static void print_json_string(const char* text)
 {
-	size_t code;
-	code = ERROR_SUCCESS;
-
-	z_stream stream = { 0 };
-	stream.next_in = reader->m_compressed_data;
-	stream.avail_in = reader->m_compressed_data_length;	   // number of bytes available at next_in
-	stream.next_out = reader->m_filtered_data;
-	stream.avail_out = reader->m_filtered_data_length;	  // remaining free space at next_out
-	if (inflateInit(&stream))
-	{
-		fprintf(stderr, "inflateEnd failed");
-		code = ERROR_UNKNOWN;
-	}
-	else
-	{
-		if (inflate(&stream, 0) != Z_STREAM_END)
-		{
-			fprintf(stderr, "inflate failed");
-			code = ERROR_UNKNOWN;
-		}
-	}
-	if (inflateEnd(&stream))	// All dynamically allocated data structures for this stream are freed
-	{
-		fprintf(stderr, "inflateEnd failed");
-		code = ERROR_UNKNOWN;
+	putchar('"');
+	for (; *text; text++)
+	{
+		unsigned char c = (unsigned char)*text;
+		if ((c == '"') || (c == '\\'))
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
 	}
-	return code;
+	putchar('"');
 }
 
-typedef enum filter_type_t_tag
-{
-	None,
-	Sub,
-	Up,
-	Average,
-	Paeth,
-} filter_type_t;
-
-static size_t on_iend(png_t* png, png_reader_t* reader)
+// one JSON line: the IHDR fields and, with a chunk list, every chunk; or the error code
+static void probe(const char* path, chunk_list_t* chunks)
 {
 	size_t code;
 
-	int64_t bytes_per_pixel = (png->m_color_type & 0b010) + 1ll;
-	int64_t byte_width = png->m_width * bytes_per_pixel;	// bytes per line
-
-	// get filtered data from compressed data
-	int64_t filtered_data_width = byte_width + 1;
-	reader->m_filtered_data_length = filtered_data_width * png->m_height;
-	reader->m_filtered_data = malloc(reader->m_filtered_data_length);
-	if (!reader->m_filtered_data)
-	{
-		fprintf(stderr, "cannot allocate memory");
-		code = ERROR_MEMORY;
-	}
+	png_t png;
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		code = ERROR_NOT_FOUND;
 	else
 	{
-		code = inflate_png_datastream(reader);
-	}
-	if (code)
-		return code;
-
-	if (reader->m_compressed_data)
-	{
-		free(reader->m_compressed_data);
-		reader->m_compressed_data = 0;
-		reader->m_compressed_data_length = 0;
+		if (chunks)
+		{
+			chunks->m_count = 0;
+			chunks->m_code = ERROR_SUCCESS;
+		}
+		code = png_probe_file(&png, file, 0, chunks ? add_chunk : 0, chunks);
+		if (!code && chunks)
+			code = chunks->m_code;
+		fclose(file);
 	}
 
-	// get image data from filtered data
-	png->m_image_data = malloc(png->m_width * png->m_height * bytes_per_pixel);
-	if (!png->m_image_data)
+	printf("{\"file\":");
+	print_json_string(path);
+	if (code)
 	{
-		fprintf(stderr, "cannot allocate memory");
-		return ERROR_MEMORY;
+		printf(",\"error\":%d}\n", (int)code);
+		return;
 	}
-	int64_t output_length = 0;
-	for (int64_t y = 0; y < png->m_height; y++)
+	printf(",\"width\":%u,\"height\":%u,\"bit_depth\":%u,\"color_type\":%u,\"interlace\":%u",
+		   png.m_width,
+		   png.m_height,
+		   png.m_bit_depth,
+		   png.m_color_type,
+		   png.m_interlace_method);
+	if (chunks)
 	{
-		uint8_t filter = reader->m_filtered_data[y * filtered_data_width + 0];
-		for (int64_t x = 0; x < byte_width; x++)
+		printf(",\"chunks\":[");
+		for (int64_t i = 0; i < chunks->m_count; i++)
 		{
-			uint8_t left = 0;
-			uint8_t above = 0;
-			uint8_t upper_left = 0;
-			if (y > 0)
-			{
-				above = png->m_image_data[(y - 1) * byte_width + x];
-				if (x >= bytes_per_pixel)
-				{
-					upper_left = png->m_image_data[(y - 1) * byte_width + (x - bytes_per_pixel)];
-				}
-			}
-			if (x >= bytes_per_pixel)
-			{
-				left = png->m_image_data[y * byte_width + (x - bytes_per_pixel)];	 // Sub(x) = Raw(x) - Raw(x-bpp)
-			}
-			uint8_t delta;
-			switch (filter)
-			{
-			case None:
-				delta = 0;
-				break;
-			case Sub:
-				delta = left;
-				break;
-			case Up:
-				delta = above;
-				break;
-			case Average:
-				delta = (left + (int64_t)above) / 2;
-				break;
-				int64_t distance;
-			case Paeth:
-				distance = (int64_t)above + (int64_t)left - (int64_t)upper_left;	// Alan Paeth method
-				int64_t dist_l = llabs(distance - left);
-				int64_t dist_a = llabs(distance - above);
-				int64_t dist_ul = llabs(distance - upper_left);
-				if ((dist_l <= dist_a) && (dist_l <= dist_ul))
-					delta = left;
-				else if (dist_a <= dist_ul)
-					delta = above;
-				else
-					delta = upper_left;
-				break;
-			default:
-				fprintf(stderr, "Invalid filter type");
-				return ERROR_INVALID_DATA;
-			}
-			uint8_t value = (uint8_t)(delta + reader->m_filtered_data[y * filtered_data_width + (x + 1)]);
-			png->m_image_data[output_length++] = value;
+			// chunk types are checked to be ASCII letters, so they need no escaping
+			const chunk_entry_t* entry = chunks->m_entries + i;
+			printf("%s{\"type\":\"%.4s\",\"length\":%u,\"offset\":%lld}",
+				   i ? "," : "",
+				   (const char*)&entry->m_type,
+				   entry->m_length,
+				   (long long)entry->m_offset);
 		}
+		printf("]");
 	}
-	return code;
+	printf("}\n");
 }
 
-static size_t parse_png_data(png_t* png, png_reader_t* reader)
-{
-	size_t code;
-	int64_t magic;
-	int64_t signature = 0x0A1A0A0D474E5089ll;
-	code = read_it(&magic, 8, reader);
-	if (code)
-		return code;
-	if (magic != signature)
-	{
-		fprintf(stderr, "not a PNG signature");
-		return ERROR_INVALID_DATA;
-	}
-
-	png_chunk_t header_chunk;
-	code = read_chunk(&header_chunk, reader);
-	if (code)
-		return code;
+#define PROBE_PREFETCH 4096	// the first read of png_probe_file()
 
-	if (header_chunk.m_type != IHDR)
-	{
-		fprintf(stderr, "The first chunk must be IHDR");
-		return ERROR_INVALID_DATA;
-	}
-	if (header_chunk.m_length != 13)
-	{
-		fprintf(stderr, "invalid length of IHDR");
-		return ERROR_INVALID_DATA;
-	}
-
-	for (int64_t i = 0; i < 13; i++)
+// main --probe [--chunks] [file...]: JSON lines for the files, or for paths read from stdin one per
+// line; a file that fails to probe gets an error line and does not stop the scan. The next file is
+// prefetched while one is probed.
+static size_t probe_files(int argc, char* argv[])
+{
+	chunk_list_t list = { 0 };
+	chunk_list_t* chunks = 0;
+	if ((argc > 0) && !strcmp(argv[0], "--chunks"))
 	{
-		((uint8_t*)png)[i] = header_chunk.m_data[i];
+		chunks = &list;
+		argc--;
+		argv++;
 	}
-	png->m_width = reverse_byte_order_32(png->m_width);
-	png->m_height = reverse_byte_order_32(png->m_height);
+	static char output_buffer[1 << 16];
+	setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+	prefetch_t prefetch;
+	init_prefetch(&prefetch);
 
-	if (!png->m_width)
-	{
-		fprintf(stderr, "Image dimensions must be non zero");
-		return ERROR_INVALID_DATA;
-	}
-	if (!png->m_height)
-	{
-		fprintf(stderr, "Image dimensions must be non zero");
-		return ERROR_INVALID_DATA;
-	}
-	if (png->m_width & (1u << 31u))
-	{
-		fprintf(stderr, "Image dimensions must be less than (2^31)-1!");
-		return ERROR_INVALID_DATA;
-	}
-	if (png->m_height & (1u << 31u))
-	{
-		fprintf(stderr, "Image dimensions must be less than (2^31)-1!");
-		return ERROR_INVALID_DATA;
-	}
-	if ((png->m_bit_depth != 1) && (png->m_bit_depth != 2) && (png->m_bit_depth != 4) && (png->m_bit_depth != 8) &&
-		(png->m_bit_depth != 16))
-	{
-		fprintf(stderr, "Invalid bit depth");
-		return ERROR_INVALID_DATA;
-	}
-	if ((png->m_color_type != 0) && (png->m_color_type != 2) && (png->m_color_type != 3) && (png->m_color_type != 4) &&
-		(png->m_color_type != 6))
-	{
-		fprintf(stderr, "Invalid color type");
-		return ERROR_INVALID_DATA;
-	}
-	if (png->m_compression_method)
-	{
-		fprintf(stderr, "only compression method 0 is defined");
-		return ERROR_INVALID_DATA;
-	}
-	if (png->m_filter_method)
-	{
-		fprintf(stderr, "only filter method 0 is defined");
-		return ERROR_INVALID_DATA;
-	}
-	if ((png->m_interlace_method != 0) && (png->m_interlace_method != 1))
-	{
-		fprintf(stderr, "only 0 and 1 values are defined");
-		return ERROR_INVALID_DATA;
-	}
-	if ((png->m_color_type != 0) && (png->m_color_type != 2))
-	{
-		fprintf(stderr, "Unsupported color type");
-		return ERROR_INVALID_DATA;
-	}
-	if (png->m_bit_depth != 8)
-	{
-		fprintf(stderr, "Unsupported bit depth");
-		return ERROR_INVALID_DATA;
-	}
-	if (png->m_interlace_method)
-	{
-		fprintf(stderr, "Unsupported interlace method");
-		return ERROR_INVALID_DATA;
-	}
-	// decode
-	reader->m_compressed_data = 0;
-	reader->m_compressed_data_length = 0;
-	reader->m_filtered_data = 0;
-	reader->m_filtered_data_length = 0;
-	// parse remaining chunks
-	size_t running = 1;
-	while (running)
+	if (argc)
 	{
-		png_chunk_t chunk;
-		code = read_chunk(&chunk, reader);
-		if (code)
-			break;
-
-		switch (chunk.m_type)
+		for (int i = 0; i < argc; i++)
 		{
-		case IHDR:
-			fprintf(stderr, "must be 1 IHDR chunk!");
-			code = ERROR_INVALID_DATA;
-			running = 0;
-			break;
-		case PLTE:
-			fprintf(stderr, "unsupported PLTE chunk");
-			code = ERROR_INVALID_DATA;
-			running = 0;
-			break;
-			uint8_t* temp;
-		case IDAT:
-			temp = realloc(reader->m_compressed_data, reader->m_compressed_data_length + chunk.m_length);
-			if (!temp)
-			{
-				fprintf(stderr, "Can't allocate more memory");
-				code = ERROR_MEMORY;
-				running = 0;
-			}
-			else
-			{
-				reader->m_compressed_data = temp;
-				memcpy(reader->m_compressed_data + reader->m_compressed_data_length, chunk.m_data, chunk.m_length);
-				reader->m_compressed_data_length += chunk.m_length;
-			}
-			break;
-		case IEND:
-			running = 0;
-			if (chunk.m_length)
-			{
-				fprintf(stderr, "IEND chunk must have 0 data length");
-				code = ERROR_INVALID_DATA;
-			}
-			else
-			{
-				code = on_iend(png, reader);
-			}
-			break;
+			if (i + 1 < argc)
+				prefetch_file(&prefetch, argv[i + 1], PROBE_PREFETCH);
+			probe(argv[i], chunks);
 		}
 	}
-
-	if (reader->m_compressed_data)
-	{
-		free(reader->m_compressed_data);
-		reader->m_compressed_data = 0;
-		reader->m_compressed_data_length = 0;
-	}
-	if (reader->m_filtered_data)
-	{
-		free(reader->m_filtered_data);
-		reader->m_filtered_data = 0;
-		reader->m_filtered_data_length = 0;
-	}
-
-	return code;
-}
-
-size_t png_from_file_handle(png_t* png, FILE* file)
-{
-	size_t code;
-
-	png_reader_t reader;
-	reader.m_cursor = 0;
-	code = get_file_length(&reader.m_length, file);
-	if (!code)
+	else
 	{
-		reader.m_data = malloc(reader.m_length);
-		if (!reader.m_data)
+		// the line after the one being probed is read ahead, so its file can be prefetched
+		char paths[2][4096];
+		int current = 0;
+		int found = fgets(paths[current], sizeof(paths[current]), stdin) != 0;
+		while (found)
 		{
-			fprintf(stderr, "Can't allocate memory");
-			code = ERROR_MEMORY;
-		}
-		else
-		{
-			code = read_from_file(reader.m_data, reader.m_length, file);
-			if (!code)
+			paths[current][strcspn(paths[current], "\r\n")] = 0;
+			found = fgets(paths[!current], sizeof(paths[!current]), stdin) != 0;
+			if (found)
 			{
-				code = parse_png_data(png, &reader);
+				paths[!current][strcspn(paths[!current], "\r\n")] = 0;
+				if (paths[!current][0])
+					prefetch_file(&prefetch, paths[!current], PROBE_PREFETCH);
 			}
-
-			free(reader.m_data);
+			if (paths[current][0])
+				probe(paths[current], chunks);
+			current = !current;
 		}
 	}
-
-	return code;
-}
-
-static size_t write_decimal(FILE* file, int32_t value)
-{
-	if (fprintf(file, "%d ", value) < 0)
+	close_prefetch(&prefetch);
+	free(list.m_entries);
+	if (fflush(stdout))
 	{
-		fprintf(stderr, "fprintf failed");
+		fprintf(stderr, "fflush failed");
 		return ERROR_UNKNOWN;
 	}
 	return ERROR_SUCCESS;
 }
 
-static size_t write_to_file(void* buffer, size_t size, FILE* file)
-{
-	size_t bytes_written = fwrite(buffer, 1, size, file);
-	if (bytes_written != size)
-	{
-		fprintf(stderr, "fwrite failed");
-		return ERROR_UNKNOWN;
-	}
-	return ERROR_SUCCESS;
-}
-
-size_t save_png_as_pnm_by_file_handle(png_t* png, FILE* file)
-{
-	size_t code;
-
-	switch (png->m_color_type)
-	{
-	case 0:
-		code = write_to_file("P5 ", 3, file);
-		if (code)
-			return code;
-		break;
-	case 2:
-		code = write_to_file("P6 ", 3, file);
-		if (code)
-			return code;
-		break;
-	default:
-		fprintf(stderr, "Invalid PNG color type");
-		return ERROR_INVALID_PARAMETER;
-	}
-
-	code = write_decimal(file, png->m_width);
-	if (code)
-		return code;
-	code = write_decimal(file, png->m_height);
-	if (code)
-		return code;
-	code = write_decimal(file, 255);
-	if (code)
-		return code;
-	size_t bytes_per_pixel = (png->m_color_type & 0b010) + 1ll;
-	code = write_to_file(png->m_image_data, png->m_width * bytes_per_pixel * png->m_height, file);
-	return code;
-}
-
 int main(int argc, char* argv[])
 {
 	size_t code;
 
-	if (argc != 3)
+	if ((argc > 1) && !strcmp(argv[1], "--probe"))
+		return (int)probe_files(argc - 2, argv + 2);
+
+	png_options_t options;
+	png_encoder_options_t encoder_options;
+	int encode;
+	if (argc < 3)
 	{
 		fprintf(stderr, "Wrong number of arguments");
 		code = ERROR_INVALID_PARAMETER;
 	}
+	else if (parse_options(&options, &encoder_options, &encode, argc - 3, argv + 3))
+	{
+		code = ERROR_INVALID_PARAMETER;
+	}
 	else
 	{
 		FILE* input_file = fopen(argv[1], "rb");
+		output_file_t output;
 		if (!input_file)
 		{
 			fprintf(stderr, "Can't open an input file");
-			code = ERROR_NOT_FOUND;
+			code = get_io_error(errno);
+		}
+		else if ((code = open_output(&output, argv[2], "wb")))
+		{
+			fprintf(stderr, "Can't open an output file");
+			fclose(input_file);
 		}
 		else
 		{
-			FILE* output_file = fopen(argv[2], "wb");
-			if (!output_file)
-			{
-				fprintf(stderr, "Can't open an output file");
-				code = ERROR_NOT_FOUND;
-			}
-			else
+			FILE* output_file = output.m_file;
+			if (encode)
 			{
 				png_t png;
-				code = png_from_file_handle(&png, input_file);
+				code = load_pnm_by_file_handle(&png, input_file);
 				if (!code)
 				{
-					code = save_png_as_pnm_by_file_handle(&png, output_file);
+					code = save_png_by_file_handle(&png, output_file, &encoder_options);
+					free(png.m_image_data);
 				}
-
-				if (png.m_image_data)
+			}
+			else
+			{
+				png_decoder_t* decoder;
+				code = png_decoder_create(&decoder, &options);
+				if (!code)
 				{
-					free(png.m_image_data);
+					png_t png = { 0 };
+					code = png_decode_file(decoder, &png, input_file);
+					if (!code && ((png.m_layout == LayoutPlanar) || (png.m_layout == LayoutFloat)))
+					{
+						code = save_png_as_raw_by_file_handle(&png, output_file);
+					}
+					else if (!code)
+					{
+						code = save_png_as_pnm_by_file_handle(&png, output_file);
+					}
+
+					png_release_image(decoder, &png);
+					png_decoder_destroy(decoder);
 				}
-				fclose(output_file);
+			}
+			if (close_output(&output) && !code)
+			{
+				fprintf(stderr, "Can't write the output file");
+				code = ERROR_UNKNOWN;
 			}
 			fclose(input_file);
 		}
@@ -0,0 +1,1817 @@
+#include "png_internal.h"
+
+#include "crc32.h"
+#include "../common/return_codes.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t read_from_file(void* buffer, size_t size, FILE* file)
+{
+	size_t bytes_read = fread(buffer, 1, size, file);
+	if (bytes_read != size)
+	{
+		fprintf(stderr, "fread failed");
+		return ERROR_INVALID_DATA;
+	}
+	return ERROR_SUCCESS;
+}
+
+size_t get_file_length(int64_t* length, FILE* file)
+{
+	if (fseek(file, 0, SEEK_END))
+	{
+		fprintf(stderr, "fseek failed");
+		return ERROR_UNKNOWN;
+	}
+	*length = ftell(file);
+	if (*length == -1)
+	{
+		fprintf(stderr, "ftell failed");
+		return ERROR_UNKNOWN;
+	}
+	if (fseek(file, 0, SEEK_SET))
+	{
+		fprintf(stderr, "fseek failed");
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
+
+static size_t is_valid_chunk_type(uint32_t chunk_type)
+{
+	for (int64_t i = 0; i < 4; i++)
+	{
+		uint32_t c = (chunk_type >> (0x08 * i)) & 0xFF;
+		if (!(((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z'))))
+			return 0;
+	}
+	return 1;
+}
+
+static size_t is_critical_chunk(uint32_t chunk_type)
+{
+	return !(chunk_type & (1 << (8 * 0 + 5)));	 // ancillary bit is bit 5 of the first type byte
+}
+
+#define POOLED_IMAGES 4
+#define POOL_HEADER 64	  // keeps pooled images 64-byte aligned
+
+struct png_decoder_t_tag
+{
+	png_options_t m_options;
+	z_stream m_stream;	  // initialized once, reset per image
+
+	// scratch buffers only ever grow
+	uint8_t* m_file_data;
+	int64_t m_file_capacity;
+	uint8_t* m_filtered_data;
+	int64_t m_filtered_capacity;
+	uint8_t* m_rows;
+	int64_t m_rows_capacity;
+	uint8_t* m_sums;	// box filter of region decoding
+	int64_t m_sums_capacity;
+
+	// released images, each block starts with its capacity
+	uint8_t* m_pool[POOLED_IMAGES];
+};
+
+static size_t read_it(void* buffer, int64_t length, png_reader_t* reader)
+{
+	if (reader->m_cursor + length > reader->m_length)
+	{
+		fprintf(stderr, "Input file ended");
+		return ERROR_INVALID_DATA;
+	}
+	memcpy(buffer, reader->m_data + reader->m_cursor, length);
+	reader->m_cursor += length;
+	return ERROR_SUCCESS;
+}
+
+size_t read_chunk(png_chunk_t* chunk, png_reader_t* reader)
+{
+	size_t code;
+
+	code = read_it(chunk, 8, reader);
+	if (code)
+		return code;
+	chunk->m_length = reverse_byte_order_32(chunk->m_length);
+	if (reader->m_cursor + chunk->m_length > reader->m_length)
+	{
+		fprintf(stderr, "Input file ended");
+		return ERROR_INVALID_DATA;
+	}
+	chunk->m_data = reader->m_data + reader->m_cursor;
+	reader->m_cursor += chunk->m_length;
+	code = read_it(&chunk->m_crc, 4, reader);
+	if (code)
+		return code;
+	chunk->m_crc = reverse_byte_order_32(chunk->m_crc);
+
+	verify_mode_t verify = reader->m_options->m_verify;
+	if ((verify == VerifyAll) || ((verify == VerifyCritical) && is_critical_chunk(chunk->m_type)))
+	{
+		// CRC covers the chunk type and data fields, which are adjacent in the input
+		if (crc32_calculate(0, chunk->m_data - 4, chunk->m_length + 4ll) != chunk->m_crc)
+		{
+			fprintf(stderr, "Chunk CRC mismatch");
+			return ERROR_INVALID_DATA;
+		}
+	}
+
+	switch (chunk->m_type)
+	{
+	case IHDR:
+	case PLTE:
+	case IDAT:
+	case IEND:
+		break;
+	default:
+		if (!is_valid_chunk_type(chunk->m_type))
+		{
+			fprintf(stderr, "Invalid chunk type");
+			return ERROR_INVALID_DATA;
+		}
+		if (is_critical_chunk(chunk->m_type))
+		{
+			fprintf(stderr, "Invalid critical chunk");
+			return ERROR_INVALID_DATA;
+		}
+		break;
+	}
+	return ERROR_SUCCESS;
+}
+
+// grows a decoder buffer, the contents are not kept
+static size_t reserve_buffer(uint8_t** buffer, int64_t* capacity, int64_t size)
+{
+	if (size <= *capacity)
+		return ERROR_SUCCESS;
+	free(*buffer);
+	*buffer = malloc(size);
+	if (!*buffer)
+	{
+		*capacity = 0;
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	*capacity = size;
+	return ERROR_SUCCESS;
+}
+
+// resets the decoder's inflate stream to the first IDAT chunk
+static void start_inflate(png_reader_t* reader)
+{
+	z_stream* stream = &reader->m_decoder->m_stream;
+	inflateReset(stream);
+	stream->avail_in = 0;
+	reader->m_idat_cursor = reader->m_idat_start;
+}
+
+// hands the next IDAT payload to inflate; read_chunk has already checked every chunk up to IEND
+static void feed_next_idat(png_reader_t* reader, z_stream* stream)
+{
+	while (reader->m_idat_cursor < reader->m_idat_end)
+	{
+		const uint8_t* header = reader->m_data + reader->m_idat_cursor;
+		uint32_t length;
+		uint32_t type;
+		memcpy(&length, header, 4);
+		memcpy(&type, header + 4, 4);
+		length = reverse_byte_order_32(length);
+		reader->m_idat_cursor += 12 + (int64_t)length;
+		if ((type == IDAT) && length)
+		{
+			stream->next_in = (uint8_t*)header + 8;
+			stream->avail_in = length;	  // number of bytes available at next_in
+			return;
+		}
+	}
+}
+
+// inflates exactly length bytes of the stream, with end_of_stream the stream must also end there
+static size_t inflate_stream(png_reader_t* reader, uint8_t* output, int64_t length, int32_t end_of_stream)
+{
+	z_stream* stream = &reader->m_decoder->m_stream;
+	stream->next_out = output;
+	stream->avail_out = length;	   // remaining free space at next_out
+	int result = Z_OK;
+	while ((result == Z_OK) && (stream->avail_out || end_of_stream))
+	{
+		if (!stream->avail_in)
+		{
+			feed_next_idat(reader, stream);
+			if (!stream->avail_in)
+				break;
+		}
+		result = inflate(stream, Z_SYNC_FLUSH);
+	}
+	if (((result != Z_OK) && (result != Z_STREAM_END)) || (end_of_stream && (result != Z_STREAM_END)) || stream->avail_out)
+	{
+		fprintf(stderr, "inflate failed");
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
+
+static size_t inflate_png_datastream(png_reader_t* reader)
+{
+	start_inflate(reader);
+	return inflate_stream(reader, reader->m_filtered_data, reader->m_filtered_data_length, 1);
+}
+
+static size_t inflate_part(png_reader_t* reader, uint8_t* output, int64_t length)
+{
+	if (!length)
+		return ERROR_SUCCESS;
+	return inflate_stream(reader, output, length, 0);
+}
+
+static int64_t get_samples_per_pixel(uint8_t color_type)
+{
+	switch (color_type)
+	{
+	case 0:
+	case 3:
+		return 1;
+	case 4:
+		return 2;
+	case 2:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+static void set_output_format(png_t* png)
+{
+	png->m_layout = LayoutPacked;
+	png->m_channels = get_samples_per_pixel(png->m_color_type);
+	png->m_sample_bytes = png->m_bit_depth == 16 ? 2 : 1;
+	png->m_max_value = (1u << png->m_bit_depth) - 1;
+	if (png->m_color_type == 3)
+	{
+		png->m_channels = png->m_has_transparency ? 4 : 3;
+		png->m_max_value = 255;
+	}
+	else if (png->m_has_transparency)
+	{
+		png->m_channels++;
+		if ((png->m_color_type == 0) && (png->m_bit_depth <= 8))
+		{
+			// greyscale with a transparent key expands through the palette table as (grey, alpha)
+			for (int64_t i = 0; i <= png->m_max_value; i++)
+			{
+				png->m_palette[i * 4 + 0] = (uint8_t)i;
+				png->m_palette[i * 4 + 1] = i == png->m_transparent[0] ? 0 : png->m_max_value;
+			}
+		}
+	}
+}
+
+static size_t is_direct_format(const png_t* png)
+{
+	return (png->m_bit_depth >= 8) && (png->m_color_type != 3) && !png->m_has_transparency;
+}
+
+// unpack_table[d][b] holds the samples of byte b at bit depth 1 << d, first sample in the most significant bits
+static uint8_t unpack_table[3][256][8];
+static once_t unpack_table_once = ONCE_INIT;
+
+static void build_unpack_table(void)
+{
+	for (int64_t d = 0; d < 3; d++)
+	{
+		int64_t depth = 1ll << d;
+		for (int64_t b = 0; b < 256; b++)
+		{
+			for (int64_t i = 0; i < 8 / depth; i++)
+			{
+				unpack_table[d][b][i] = (b >> (8 - depth * (i + 1))) & ((1 << depth) - 1);
+			}
+		}
+	}
+}
+
+#if defined __SSE2__
+// 16 input bytes per step, the sample planes are interleaved back into pixel order
+static int64_t unpack_samples_sse2(uint8_t* output, const uint8_t* input, int64_t length, uint8_t depth)
+{
+	int64_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(input + i));
+		if (depth == 4)
+		{
+			__m128i mask = _mm_set1_epi8(0x0F);
+			__m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+			__m128i low = _mm_and_si128(v, mask);
+			_mm_storeu_si128((__m128i*)(output + i * 2 + 0x00), _mm_unpacklo_epi8(high, low));
+			_mm_storeu_si128((__m128i*)(output + i * 2 + 0x10), _mm_unpackhi_epi8(high, low));
+		}
+		else if (depth == 2)
+		{
+			__m128i mask = _mm_set1_epi8(0x03);
+			__m128i p0 = _mm_and_si128(_mm_srli_epi16(v, 6), mask);
+			__m128i p1 = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+			__m128i p2 = _mm_and_si128(_mm_srli_epi16(v, 2), mask);
+			__m128i p3 = _mm_and_si128(v, mask);
+			__m128i p01_low = _mm_unpacklo_epi8(p0, p1);
+			__m128i p01_high = _mm_unpackhi_epi8(p0, p1);
+			__m128i p23_low = _mm_unpacklo_epi8(p2, p3);
+			__m128i p23_high = _mm_unpackhi_epi8(p2, p3);
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 0x00), _mm_unpacklo_epi16(p01_low, p23_low));
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 0x10), _mm_unpackhi_epi16(p01_low, p23_low));
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 0x20), _mm_unpacklo_epi16(p01_high, p23_high));
+			_mm_storeu_si128((__m128i*)(output + i * 4 + 0x30), _mm_unpackhi_epi16(p01_high, p23_high));
+		}
+		else
+		{
+			__m128i mask = _mm_set1_epi8(0x01);
+			__m128i p[8];
+			for (int k = 0; k < 8; k++)
+				p[k] = _mm_and_si128(_mm_srli_epi16(v, 7 - k), mask);
+			__m128i pairs[8];
+			for (int k = 0; k < 4; k++)
+			{
+				pairs[k * 2 + 0] = _mm_unpacklo_epi8(p[k * 2], p[k * 2 + 1]);
+				pairs[k * 2 + 1] = _mm_unpackhi_epi8(p[k * 2], p[k * 2 + 1]);
+			}
+			// pairs[2k + h] holds bit planes 2k, 2k + 1 of the low (h = 0) or high input half
+			for (int h = 0; h < 2; h++)
+			{
+				__m128i q0_low = _mm_unpacklo_epi16(pairs[0 + h], pairs[2 + h]);
+				__m128i q0_high = _mm_unpackhi_epi16(pairs[0 + h], pairs[2 + h]);
+				__m128i q1_low = _mm_unpacklo_epi16(pairs[4 + h], pairs[6 + h]);
+				__m128i q1_high = _mm_unpackhi_epi16(pairs[4 + h], pairs[6 + h]);
+				uint8_t* target = output + i * 8 + h * 64;
+				_mm_storeu_si128((__m128i*)(target + 0x00), _mm_unpacklo_epi32(q0_low, q1_low));
+				_mm_storeu_si128((__m128i*)(target + 0x10), _mm_unpackhi_epi32(q0_low, q1_low));
+				_mm_storeu_si128((__m128i*)(target + 0x20), _mm_unpacklo_epi32(q0_high, q1_high));
+				_mm_storeu_si128((__m128i*)(target + 0x30), _mm_unpackhi_epi32(q0_high, q1_high));
+			}
+		}
+	}
+	return i;
+}
+#endif
+
+// expands 1, 2 or 4-bit samples to one byte each; writes up to 7 bytes past count
+static void unpack_samples(uint8_t* output, const uint8_t* input, int64_t count, uint8_t depth)
+{
+	int64_t samples_per_byte = 8 / depth;
+	int64_t length = (count + samples_per_byte - 1) / samples_per_byte;
+	int64_t table_index = depth == 1 ? 0 : depth == 2 ? 1 : 2;
+	int64_t i = 0;
+#if defined __SSE2__
+	i = unpack_samples_sse2(output, input, length, depth);
+#endif
+	for (; i < length; i++)
+	{
+		memcpy(output + i * samples_per_byte, unpack_table[table_index][input[i]], 8);
+	}
+}
+
+// table lookup of 4-byte entries; writes up to 4 - pixel_bytes bytes past the last pixel
+static inline void expand_palette(uint8_t* output, const uint8_t* input, int64_t count, const uint8_t* palette, int64_t pixel_bytes)
+{
+	for (int64_t x = 0; x < count; x++)
+	{
+		memcpy(output, palette + input[x] * 4, 4);
+		output += pixel_bytes;
+	}
+}
+
+// appends alpha to greyscale or truecolor pixels, transparent where all samples match the tRNS key
+static void expand_transparent(uint8_t* output, const uint8_t* input, int64_t count, const png_t* png)
+{
+	int64_t samples = png->m_channels - 1;
+	int64_t sample_bytes = png->m_sample_bytes;
+	for (int64_t x = 0; x < count; x++)
+	{
+		size_t opaque = 0;
+		for (int64_t c = 0; c < samples; c++)
+		{
+			uint16_t value = sample_bytes == 2 ? (input[0] << 8) | input[1] : input[0];
+			opaque |= value != png->m_transparent[c];
+			memcpy(output, input, sample_bytes);
+			output += sample_bytes;
+			input += sample_bytes;
+		}
+		uint16_t alpha = opaque ? png->m_max_value : 0;
+		output[0] = (uint8_t)(alpha >> (8 * (sample_bytes - 1)));
+		output[sample_bytes - 1] = (uint8_t)alpha;
+		output += sample_bytes;
+	}
+}
+
+static void expand_row(uint8_t* output, const uint8_t* input, int64_t count, uint8_t* samples, const png_t* png)
+{
+	if (png->m_bit_depth < 8)
+	{
+		if ((png->m_color_type == 0) && !png->m_has_transparency)
+		{
+			unpack_samples(output, input, count, png->m_bit_depth);
+			return;
+		}
+		unpack_samples(samples, input, count, png->m_bit_depth);
+		input = samples;
+	}
+	if ((png->m_color_type == 3) || ((png->m_color_type == 0) && (png->m_bit_depth <= 8)))
+	{
+		switch (png->m_channels)
+		{
+		case 2:
+			expand_palette(output, input, count, png->m_palette, 2);
+			break;
+		case 3:
+			expand_palette(output, input, count, png->m_palette, 3);
+			break;
+		default:
+			expand_palette(output, input, count, png->m_palette, 4);
+			break;
+		}
+	}
+	else
+	{
+		expand_transparent(output, input, count, png);
+	}
+}
+
+// Reconstructs one row. output may be input itself or lie before it: every input byte is read
+// before that position of output is written. prior is the reconstructed row above, null for the first row.
+size_t unfilter_row(uint8_t* output, const uint8_t* input, const uint8_t* prior, int64_t byte_width, int64_t bytes_per_pixel, uint8_t filter)
+{
+	int64_t x;
+	if (!prior)
+	{
+		// the row above the image is zero
+		if (filter == Up)
+			filter = None;
+		else if (filter == Paeth)
+			filter = Sub;
+	}
+	switch (filter)
+	{
+	case None:
+		if (output != input)
+			memmove(output, input, byte_width);
+		break;
+	case Sub:
+		for (x = 0; x < bytes_per_pixel; x++)
+			output[x] = input[x];
+		for (; x < byte_width; x++)
+			output[x] = input[x] + output[x - bytes_per_pixel];
+		break;
+	case Up:
+		for (x = 0; x < byte_width; x++)
+			output[x] = input[x] + prior[x];
+		break;
+	case Average:
+		if (!prior)
+		{
+			for (x = 0; x < bytes_per_pixel; x++)
+				output[x] = input[x];
+			for (; x < byte_width; x++)
+				output[x] = input[x] + (output[x - bytes_per_pixel] >> 1);
+			break;
+		}
+		for (x = 0; x < bytes_per_pixel; x++)
+			output[x] = input[x] + (prior[x] >> 1);
+		for (; x < byte_width; x++)
+			output[x] = input[x] + ((output[x - bytes_per_pixel] + prior[x]) >> 1);
+		break;
+	case Paeth:
+		for (x = 0; x < bytes_per_pixel; x++)
+			output[x] = input[x] + prior[x];
+		for (; x < byte_width; x++)
+			output[x] = input[x] + paeth_predictor(output[x - bytes_per_pixel], prior[x], prior[x - bytes_per_pixel]);
+		break;
+	default:
+		fprintf(stderr, "Invalid filter type");
+		return ERROR_INVALID_DATA;
+	}
+	return ERROR_SUCCESS;
+}
+
+// Unfilters rows in place, each row stays after its filter byte
+static size_t unfilter_in_place(uint8_t* data, int64_t byte_width, int64_t height, int64_t bytes_per_pixel)
+{
+	int64_t filtered_data_width = byte_width + 1;
+	for (int64_t y = 0; y < height; y++)
+	{
+		uint8_t* row = data + y * filtered_data_width + 1;
+		size_t code = unfilter_row(row, row, y ? row - filtered_data_width : 0, byte_width, bytes_per_pixel, row[-1]);
+		if (code)
+			return code;
+	}
+	return ERROR_SUCCESS;
+}
+
+// Unfilters rows and packs them over the filter bytes, row y moves from y * (byte_width + 1) + 1 to y * byte_width
+static size_t unfilter_and_compact(uint8_t* data, int64_t byte_width, int64_t height, int64_t bytes_per_pixel)
+{
+	int64_t filtered_data_width = byte_width + 1;
+	for (int64_t y = 0; y < height; y++)
+	{
+		const uint8_t* input = data + y * filtered_data_width + 1;
+		uint8_t* output = data + y * byte_width;
+		size_t code = unfilter_row(output, input, y ? output - byte_width : 0, byte_width, bytes_per_pixel, input[-1]);
+		if (code)
+			return code;
+	}
+	return ERROR_SUCCESS;
+}
+
+// reduced image of one Adam7 pass, or the whole image when not interlaced
+typedef struct pass_t_tag
+{
+	int64_t m_x;	// position of the first pixel and pixel spacing in the full image
+	int64_t m_y;
+	int64_t m_dx;
+	int64_t m_dy;
+	int64_t m_width;
+	int64_t m_height;
+	int64_t m_byte_width;
+	int64_t m_filtered_offset;	  // start in the inflated stream
+} pass_t;
+
+static const uint8_t adam7[7][4] = {
+	{ 0, 0, 8, 8 },
+	{ 4, 0, 8, 8 },
+	{ 0, 4, 4, 8 },
+	{ 2, 0, 4, 4 },
+	{ 0, 2, 2, 4 },
+	{ 1, 0, 2, 2 },
+	{ 0, 1, 1, 2 },
+};
+
+// fills count + 1 entries, the last one only holds the total length
+static int64_t get_passes(pass_t* passes, const png_t* png, int64_t bits_per_pixel)
+{
+	int64_t count = png->m_interlace_method ? 7 : 1;
+	int64_t filtered_offset = 0;
+	for (int64_t p = 0; p < count; p++)
+	{
+		pass_t* pass = passes + p;
+		pass->m_x = png->m_interlace_method ? adam7[p][0] : 0;
+		pass->m_y = png->m_interlace_method ? adam7[p][1] : 0;
+		pass->m_dx = png->m_interlace_method ? adam7[p][2] : 1;
+		pass->m_dy = png->m_interlace_method ? adam7[p][3] : 1;
+		pass->m_width = png->m_width > pass->m_x ? (png->m_width - pass->m_x + pass->m_dx - 1) / pass->m_dx : 0;
+		pass->m_height = png->m_height > pass->m_y ? (png->m_height - pass->m_y + pass->m_dy - 1) / pass->m_dy : 0;
+		if (!pass->m_width || !pass->m_height)
+		{
+			// empty passes have no filter bytes either
+			pass->m_width = 0;
+			pass->m_height = 0;
+		}
+		pass->m_byte_width = (pass->m_width * bits_per_pixel + 7) / 8;
+		pass->m_filtered_offset = filtered_offset;
+		filtered_offset += (pass->m_byte_width + 1) * pass->m_height;
+	}
+	passes[count].m_filtered_offset = filtered_offset;
+	return count;
+}
+
+static inline void scatter_pixels(uint8_t* target, const uint8_t* pixels, int64_t count, int64_t pixel_bytes, int64_t dx)
+{
+	for (int64_t x = 0; x < count; x++)
+	{
+		memcpy(target + x * dx * pixel_bytes, pixels + x * pixel_bytes, pixel_bytes);
+	}
+}
+
+// places one row of a pass into its row of the full image, specialized by pixel size and spacing
+static void scatter_row(uint8_t* image_row, const uint8_t* pixels, const pass_t* pass, int64_t pixel_bytes)
+{
+	uint8_t* target = image_row + pass->m_x * pixel_bytes;
+	int64_t count = pass->m_width;
+	if (pass->m_dx == 1)
+	{
+		memcpy(target, pixels, count * pixel_bytes);
+		return;
+	}
+	switch (pixel_bytes)
+	{
+#define SCATTER_CASE(n)                                        \
+	case n:                                                    \
+		if (pass->m_dx == 8)                                   \
+			scatter_pixels(target, pixels, count, n, 8);       \
+		else if (pass->m_dx == 4)                              \
+			scatter_pixels(target, pixels, count, n, 4);       \
+		else                                                   \
+			scatter_pixels(target, pixels, count, n, 2);       \
+		break;
+
+		SCATTER_CASE(1)
+		SCATTER_CASE(2)
+		SCATTER_CASE(3)
+		SCATTER_CASE(4)
+		SCATTER_CASE(6)
+		SCATTER_CASE(8)
+#undef SCATTER_CASE
+	default:
+		scatter_pixels(target, pixels, count, pixel_bytes, pass->m_dx);
+		break;
+	}
+}
+
+// expands (if needed) and places the rows [first, last) of a pass unfiltered in place
+static void scatter_pass_rows(png_t* png, const pass_t* pass, const uint8_t* data, int64_t first, int64_t last, uint8_t* row, uint8_t* samples)
+{
+	int64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	int64_t image_width = png->m_width * pixel_bytes;
+	for (int64_t r = first; r < last; r++)
+	{
+		const uint8_t* pixels = data + pass->m_filtered_offset + r * (pass->m_byte_width + 1) + 1;
+		if (!is_direct_format(png))
+		{
+			expand_row(row, pixels, pass->m_width, samples, png);
+			pixels = row;
+		}
+		scatter_row(png->m_image_data + (pass->m_y + r * pass->m_dy) * image_width, pixels, pass, pixel_bytes);
+	}
+}
+
+// decodes pass after pass, publishing each one before the next is inflated
+static size_t decode_progressive(png_t* png, png_reader_t* reader, const pass_t* passes, int64_t bytes_per_pixel, uint8_t* row, uint8_t* samples)
+{
+	size_t code = ERROR_SUCCESS;
+
+	start_inflate(reader);
+	for (int64_t p = 0; (p < 7) && !code; p++)
+	{
+		const pass_t* pass = passes + p;
+		uint8_t* filtered = reader->m_filtered_data + pass->m_filtered_offset;
+		code = inflate_part(reader, filtered, (pass->m_byte_width + 1) * pass->m_height);
+		if (!code)
+			code = unfilter_in_place(filtered, pass->m_byte_width, pass->m_height, bytes_per_pixel);
+		if (!code)
+		{
+			scatter_pass_rows(png, pass, reader->m_filtered_data, 0, pass->m_height, row, samples);
+			reader->m_options->m_on_pass(png, (int32_t)p + 1, reader->m_options->m_on_pass_context);
+		}
+	}
+	return code;
+}
+
+// decodes all passes at once: they are unfiltered in parallel, then scattered in 8-row bands
+// so every band of the image stays in cache while all seven passes write into it
+static size_t decode_interlaced(png_t* png, png_reader_t* reader, const pass_t* passes, int64_t bytes_per_pixel)
+{
+	size_t code = inflate_png_datastream(reader);
+	if (code)
+		return code;
+
+	size_t codes[7];
+	PARALLEL_FOR
+	for (int64_t p = 0; p < 7; p++)
+	{
+		const pass_t* pass = passes + p;
+		codes[p] = unfilter_in_place(reader->m_filtered_data + pass->m_filtered_offset, pass->m_byte_width, pass->m_height, bytes_per_pixel);
+	}
+	for (int64_t p = 0; p < 7; p++)
+	{
+		if (codes[p])
+			return codes[p];
+	}
+
+	// expansion rows and samples for every thread
+	int64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	int64_t row_length = png->m_width * pixel_bytes + 8;
+	int64_t samples_length = png->m_width + 8ll;
+	png_decoder_t* decoder = reader->m_decoder;
+	code = reserve_buffer(&decoder->m_rows, &decoder->m_rows_capacity, (row_length + samples_length) * THREAD_COUNT);
+	if (code)
+		return code;
+
+	int64_t band_count = (png->m_height + 7) / 8;
+	PARALLEL_FOR
+	for (int64_t band = 0; band < band_count; band++)
+	{
+		uint8_t* row = decoder->m_rows + (row_length + samples_length) * THREAD_INDEX;
+		uint8_t* samples = row + row_length;
+		for (int64_t p = 0; p < 7; p++)
+		{
+			// every pass has 8 / dy rows in each band
+			const pass_t* pass = passes + p;
+			int64_t first = band * 8 / pass->m_dy;
+			int64_t last = first + 8 / pass->m_dy;
+			scatter_pass_rows(png, pass, reader->m_filtered_data, first, last < pass->m_height ? last : pass->m_height, row, samples);
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+// rows stream through a two-row ring and are expanded straight into the image
+static size_t decode_expanded(png_t* png, png_reader_t* reader, int64_t byte_width, int64_t bytes_per_pixel)
+{
+	size_t code;
+
+	int64_t filtered_data_width = byte_width + 1;
+	int64_t output_width = (int64_t)png->m_width * png->m_channels * png->m_sample_bytes;
+	png_decoder_t* decoder = reader->m_decoder;
+	code = reserve_buffer(&decoder->m_rows, &decoder->m_rows_capacity, filtered_data_width * 2 + png->m_width + 8);
+	if (code)
+		return code;
+	uint8_t* ring = decoder->m_rows;
+	uint8_t* samples = ring + filtered_data_width * 2;
+
+	start_inflate(reader);
+	for (int64_t y = 0; (y < png->m_height) && !code; y++)
+	{
+		uint8_t* row = ring + (y & 1) * filtered_data_width;
+		uint8_t* prior = ring + ((y + 1) & 1) * filtered_data_width + 1;
+		code = inflate_part(reader, row, filtered_data_width);
+		if (!code)
+			code = unfilter_row(row + 1, row + 1, y ? prior : 0, byte_width, bytes_per_pixel, row[0]);
+		if (!code)
+			expand_row(png->m_image_data + y * output_width, row + 1, png->m_width, samples, png);
+	}
+	return code;
+}
+
+// as decode_expanded, every row is converted to the layout while it is still in cache
+static size_t decode_converted(png_t* png, png_reader_t* reader, int64_t byte_width, int64_t bytes_per_pixel, png_layout_t layout)
+{
+	size_t code;
+
+	int64_t filtered_data_width = byte_width + 1;
+	int64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	int64_t expanded_length = is_direct_format(png) ? 0 : png->m_width * pixel_bytes + 8;
+	int64_t samples_length = png->m_width + 8;
+	png_decoder_t* decoder = reader->m_decoder;
+	code = reserve_buffer(&decoder->m_rows,
+						  &decoder->m_rows_capacity,
+						  filtered_data_width * 2 + expanded_length + samples_length + png->m_width * png->m_channels);
+	if (code)
+		return code;
+	uint8_t* ring = decoder->m_rows;
+	uint8_t* expanded = ring + filtered_data_width * 2;
+	uint8_t* samples = expanded + expanded_length;
+	uint8_t* scratch = samples + samples_length;
+
+	start_inflate(reader);
+	for (int64_t y = 0; (y < png->m_height) && !code; y++)
+	{
+		uint8_t* row = ring + (y & 1) * filtered_data_width;
+		uint8_t* prior = ring + ((y + 1) & 1) * filtered_data_width + 1;
+		code = inflate_part(reader, row, filtered_data_width);
+		if (!code)
+			code = unfilter_row(row + 1, row + 1, y ? prior : 0, byte_width, bytes_per_pixel, row[0]);
+		if (code)
+			break;
+		const uint8_t* pixels = row + 1;
+		if (expanded_length)
+		{
+			expand_row(expanded, row + 1, png->m_width, samples, png);
+			pixels = expanded;
+		}
+		convert_row(png->m_image_data, pixels, y, png, layout, scratch);
+	}
+	return code;
+}
+
+// Box filter over region rows: each row is added to per-sample sums, which become an output
+// row after every scale rows and after the last row of the region
+typedef struct region_writer_t_tag
+{
+	uint8_t* m_output;	  // next output row
+	uint32_t* m_sums;
+	int64_t m_width;	// of the region, in pixels
+	int64_t m_rows;	   // region rows in m_sums
+	int64_t m_channels;
+	int64_t m_sample_bytes;
+	int64_t m_scale;
+} region_writer_t;
+
+static void write_region_row(region_writer_t* writer, const uint8_t* pixels, int32_t last)
+{
+	int64_t pixel_bytes = writer->m_channels * writer->m_sample_bytes;
+	if (writer->m_scale == 1)
+	{
+		memcpy(writer->m_output, pixels, writer->m_width * pixel_bytes);
+		writer->m_output += writer->m_width * pixel_bytes;
+		return;
+	}
+
+	int64_t channels = writer->m_channels;
+	uint32_t* sums = writer->m_sums;
+	int64_t box_samples = writer->m_scale * channels;
+	int64_t row_samples = writer->m_width * channels;
+	if (writer->m_sample_bytes == 2)
+	{
+		for (int64_t i = 0; i < row_samples; i++)
+		{
+			sums[i / box_samples * channels + i % channels] += (pixels[2 * i] << 8) | pixels[2 * i + 1];
+		}
+	}
+	else
+	{
+		// whole boxes sample by sample into the channel sums, then the cut box at the edge
+		int64_t i = 0;
+		for (; i + box_samples <= row_samples; i += box_samples, sums += channels)
+		{
+			for (int64_t j = 0; j < box_samples; j += channels)
+			{
+				for (int64_t c = 0; c < channels; c++)
+					sums[c] += pixels[i + j + c];
+			}
+		}
+		for (int64_t j = 0; i + j < row_samples; j += channels)
+		{
+			for (int64_t c = 0; c < channels; c++)
+				sums[c] += pixels[i + j + c];
+		}
+		sums = writer->m_sums;
+	}
+	if (++writer->m_rows < writer->m_scale && !last)
+		return;
+
+	int64_t output_width = (writer->m_width + writer->m_scale - 1) / writer->m_scale;
+	uint8_t* output = writer->m_output;
+	for (int64_t x = 0; x < output_width; x++)
+	{
+		int64_t columns = writer->m_width - x * writer->m_scale;
+		uint32_t count = (uint32_t)((columns < writer->m_scale ? columns : writer->m_scale) * writer->m_rows);
+		for (int64_t c = 0; c < channels; c++)
+		{
+			uint32_t value = (sums[x * channels + c] + count / 2) / count;
+			if (writer->m_sample_bytes == 2)
+				*output++ = (uint8_t)(value >> 8);
+			*output++ = (uint8_t)value;
+		}
+	}
+	memset(sums, 0, output_width * channels * sizeof(uint32_t));
+	writer->m_output = output;
+	writer->m_rows = 0;
+}
+
+// the region and scale of the options checked against the image, the output image size
+static size_t get_region(png_region_t* region, int64_t* output_width, int64_t* output_height, const png_t* png, const png_options_t* options)
+{
+	*region = options->m_region;
+	if (!region->m_width && region->m_x < png->m_width)
+		region->m_width = png->m_width - region->m_x;
+	if (!region->m_height && region->m_y < png->m_height)
+		region->m_height = png->m_height - region->m_y;
+	if (!region->m_width || !region->m_height || (int64_t)region->m_x + region->m_width > png->m_width ||
+		(int64_t)region->m_y + region->m_height > png->m_height)
+	{
+		fprintf(stderr, "Region is outside the image");
+		return ERROR_INVALID_PARAMETER;
+	}
+	if ((options->m_scale != 1) && (options->m_scale != 2) && (options->m_scale != 4) && (options->m_scale != 8))
+	{
+		fprintf(stderr, "Invalid scale");
+		return ERROR_INVALID_PARAMETER;
+	}
+	*output_width = (region->m_width + options->m_scale - 1) / options->m_scale;
+	*output_height = (region->m_height + options->m_scale - 1) / options->m_scale;
+	return ERROR_SUCCESS;
+}
+
+static size_t is_full_image(const png_t* png, const png_options_t* options)
+{
+	const png_region_t* region = &options->m_region;
+	return (options->m_scale == 1) && !region->m_x && !region->m_y && (!region->m_width || (region->m_width == png->m_width)) &&
+		   (!region->m_height || (region->m_height == png->m_height));
+}
+
+// Rows stream through a two-row ring up to the last region row; only region columns are expanded
+// and box filtered into the output, so memory is a few rows plus the (scaled) region
+static size_t decode_region(png_t* png, png_reader_t* reader, int64_t byte_width, int64_t bytes_per_pixel, const png_region_t* region, region_writer_t* writer)
+{
+	size_t code;
+
+	int64_t filtered_data_width = byte_width + 1;
+	int64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	int64_t expanded_count = (int64_t)region->m_x + region->m_width;
+	int64_t expanded_length = is_direct_format(png) ? 0 : expanded_count * pixel_bytes + 8;
+	int64_t samples_length = expanded_count + 8;
+	png_decoder_t* decoder = reader->m_decoder;
+	code = reserve_buffer(&decoder->m_rows, &decoder->m_rows_capacity, filtered_data_width * 2 + expanded_length + samples_length);
+	if (code)
+		return code;
+	uint8_t* ring = decoder->m_rows;
+	uint8_t* expanded = ring + filtered_data_width * 2;
+	uint8_t* samples = expanded + expanded_length;
+
+	start_inflate(reader);
+	int64_t end = (int64_t)region->m_y + region->m_height;
+	for (int64_t y = 0; (y < end) && !code; y++)
+	{
+		uint8_t* row = ring + (y & 1) * filtered_data_width;
+		uint8_t* prior = ring + ((y + 1) & 1) * filtered_data_width + 1;
+		code = inflate_part(reader, row, filtered_data_width);
+		if (!code)
+			code = unfilter_row(row + 1, row + 1, y ? prior : 0, byte_width, bytes_per_pixel, row[0]);
+		if (code || (y < region->m_y))
+			continue;
+		const uint8_t* pixels = row + 1;
+		if (expanded_length)
+		{
+			expand_row(expanded, row + 1, expanded_count, samples, png);
+			pixels = expanded;
+		}
+		write_region_row(writer, pixels + region->m_x * pixel_bytes, y == end - 1);
+	}
+	return code;
+}
+
+static void* allocate_image(png_decoder_t* decoder, size_t size)
+{
+	png_allocator_t* allocator = &decoder->m_options.m_allocator;
+	if (allocator->m_allocate)
+		return allocator->m_allocate(size, allocator->m_context);
+
+	// best fitting pooled image
+	int64_t best = -1;
+	for (int64_t i = 0; i < POOLED_IMAGES; i++)
+	{
+		uint8_t* block = decoder->m_pool[i];
+		if (block && (*(size_t*)block >= size) && ((best < 0) || (*(size_t*)block < *(size_t*)decoder->m_pool[best])))
+			best = i;
+	}
+	uint8_t* block;
+	if (best >= 0)
+	{
+		block = decoder->m_pool[best];
+		decoder->m_pool[best] = 0;
+	}
+	else
+	{
+		block = malloc(POOL_HEADER + size);
+		if (!block)
+			return 0;
+		*(size_t*)block = size;
+	}
+	return block + POOL_HEADER;
+}
+
+void png_release_image(png_decoder_t* decoder, png_t* png)
+{
+	if (!png->m_image_data)
+		return;
+	png_allocator_t* allocator = &decoder->m_options.m_allocator;
+	if (allocator->m_allocate)
+	{
+		allocator->m_release(png->m_image_data, allocator->m_context);
+		png->m_image_data = 0;
+		return;
+	}
+
+	// keep it for the next image, a full pool drops its smallest block
+	uint8_t* block = png->m_image_data - POOL_HEADER;
+	png->m_image_data = 0;
+	for (int64_t i = 0; i < POOLED_IMAGES; i++)
+	{
+		if (!decoder->m_pool[i] || (*(size_t*)decoder->m_pool[i] < *(size_t*)block))
+		{
+			uint8_t* dropped = decoder->m_pool[i];
+			decoder->m_pool[i] = block;
+			block = dropped;
+			if (!block)
+				return;
+		}
+	}
+	free(block);
+}
+
+static size_t decode_image(png_t* png, png_reader_t* reader)
+{
+	size_t code;
+
+	int64_t bits_per_pixel = get_samples_per_pixel(png->m_color_type) * png->m_bit_depth;
+	int64_t bytes_per_pixel = (bits_per_pixel + 7) / 8;	   // filters work on whole bytes
+	pass_t passes[8];
+	int64_t pass_count = get_passes(passes, png, bits_per_pixel);
+	int64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	int64_t image_length = (int64_t)png->m_width * png->m_height * pixel_bytes;
+	png_decoder_t* decoder = reader->m_decoder;
+	png_layout_t layout = reader->m_options->m_layout;
+
+	if ((pass_count == 1) && (layout != LayoutPacked))
+	{
+		run_once(&unpack_table_once, build_unpack_table);
+		png->m_image_data = allocate_image(decoder, (int64_t)png->m_width * png->m_height * get_layout_pixel_bytes(png, layout));
+		if (!png->m_image_data)
+		{
+			fprintf(stderr, "cannot allocate memory");
+			return ERROR_MEMORY;
+		}
+		code = decode_converted(png, reader, passes[0].m_byte_width, bytes_per_pixel, layout);
+		if (!code)
+			set_layout_format(png, layout);
+		return code;
+	}
+
+	if ((pass_count == 1) && is_direct_format(png))
+	{
+		// inflate into the image itself, rows are unfiltered and compacted over the filter bytes
+		png->m_image_data = allocate_image(decoder, passes[1].m_filtered_offset);
+		if (!png->m_image_data)
+		{
+			fprintf(stderr, "cannot allocate memory");
+			return ERROR_MEMORY;
+		}
+		reader->m_filtered_data = png->m_image_data;
+		reader->m_filtered_data_length = passes[1].m_filtered_offset;
+		code = inflate_png_datastream(reader);
+		reader->m_filtered_data = 0;
+		reader->m_filtered_data_length = 0;
+		if (code)
+			return code;
+		return unfilter_and_compact(png->m_image_data, passes[0].m_byte_width, png->m_height, bytes_per_pixel);
+	}
+
+	run_once(&unpack_table_once, build_unpack_table);
+	// row expanders write a few bytes past the last pixel
+	png->m_image_data = allocate_image(decoder, image_length + 8);
+	if (!png->m_image_data)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	if (pass_count == 1)
+		return decode_expanded(png, reader, passes[0].m_byte_width, bytes_per_pixel);
+
+	// get filtered data from compressed data, passes are unfiltered where they were inflated
+	code = reserve_buffer(&decoder->m_filtered_data, &decoder->m_filtered_capacity, passes[pass_count].m_filtered_offset);
+	if (code)
+		return code;
+	reader->m_filtered_data = decoder->m_filtered_data;
+	reader->m_filtered_data_length = passes[pass_count].m_filtered_offset;
+
+	if (!reader->m_options->m_on_pass)
+		return decode_interlaced(png, reader, passes, bytes_per_pixel);
+
+	memset(png->m_image_data, 0, image_length);
+	int64_t row_length = png->m_width * pixel_bytes + 8;
+	code = reserve_buffer(&decoder->m_rows, &decoder->m_rows_capacity, row_length + png->m_width + 8);
+	if (code)
+		return code;
+	return decode_progressive(png, reader, passes, bytes_per_pixel, decoder->m_rows, decoder->m_rows + row_length);
+}
+
+static size_t decode_scaled_image(png_t* png, png_reader_t* reader)
+{
+	size_t code;
+
+	png_region_t region;
+	int64_t output_width;
+	int64_t output_height;
+	code = get_region(&region, &output_width, &output_height, png, reader->m_options);
+	if (code)
+		return code;
+	int64_t bits_per_pixel = get_samples_per_pixel(png->m_color_type) * png->m_bit_depth;
+	int64_t bytes_per_pixel = (bits_per_pixel + 7) / 8;
+	pass_t passes[8];
+	int64_t pass_count = get_passes(passes, png, bits_per_pixel);
+	int64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	png_decoder_t* decoder = reader->m_decoder;
+
+	code = reserve_buffer(&decoder->m_sums, &decoder->m_sums_capacity, output_width * png->m_channels * sizeof(uint32_t));
+	if (code)
+		return code;
+	memset(decoder->m_sums, 0, output_width * png->m_channels * sizeof(uint32_t));
+	png_t scaled = *png;
+	scaled.m_image_data = allocate_image(decoder, output_width * output_height * pixel_bytes);
+	if (!scaled.m_image_data)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	region_writer_t writer = { scaled.m_image_data, (uint32_t*)decoder->m_sums, region.m_width, 0, png->m_channels, png->m_sample_bytes, reader->m_options->m_scale };
+
+	if (pass_count == 1)
+	{
+		run_once(&unpack_table_once, build_unpack_table);
+		code = decode_region(png, reader, passes[0].m_byte_width, bytes_per_pixel, &region, &writer);
+	}
+	else
+	{
+		// every Adam7 pass spans the whole image, so the image is decoded in full and then reduced
+		code = decode_image(png, reader);
+		int64_t end = (int64_t)region.m_y + region.m_height;
+		for (int64_t y = region.m_y; (y < end) && !code; y++)
+		{
+			write_region_row(&writer, png->m_image_data + (y * png->m_width + region.m_x) * pixel_bytes, y == end - 1);
+		}
+		png_release_image(decoder, png);
+	}
+	if (code)
+	{
+		png_release_image(decoder, &scaled);
+		return code;
+	}
+	png->m_image_data = scaled.m_image_data;
+	png->m_width = (uint32_t)output_width;
+	png->m_height = (uint32_t)output_height;
+	return ERROR_SUCCESS;
+}
+
+// Adam7 passes and reduced regions are only complete at the end, so they are converted in a second pass
+static size_t convert_image(png_t* png, png_decoder_t* decoder, png_layout_t layout)
+{
+	size_t code;
+
+	code = reserve_buffer(&decoder->m_rows, &decoder->m_rows_capacity, png->m_width * png->m_channels);
+	if (code)
+		return code;
+	png_t converted = *png;
+	converted.m_image_data = allocate_image(decoder, (int64_t)png->m_width * png->m_height * get_layout_pixel_bytes(png, layout));
+	if (!converted.m_image_data)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	int64_t row_length = png->m_width * png->m_channels * png->m_sample_bytes;
+	for (int64_t y = 0; y < png->m_height; y++)
+	{
+		convert_row(converted.m_image_data, png->m_image_data + y * row_length, y, png, layout, decoder->m_rows);
+	}
+	png_release_image(decoder, png);
+	png->m_image_data = converted.m_image_data;
+	set_layout_format(png, layout);
+	return ERROR_SUCCESS;
+}
+
+#define DEFLATE_MAX_RATIO 1032	 // a 258-byte match in two bits
+
+// the IDAT data and the memory the decode will take, against the limits of the options
+static size_t check_limits(const png_t* png, const png_reader_t* reader)
+{
+	size_t code;
+
+	const png_options_t* options = reader->m_options;
+	int64_t bits_per_pixel = get_samples_per_pixel(png->m_color_type) * png->m_bit_depth;
+
+	// whatever the limits of the options, every size must fit in int64_t and size_t: the passes of an
+	// interlaced image have fewer than twice its rows plus 8, a pixel takes at most 8 bytes packed and
+	// 16 in a layout
+	uint64_t size_limit = SIZE_MAX < INT64_MAX ? SIZE_MAX : INT64_MAX;
+	uint64_t row_bytes = ((uint64_t)png->m_width * bits_per_pixel + 7) / 8 + 1;
+	uint64_t pixels = (uint64_t)png->m_width * png->m_height;
+	if ((row_bytes > size_limit / (2 * (uint64_t)png->m_height + 8)) || (pixels > (size_limit - 8) / 24))
+	{
+		fprintf(stderr, "Image is too large for this machine");
+		return ERROR_UNSUPPORTED;
+	}
+
+	pass_t passes[8];
+	int64_t pass_count = get_passes(passes, png, bits_per_pixel);
+	uint64_t filtered_length = passes[pass_count].m_filtered_offset;
+	uint64_t compressed_length = reader->m_compressed_data_length;
+	if (filtered_length > compressed_length * DEFLATE_MAX_RATIO)
+	{
+		fprintf(stderr, "IDAT data is too short for the image size");
+		return ERROR_INVALID_DATA;
+	}
+	if (options->m_max_inflate_ratio && (filtered_length > compressed_length * options->m_max_inflate_ratio))
+	{
+		fprintf(stderr, "Compression ratio is over the limit");
+		return ERROR_UNSUPPORTED;
+	}
+
+	// images and whole-image buffers only, rows and sums are small next to them
+	uint64_t pixel_bytes = png->m_channels * png->m_sample_bytes;
+	uint64_t layout_bytes = options->m_layout != LayoutPacked ? get_layout_pixel_bytes(png, options->m_layout) : 0;
+	uint64_t memory;
+	if (is_full_image(png, options))
+	{
+		if (pass_count > 1)
+			memory = filtered_length + pixels * (pixel_bytes + layout_bytes);
+		else if (layout_bytes)
+			memory = pixels * layout_bytes;
+		else
+			memory = filtered_length > pixels * pixel_bytes ? filtered_length : pixels * pixel_bytes;
+	}
+	else
+	{
+		png_region_t region;
+		int64_t output_width;
+		int64_t output_height;
+		code = get_region(&region, &output_width, &output_height, png, options);
+		if (code)
+			return code;
+		memory = (uint64_t)output_width * output_height * (pixel_bytes + layout_bytes);
+		if (pass_count > 1)
+			memory += filtered_length + pixels * pixel_bytes;
+	}
+	if (options->m_max_memory && (memory > options->m_max_memory))
+	{
+		fprintf(stderr, "Image needs more memory than allowed");
+		return ERROR_UNSUPPORTED;
+	}
+	return ERROR_SUCCESS;
+}
+
+static size_t on_iend(png_t* png, png_reader_t* reader)
+{
+	size_t code;
+
+	png_layout_t layout = reader->m_options->m_layout;
+	if ((layout != LayoutPacked) && (layout != LayoutPlanar) && (layout != LayoutRgba32) && (layout != LayoutFloat))
+	{
+		fprintf(stderr, "Invalid layout");
+		return ERROR_INVALID_PARAMETER;
+	}
+	set_output_format(png);
+	code = check_limits(png, reader);
+	if (code)
+		return code;
+	if (is_full_image(png, reader->m_options))
+		code = decode_image(png, reader);
+	else
+		code = decode_scaled_image(png, reader);
+	if (!code && (png->m_layout != layout))
+		code = convert_image(png, reader->m_decoder, layout);
+	return code;
+}
+
+static size_t read_palette(png_t* png, const png_chunk_t* chunk)
+{
+	if (png->m_palette_size)
+	{
+		fprintf(stderr, "must be 1 PLTE chunk!");
+		return ERROR_INVALID_DATA;
+	}
+	if ((png->m_color_type == 0) || (png->m_color_type == 4))
+	{
+		fprintf(stderr, "PLTE chunk must not appear for greyscale images");
+		return ERROR_INVALID_DATA;
+	}
+	int64_t entries = chunk->m_length / 3;
+	if (!entries || (chunk->m_length % 3) || (entries > 256) ||
+		((png->m_color_type == 3) && (entries > (1ll << png->m_bit_depth))))
+	{
+		fprintf(stderr, "invalid length of PLTE");
+		return ERROR_INVALID_DATA;
+	}
+	// truecolor images only suggest a palette for quantization, the pixels do not use it
+	if (png->m_color_type != 3)
+		return ERROR_SUCCESS;
+
+	// indices past the end of the palette decode as opaque black
+	for (int64_t i = 0; i < 256; i++)
+	{
+		png->m_palette[i * 4 + 0] = 0;
+		png->m_palette[i * 4 + 1] = 0;
+		png->m_palette[i * 4 + 2] = 0;
+		png->m_palette[i * 4 + 3] = 255;
+	}
+	for (int64_t i = 0; i < entries; i++)
+	{
+		png->m_palette[i * 4 + 0] = chunk->m_data[i * 3 + 0];
+		png->m_palette[i * 4 + 1] = chunk->m_data[i * 3 + 1];
+		png->m_palette[i * 4 + 2] = chunk->m_data[i * 3 + 2];
+	}
+	png->m_palette_size = entries;
+	return ERROR_SUCCESS;
+}
+
+static size_t read_transparency(png_t* png, const png_chunk_t* chunk)
+{
+	int64_t samples = 0;
+	switch (png->m_color_type)
+	{
+	case 3:
+		if (!png->m_palette_size)
+		{
+			fprintf(stderr, "tRNS chunk must follow PLTE");
+			return ERROR_INVALID_DATA;
+		}
+		if ((int64_t)chunk->m_length > png->m_palette_size)
+		{
+			fprintf(stderr, "invalid length of tRNS");
+			return ERROR_INVALID_DATA;
+		}
+		for (int64_t i = 0; i < chunk->m_length; i++)
+		{
+			png->m_palette[i * 4 + 3] = chunk->m_data[i];
+		}
+		png->m_has_transparency = 1;
+		return ERROR_SUCCESS;
+	case 0:
+		samples = 1;
+		break;
+	case 2:
+		samples = 3;
+		break;
+	default:
+		// images with an alpha channel have no use for tRNS
+		return ERROR_SUCCESS;
+	}
+	if (chunk->m_length != samples * 2)
+	{
+		fprintf(stderr, "invalid length of tRNS");
+		return ERROR_INVALID_DATA;
+	}
+	for (int64_t i = 0; i < samples; i++)
+	{
+		png->m_transparent[i] = (chunk->m_data[i * 2] << 8) | chunk->m_data[i * 2 + 1];
+	}
+	png->m_has_transparency = 1;
+	return ERROR_SUCCESS;
+}
+
+// signature and IHDR, checked and stored in png
+static size_t read_header(png_t* png, png_reader_t* reader)
+{
+	size_t code;
+	int64_t magic;
+	int64_t signature = 0x0A1A0A0D474E5089ll;
+	code = read_it(&magic, 8, reader);
+	if (code)
+		return code;
+	if (magic != signature)
+	{
+		fprintf(stderr, "not a PNG signature");
+		return ERROR_INVALID_DATA;
+	}
+
+	png_chunk_t header_chunk;
+	code = read_chunk(&header_chunk, reader);
+	if (code)
+		return code;
+
+	if (header_chunk.m_type != IHDR)
+	{
+		fprintf(stderr, "The first chunk must be IHDR");
+		return ERROR_INVALID_DATA;
+	}
+	if (header_chunk.m_length != 13)
+	{
+		fprintf(stderr, "invalid length of IHDR");
+		return ERROR_INVALID_DATA;
+	}
+
+	for (int64_t i = 0; i < 13; i++)
+	{
+		((uint8_t*)png)[i] = header_chunk.m_data[i];
+	}
+	png->m_width = reverse_byte_order_32(png->m_width);
+	png->m_height = reverse_byte_order_32(png->m_height);
+
+	if (!png->m_width)
+	{
+		fprintf(stderr, "Image dimensions must be non zero");
+		return ERROR_INVALID_DATA;
+	}
+	if (!png->m_height)
+	{
+		fprintf(stderr, "Image dimensions must be non zero");
+		return ERROR_INVALID_DATA;
+	}
+	if (png->m_width & (1u << 31u))
+	{
+		fprintf(stderr, "Image dimensions must be less than (2^31)-1!");
+		return ERROR_INVALID_DATA;
+	}
+	if (png->m_height & (1u << 31u))
+	{
+		fprintf(stderr, "Image dimensions must be less than (2^31)-1!");
+		return ERROR_INVALID_DATA;
+	}
+	if ((png->m_bit_depth != 1) && (png->m_bit_depth != 2) && (png->m_bit_depth != 4) && (png->m_bit_depth != 8) &&
+		(png->m_bit_depth != 16))
+	{
+		fprintf(stderr, "Invalid bit depth");
+		return ERROR_INVALID_DATA;
+	}
+	if ((png->m_color_type != 0) && (png->m_color_type != 2) && (png->m_color_type != 3) && (png->m_color_type != 4) &&
+		(png->m_color_type != 6))
+	{
+		fprintf(stderr, "Invalid color type");
+		return ERROR_INVALID_DATA;
+	}
+	if (png->m_compression_method)
+	{
+		fprintf(stderr, "only compression method 0 is defined");
+		return ERROR_INVALID_DATA;
+	}
+	if (png->m_filter_method)
+	{
+		fprintf(stderr, "only filter method 0 is defined");
+		return ERROR_INVALID_DATA;
+	}
+	if ((png->m_interlace_method != 0) && (png->m_interlace_method != 1))
+	{
+		fprintf(stderr, "only 0 and 1 values are defined");
+		return ERROR_INVALID_DATA;
+	}
+	if (((png->m_color_type == 3) && (png->m_bit_depth == 16)) ||
+		((png->m_color_type & 0b110) && (png->m_color_type != 3) && (png->m_bit_depth < 8)))
+	{
+		fprintf(stderr, "Invalid bit depth for color type");
+		return ERROR_INVALID_DATA;
+	}
+	return ERROR_SUCCESS;
+}
+
+static size_t parse_png_data(png_t* png, png_reader_t* reader)
+{
+	size_t code;
+
+	code = read_header(png, reader);
+	if (code)
+		return code;
+	uint64_t max_pixels = reader->m_options->m_max_pixels;
+	if (max_pixels && ((uint64_t)png->m_width * png->m_height > max_pixels))
+	{
+		fprintf(stderr, "Image has more pixels than allowed");
+		return ERROR_UNSUPPORTED;
+	}
+	// decode
+	reader->m_idat_start = 0;
+	reader->m_idat_end = 0;
+	reader->m_compressed_data_length = 0;
+	reader->m_filtered_data = 0;
+	reader->m_filtered_data_length = 0;
+	png->m_palette_size = 0;
+	png->m_has_transparency = 0;
+	// parse remaining chunks
+	size_t idat_seen = 0;
+	size_t running = 1;
+	while (running)
+	{
+		png_chunk_t chunk;
+		code = read_chunk(&chunk, reader);
+		if (code)
+			break;
+
+		switch (chunk.m_type)
+		{
+		case IHDR:
+			fprintf(stderr, "must be 1 IHDR chunk!");
+			code = ERROR_INVALID_DATA;
+			running = 0;
+			break;
+		case PLTE:
+			if (idat_seen)
+			{
+				fprintf(stderr, "PLTE chunk must precede IDAT");
+				code = ERROR_INVALID_DATA;
+			}
+			else
+			{
+				code = read_palette(png, &chunk);
+			}
+			running = !code;
+			break;
+		case tRNS:
+			// a late tRNS chunk is ignored like any other misplaced ancillary chunk
+			if (!idat_seen)
+			{
+				code = read_transparency(png, &chunk);
+				running = !code;
+			}
+			break;
+		case IDAT:
+			// only located here, on_iend inflates the payloads in place
+			if (!idat_seen)
+				reader->m_idat_start = chunk.m_data - 8 - reader->m_data;
+			idat_seen = 1;
+			reader->m_idat_end = reader->m_cursor;
+			reader->m_compressed_data_length += chunk.m_length;
+			break;
+		case IEND:
+			running = 0;
+			if (chunk.m_length)
+			{
+				fprintf(stderr, "IEND chunk must have 0 data length");
+				code = ERROR_INVALID_DATA;
+			}
+			else if ((png->m_color_type == 3) && !png->m_palette_size)
+			{
+				fprintf(stderr, "PLTE chunk is required for indexed-color images");
+				code = ERROR_INVALID_DATA;
+			}
+			else
+			{
+				code = on_iend(png, reader);
+			}
+			break;
+		}
+	}
+
+	// buffers belong to the decoder
+	reader->m_filtered_data = 0;
+	reader->m_filtered_data_length = 0;
+
+	return code;
+}
+
+void png_default_options(png_options_t* options)
+{
+	options->m_verify = VerifyCritical;
+	options->m_allocator.m_allocate = 0;
+	options->m_allocator.m_release = 0;
+	options->m_allocator.m_context = 0;
+	options->m_on_pass = 0;
+	options->m_on_pass_context = 0;
+	options->m_region.m_x = 0;
+	options->m_region.m_y = 0;
+	options->m_region.m_width = 0;
+	options->m_region.m_height = 0;
+	options->m_scale = 1;
+	options->m_layout = LayoutPacked;
+	options->m_max_pixels = 1ull << 28;
+	options->m_max_memory = 1ull << 32;
+	options->m_max_inflate_ratio = 0;
+}
+
+size_t png_decoder_create(png_decoder_t** decoder, const png_options_t* options)
+{
+	*decoder = calloc(1, sizeof(png_decoder_t));
+	if (!*decoder)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	(*decoder)->m_options = *options;
+	if (inflateInit(&(*decoder)->m_stream))
+	{
+		fprintf(stderr, "inflateInit failed");
+		free(*decoder);
+		*decoder = 0;
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
+
+void png_decoder_destroy(png_decoder_t* decoder)
+{
+	if (!decoder)
+		return;
+	inflateEnd(&decoder->m_stream);	   // All dynamically allocated data structures for this stream are freed
+	free(decoder->m_file_data);
+	free(decoder->m_filtered_data);
+	free(decoder->m_rows);
+	free(decoder->m_sums);
+	for (int64_t i = 0; i < POOLED_IMAGES; i++)
+	{
+		free(decoder->m_pool[i]);
+	}
+	free(decoder);
+}
+
+size_t png_decode_memory(png_decoder_t* decoder, png_t* png, const void* data, int64_t length)
+{
+	png_reader_t reader;
+	reader.m_data = data;
+	reader.m_length = length;
+	reader.m_cursor = 0;
+	reader.m_options = &decoder->m_options;
+	reader.m_decoder = decoder;
+	png->m_image_data = 0;
+	return parse_png_data(png, &reader);
+}
+
+size_t png_decode_file(png_decoder_t* decoder, png_t* png, FILE* file)
+{
+	size_t code;
+
+	int64_t length;
+	code = get_file_length(&length, file);
+	if (code)
+		return code;
+	uint64_t max_memory = decoder->m_options.m_max_memory;
+	if (max_memory && ((uint64_t)length > max_memory))
+	{
+		fprintf(stderr, "Input file is larger than allowed");
+		return ERROR_UNSUPPORTED;
+	}
+
+#if defined POSIX_IO
+	// map the file, chunk payloads are referenced in place
+	if (length)
+	{
+		mapped_file_t mapping;
+		code = map_descriptor(&mapping, fileno(file));
+		if (code)
+		{
+			fprintf(stderr, "Can't read the input file");
+			return code;
+		}
+		code = png_decode_memory(decoder, png, mapping.m_data, mapping.m_length);
+		unmap_file(&mapping);
+		return code;
+	}
+#endif
+	code = reserve_buffer(&decoder->m_file_data, &decoder->m_file_capacity, length);
+	if (!code)
+		code = read_from_file(decoder->m_file_data, length, file);
+	if (!code)
+		code = png_decode_memory(decoder, png, decoder->m_file_data, length);
+	return code;
+}
+
+#define PROBE_BLOCK 4096	// one read covers the header and every chunk header of small files
+
+// reads up to length bytes at offset without moving the file position under POSIX
+static size_t read_at(uint8_t* buffer, int64_t length, int64_t offset, FILE* file, int64_t* bytes_read)
+{
+#if defined POSIX_IO
+	ssize_t result;
+	do
+	{
+		result = pread(fileno(file), buffer, length, offset);
+	} while ((result < 0) && (errno == EINTR));
+	if (result < 0)
+	{
+		fprintf(stderr, "pread failed");
+		return ERROR_UNKNOWN;
+	}
+	*bytes_read = result;
+#else
+	if (fseek(file, offset, SEEK_SET))
+	{
+		fprintf(stderr, "fseek failed");
+		return ERROR_UNKNOWN;
+	}
+	*bytes_read = fread(buffer, 1, length, file);
+#endif
+	return ERROR_SUCCESS;
+}
+
+size_t png_probe_file(png_t* png, FILE* file, const png_options_t* options, png_chunk_callback_t on_chunk, void* context)
+{
+	size_t code;
+
+	png_options_t default_options;
+	if (!options)
+	{
+		png_default_options(&default_options);
+		options = &default_options;
+	}
+	uint8_t block[PROBE_BLOCK];
+	int64_t block_offset = 0;
+	int64_t block_length;
+	code = read_at(block, PROBE_BLOCK, 0, file, &block_length);
+	if (code)
+		return code;
+
+	png_reader_t reader;
+	memset(&reader, 0, sizeof(reader));
+	reader.m_data = block;
+	reader.m_length = block_length;
+	reader.m_options = options;
+	png->m_image_data = 0;
+	code = read_header(png, &reader);
+	if (code || !on_chunk)
+		return code;
+	on_chunk(IHDR, 13, 8, context);
+
+	// chunk headers only: each next one is found from the length of the last, payloads are skipped
+	int64_t offset = reader.m_cursor;
+	for (;;)
+	{
+		if (offset + 8 > block_offset + block_length)
+		{
+			block_offset = offset;
+			code = read_at(block, PROBE_BLOCK, offset, file, &block_length);
+			if (code)
+				return code;
+			if (block_length < 8)
+			{
+				fprintf(stderr, "Input file ended");
+				return ERROR_INVALID_DATA;
+			}
+		}
+		uint32_t length;
+		uint32_t type;
+		memcpy(&length, block + offset - block_offset, 4);
+		memcpy(&type, block + offset - block_offset + 4, 4);
+		length = reverse_byte_order_32(length);
+		if ((length & (1u << 31u)) || !is_valid_chunk_type(type))
+		{
+			fprintf(stderr, "Invalid chunk");
+			return ERROR_INVALID_DATA;
+		}
+		on_chunk(type, length, offset, context);
+		if (type == IEND)
+			return ERROR_SUCCESS;
+		offset += 12 + (int64_t)length;
+	}
+}
+
+#if defined POSIX_IO
+size_t write_vectors(int descriptor, struct iovec* vectors, int count)
+{
+	while (count)
+	{
+		ssize_t bytes_written = writev(descriptor, vectors, count);
+		if (bytes_written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "writev failed");
+			return ERROR_UNKNOWN;
+		}
+		// skip fully written vectors and advance inside the partially written one
+		while (count && (size_t)bytes_written >= vectors->iov_len)
+		{
+			bytes_written -= vectors->iov_len;
+			vectors++;
+			count--;
+		}
+		if (count)
+		{
+			vectors->iov_base = (uint8_t*)vectors->iov_base + bytes_written;
+			vectors->iov_len -= bytes_written;
+		}
+	}
+	return ERROR_SUCCESS;
+}
+#else
+size_t write_to_file(const void* buffer, size_t size, FILE* file)
+{
+	size_t bytes_written = fwrite(buffer, 1, size, file);
+	if (bytes_written != size)
+	{
+		fprintf(stderr, "fwrite failed");
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
+#endif
+
+static size_t write_image(const png_t* png, const char* header, int header_length, FILE* file)
+{
+	size_t image_length = (size_t)png->m_width * png->m_height * png->m_channels * png->m_sample_bytes;
+
+#if defined POSIX_IO
+	// header and pixels in one system call, bypassing the stdio buffer
+	if (fflush(file))
+	{
+		fprintf(stderr, "fflush failed");
+		return ERROR_UNKNOWN;
+	}
+	struct iovec vectors[2] = {
+		{ (void*)header, header_length },
+		{ png->m_image_data, image_length },
+	};
+	return write_vectors(fileno(file), vectors, 2);
+#else
+	size_t code = write_to_file(header, header_length, file);
+	if (code)
+		return code;
+	return write_to_file(png->m_image_data, image_length, file);
+#endif
+}
+
+size_t save_png_as_pnm_by_file_handle(png_t* png, FILE* file)
+{
+	char header[128];
+	int header_length;
+	if ((png->m_layout != LayoutPacked) && (png->m_layout != LayoutRgba32))
+	{
+		fprintf(stderr, "PNM holds packed integer samples only");
+		return ERROR_UNSUPPORTED;
+	}
+	switch (png->m_channels)
+	{
+	case 1:
+	case 3:
+		header_length = snprintf(header,
+								 sizeof(header),
+								 "P%c %d %d %d ",
+								 png->m_channels == 1 ? '5' : '6',
+								 png->m_width,
+								 png->m_height,
+								 png->m_max_value);
+		break;
+	case 2:
+	case 4:
+		// PAM, the only netpbm format with an alpha channel
+		header_length = snprintf(header,
+								 sizeof(header),
+								 "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+								 png->m_width,
+								 png->m_height,
+								 png->m_channels,
+								 png->m_max_value,
+								 png->m_channels == 2 ? "GRAYSCALE_ALPHA" : "RGB_ALPHA");
+		break;
+	default:
+		fprintf(stderr, "Invalid PNG channel count");
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (header_length < 0)
+	{
+		fprintf(stderr, "snprintf failed");
+		return ERROR_UNKNOWN;
+	}
+	return write_image(png, header, header_length, file);
+}
+
+size_t save_png_as_raw_by_file_handle(png_t* png, FILE* file)
+{
+	return write_image(png, "", 0, file);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct png_t_tag
+{
+	uint32_t m_width;
+	uint32_t m_height;
+	uint8_t m_bit_depth;
+	uint8_t m_color_type;
+	uint8_t m_compression_method;
+	uint8_t m_filter_method;
+	uint8_t m_interlace_method;
+
+	uint8_t m_palette[256 * 4];	   // RGBA entries from PLTE and tRNS
+	int32_t m_palette_size;
+	uint16_t m_transparent[3];	  // tRNS sample values of greyscale and truecolor images
+	uint8_t m_has_transparency;
+
+	// decoded pixel format: samples are unpacked to whole bytes, 16-bit samples are big-endian
+	uint8_t m_channels;
+	uint8_t m_sample_bytes;
+	uint16_t m_max_value;
+	uint8_t m_layout;	 // png_layout_t of m_image_data
+
+	uint8_t* m_image_data;
+} png_t;
+
+// arrangement of m_image_data
+typedef enum png_layout_t_tag
+{
+	LayoutPacked,	 // pixels in rows, the channels of a pixel next to each other
+	LayoutPlanar,	 // one packed plane per channel: all of channel 0, then all of channel 1...
+	LayoutRgba32,	 // 4 bytes per pixel whatever the image: grey is replicated, opaque alpha added, 16-bit reduced to 8
+	LayoutFloat,	// packed native floats from 0 to 1, m_sample_bytes is 4 and m_max_value 1
+} png_layout_t;
+
+typedef enum verify_mode_t_tag
+{
+	VerifyOff,
+	VerifyCritical,
+	VerifyAll,
+} verify_mode_t;
+
+// called after each Adam7 pass is placed in m_image_data, pass is 1..7; pixels of later passes are zero
+typedef void (*png_pass_callback_t)(const png_t* png, int32_t pass, void* context);
+
+// source of m_image_data, a null m_allocate means buffers pooled by the decoder
+typedef struct png_allocator_t_tag
+{
+	void* (*m_allocate)(size_t size, void* context);
+	void (*m_release)(void* memory, void* context);
+	void* m_context;
+} png_allocator_t;
+
+// part of the image in full resolution pixels, a zero m_width or m_height extends it to the image edge
+typedef struct png_region_t_tag
+{
+	uint32_t m_x;
+	uint32_t m_y;
+	uint32_t m_width;
+	uint32_t m_height;
+} png_region_t;
+
+typedef struct png_options_t_tag
+{
+	verify_mode_t m_verify;	   // chunks whose CRC is checked
+	png_allocator_t m_allocator;
+	png_pass_callback_t m_on_pass;	  // progressive display of interlaced images, may be null
+	void* m_on_pass_context;
+
+	// Only the region is decoded, box filtered down by m_scale (1, 2, 4 or 8); m_width and m_height
+	// of the decoded png_t are then the output size. Boxes cut by the region edge average fewer pixels.
+	png_region_t m_region;
+	uint8_t m_scale;
+
+	png_layout_t m_layout;	  // converted row by row while each row is still in cache
+
+	// Limits against hostile headers, checked before anything is allocated for the image; 0 turns one off.
+	// m_max_memory covers the input read into memory, the image and the decoder's whole-image buffers.
+	// IDAT data that would have to inflate more than m_max_inflate_ratio times its size to fill the image
+	// is refused as a compression bomb. Deflate cannot go past 1032:1, data too short even for that always is.
+	uint64_t m_max_pixels;
+	uint64_t m_max_memory;
+	uint32_t m_max_inflate_ratio;
+} png_options_t;
+
+// Decoder context: keeps the inflate state and scratch buffers between images, so decoding
+// many images does not allocate per image. Not thread safe, use one decoder per thread.
+typedef struct png_decoder_t_tag png_decoder_t;
+
+void png_default_options(png_options_t* options);
+
+size_t png_decoder_create(png_decoder_t** decoder, const png_options_t* options);
+void png_decoder_destroy(png_decoder_t* decoder);
+
+size_t png_decode_memory(png_decoder_t* decoder, png_t* png, const void* data, int64_t length);
+size_t png_decode_file(png_decoder_t* decoder, png_t* png, FILE* file);
+
+// chunk found by png_probe_file: type bytes in file order, payload length, file offset of the chunk
+typedef void (*png_chunk_callback_t)(uint32_t type, uint32_t length, int64_t offset, void* context);
+
+// Fills the IHDR fields of png from the first bytes of the file, checked as the decoder checks them.
+// With on_chunk every chunk header up to IEND is reported; payloads are skipped, not read.
+// options only selects CRC checking and may be null.
+size_t png_probe_file(png_t* png, FILE* file, const png_options_t* options, png_chunk_callback_t on_chunk, void* context);
+
+// returns m_image_data to the allocator or the decoder's pool
+void png_release_image(png_decoder_t* decoder, png_t* png);
+
+// LayoutPacked and LayoutRgba32 images
+size_t save_png_as_pnm_by_file_handle(png_t* png, FILE* file);
+
+// m_image_data as it is in memory, without a header
+size_t save_png_as_raw_by_file_handle(png_t* png, FILE* file);
+
+typedef struct png_encoder_options_t_tag
+{
+	int32_t m_level;	// zlib compression level, 0..9
+	int32_t m_band_rows;	// rows compressed as one parallel task, 0 picks bands of about 256 KiB
+	int32_t m_filter;	 // -1 picks a filter per row, 0..4 filters every row of 8 and 16-bit images with that one
+} png_encoder_options_t;
+
+void png_default_encoder_options(png_encoder_options_t* options);
+
+// reads a P5, P6 or P7 file; m_image_data is allocated with malloc and freed by the caller
+size_t load_pnm_by_file_handle(png_t* png, FILE* file);
+
+// writes m_image_data laid out as the decoder produces it: 1 to 4 channels of 1 or 2 byte samples
+// from 0 to m_max_value; greyscale with m_max_value 1, 3 or 15 is packed to 1, 2 or 4-bit samples,
+// other maximum values below 255 or 65535 are rescaled
+size_t save_png_by_file_handle(const png_t* png, FILE* file, const png_encoder_options_t* options);
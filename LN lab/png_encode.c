@@ -0,0 +1,644 @@
+#include "png_internal.h"
+
+#include "crc32.h"
+#include "../common/return_codes.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BAND_BYTES (1 << 18)
+#define MAX_BAND_BYTES (1 << 30)	// keeps every IDAT and every deflate call below the 32-bit limits
+#define DICTIONARY_BYTES (1 << 15)
+#define WRITE_BATCH 512	   // vectors per writev, below any IOV_MAX
+
+typedef struct pnm_reader_t_tag
+{
+	const uint8_t* m_data;
+	int64_t m_length;
+	int64_t m_cursor;
+} pnm_reader_t;
+
+static int is_pnm_space(uint8_t c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// next whitespace separated word, comments are skipped; returns its length, 0 at the end of input
+static int64_t read_pnm_word(const uint8_t** word, pnm_reader_t* reader)
+{
+	while (reader->m_cursor < reader->m_length)
+	{
+		uint8_t c = reader->m_data[reader->m_cursor];
+		if (c == '#')
+		{
+			while (reader->m_cursor < reader->m_length && reader->m_data[reader->m_cursor] != '\n')
+				reader->m_cursor++;
+		}
+		else if (is_pnm_space(c))
+			reader->m_cursor++;
+		else
+			break;
+	}
+	int64_t start = reader->m_cursor;
+	while (reader->m_cursor < reader->m_length && !is_pnm_space(reader->m_data[reader->m_cursor]))
+		reader->m_cursor++;
+	*word = reader->m_data + start;
+	return reader->m_cursor - start;
+}
+
+static int64_t read_pnm_number(pnm_reader_t* reader)
+{
+	const uint8_t* word;
+	int64_t length = read_pnm_word(&word, reader);
+	if (!length || length > 9)
+		return -1;
+	int64_t value = 0;
+	for (int64_t i = 0; i < length; i++)
+	{
+		if (word[i] < '0' || word[i] > '9')
+			return -1;
+		value = value * 10 + (word[i] - '0');
+	}
+	return value;
+}
+
+static int is_pnm_word(const uint8_t* word, int64_t length, const char* expected)
+{
+	return length == (int64_t)strlen(expected) && !memcmp(word, expected, length);
+}
+
+static size_t read_pam_header(png_t* png, int64_t* max_value, pnm_reader_t* reader)
+{
+	for (;;)
+	{
+		const uint8_t* word;
+		int64_t length = read_pnm_word(&word, reader);
+		if (!length)
+		{
+			fprintf(stderr, "PAM header ended");
+			return ERROR_INVALID_DATA;
+		}
+		if (is_pnm_word(word, length, "ENDHDR"))
+			return ERROR_SUCCESS;
+
+		if (is_pnm_word(word, length, "TUPLTYPE"))
+		{
+			// the channel count comes from DEPTH, the tuple type is informational
+			while (reader->m_cursor < reader->m_length && reader->m_data[reader->m_cursor] != '\n')
+				reader->m_cursor++;
+			continue;
+		}
+		int64_t value = read_pnm_number(reader);
+		if (value < 0)
+		{
+			fprintf(stderr, "Invalid PAM header value");
+			return ERROR_INVALID_DATA;
+		}
+		if (is_pnm_word(word, length, "WIDTH"))
+			png->m_width = (uint32_t)value;
+		else if (is_pnm_word(word, length, "HEIGHT"))
+			png->m_height = (uint32_t)value;
+		else if (is_pnm_word(word, length, "DEPTH"))
+			png->m_channels = value > 4 ? 0 : (uint8_t)value;
+		else if (is_pnm_word(word, length, "MAXVAL"))
+			*max_value = value;
+		else
+		{
+			fprintf(stderr, "Unknown PAM header field");
+			return ERROR_INVALID_DATA;
+		}
+	}
+}
+
+size_t load_pnm_by_file_handle(png_t* png, FILE* file)
+{
+	size_t code;
+
+	int64_t length;
+	code = get_file_length(&length, file);
+	if (code)
+		return code;
+	uint8_t* data = malloc(length ? length : 1);
+	if (!data)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	code = read_from_file(data, length, file);
+	if (code)
+	{
+		free(data);
+		return code;
+	}
+
+	pnm_reader_t reader = { data, length, 0 };
+	const uint8_t* magic;
+	int64_t max_value = -1;
+	memset(png, 0, sizeof(*png));
+	if (read_pnm_word(&magic, &reader) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6' && magic[1] != '7'))
+	{
+		fprintf(stderr, "Not a P5, P6 or P7 file");
+		free(data);
+		return ERROR_INVALID_DATA;
+	}
+	if (magic[1] == '7')
+	{
+		code = read_pam_header(png, &max_value, &reader);
+		if (code)
+		{
+			free(data);
+			return code;
+		}
+	}
+	else
+	{
+		int64_t width = read_pnm_number(&reader);
+		int64_t height = read_pnm_number(&reader);
+		max_value = read_pnm_number(&reader);
+		png->m_width = width < 0 ? 0 : (uint32_t)width;
+		png->m_height = height < 0 ? 0 : (uint32_t)height;
+		png->m_channels = magic[1] == '5' ? 1 : 3;
+	}
+	reader.m_cursor++;	  // the single whitespace character before the raster
+
+	if (!png->m_width || !png->m_height || png->m_width > 0x7FFFFFFF || png->m_height > 0x7FFFFFFF || !png->m_channels ||
+		max_value < 1 || max_value > 0xFFFF)
+	{
+		fprintf(stderr, "Invalid PNM header");
+		free(data);
+		return ERROR_INVALID_DATA;
+	}
+	png->m_max_value = (uint16_t)max_value;
+	png->m_sample_bytes = max_value > 0xFF ? 2 : 1;
+	png->m_bit_depth = png->m_sample_bytes * 8;
+
+	uint64_t image_length = (uint64_t)png->m_width * png->m_height * png->m_channels * png->m_sample_bytes;
+	if (reader.m_cursor > length || image_length > (uint64_t)(length - reader.m_cursor))
+	{
+		fprintf(stderr, "Input file ended");
+		free(data);
+		return ERROR_INVALID_DATA;
+	}
+	memmove(data, data + reader.m_cursor, image_length);
+	png->m_image_data = data;
+	return ERROR_SUCCESS;
+}
+
+void png_default_encoder_options(png_encoder_options_t* options)
+{
+	options->m_level = 6;
+	options->m_band_rows = 0;
+	options->m_filter = -1;
+}
+
+// picks the PNG pixel format for the samples of m_image_data; other maximum values than
+// 1, 3, 15 (greyscale only), 255 and 65535 are stored rescaled to 8 or 16 bits
+static size_t get_png_format(const png_t* png, uint8_t* bit_depth, uint8_t* color_type)
+{
+	static const uint8_t color_types[] = { 0, 0, 4, 2, 6 };
+	if (png->m_channels < 1 || png->m_channels > 4)
+	{
+		fprintf(stderr, "Invalid PNG channel count");
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (png->m_sample_bytes < 1 || png->m_sample_bytes > 2 || !png->m_max_value || (png->m_sample_bytes == 1 && png->m_max_value > 0xFF))
+	{
+		fprintf(stderr, "Invalid sample format");
+		return ERROR_INVALID_PARAMETER;
+	}
+	*color_type = color_types[png->m_channels];
+	*bit_depth = png->m_sample_bytes * 8;
+	if (png->m_sample_bytes == 1 && png->m_channels == 1 && (png->m_max_value == 1 || png->m_max_value == 3 || png->m_max_value == 15))
+		*bit_depth = png->m_max_value == 1 ? 1 : png->m_max_value == 3 ? 2 : 4;
+	return ERROR_SUCCESS;
+}
+
+// stretches samples from 0..max_value to the full range of their 1 or 2 bytes
+static void rescale_samples(uint8_t* output, const uint8_t* input, int64_t count, uint8_t sample_bytes, uint32_t max_value)
+{
+	uint32_t full = sample_bytes == 2 ? 0xFFFF : 0xFF;
+	for (int64_t i = 0; i < count; i++)
+	{
+		uint32_t value = sample_bytes == 2 ? (input[2 * i] << 8) | input[2 * i + 1] : input[i];
+		value = value < max_value ? (value * full + max_value / 2) / max_value : full;
+		if (sample_bytes == 2)
+		{
+			output[2 * i] = (uint8_t)(value >> 8);
+			output[2 * i + 1] = (uint8_t)value;
+		}
+		else
+			output[i] = (uint8_t)value;
+	}
+}
+
+// packs one byte samples into 1, 2 or 4-bit samples, the first sample in the high bits
+static void pack_samples(uint8_t* output, const uint8_t* input, int64_t count, uint8_t depth)
+{
+	int64_t samples_per_byte = 8 / depth;
+	uint8_t mask = (uint8_t)((1 << depth) - 1);
+	for (int64_t i = 0; i < count; i += samples_per_byte)
+	{
+		uint8_t byte = 0;
+		for (int64_t j = 0; j < samples_per_byte && i + j < count; j++)
+			byte |= (input[i + j] & mask) << (8 - depth * (j + 1));
+		*output++ = byte;
+	}
+}
+
+static uint64_t residual_cost(uint8_t residual)
+{
+	return abs((int8_t)residual);
+}
+
+// residuals of x in [begin, end) for Sub, Up, Average and Paeth, and the cost of every filter
+static void filter_bytes(uint8_t* const residuals[4], uint64_t costs[5], const uint8_t* row, const uint8_t* prior, int64_t begin, int64_t end, int64_t bytes_per_pixel)
+{
+	for (int64_t x = begin; x < end; x++)
+	{
+		uint8_t left = x >= bytes_per_pixel ? row[x - bytes_per_pixel] : 0;
+		uint8_t upper_left = x >= bytes_per_pixel ? prior[x - bytes_per_pixel] : 0;
+		uint8_t current = row[x];
+		uint8_t r[4] = {
+			(uint8_t)(current - left),
+			(uint8_t)(current - prior[x]),
+			(uint8_t)(current - ((left + prior[x]) >> 1)),
+			(uint8_t)(current - paeth_predictor(left, prior[x], upper_left)),
+		};
+		costs[None] += residual_cost(current);
+		for (int32_t f = 0; f < 4; f++)
+		{
+			residuals[f][x] = r[f];
+			costs[f + 1] += residual_cost(r[f]);
+		}
+	}
+}
+
+#if defined __SSE2__
+static __m128i abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+// mask ? b : a
+static __m128i select_si128(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a));
+}
+
+// paeth_predictor on eight 16-bit lanes
+static __m128i paeth_epi16(__m128i left, __m128i above, __m128i upper_left)
+{
+	__m128i distance_left = abs_epi16(_mm_sub_epi16(above, upper_left));
+	__m128i distance_above = abs_epi16(_mm_sub_epi16(left, upper_left));
+	__m128i distance_upper_left = abs_epi16(_mm_sub_epi16(_mm_add_epi16(left, above), _mm_add_epi16(upper_left, upper_left)));
+	__m128i not_left = _mm_or_si128(_mm_cmpgt_epi16(distance_left, distance_above), _mm_cmpgt_epi16(distance_left, distance_upper_left));
+	__m128i not_above = _mm_cmpgt_epi16(distance_above, distance_upper_left);
+	return select_si128(not_left, left, select_si128(not_above, above, upper_left));
+}
+
+// sum of |(int8_t)r| over the 16 bytes, in two 64-bit halves
+static __m128i residual_cost_sse2(__m128i residual)
+{
+	__m128i zero = _mm_setzero_si128();
+	return _mm_sad_epu8(_mm_min_epu8(residual, _mm_sub_epi8(zero, residual)), zero);
+}
+
+// filter_bytes for 16 bytes per step from x = bytes_per_pixel on; returns where it stopped
+static int64_t filter_bytes_sse2(uint8_t* const residuals[4], uint64_t costs[5], const uint8_t* row, const uint8_t* prior, int64_t byte_width, int64_t bytes_per_pixel)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi8(1);
+	__m128i totals[5] = { zero, zero, zero, zero, zero };
+	int64_t x = bytes_per_pixel;
+	for (; x + 16 <= byte_width; x += 16)
+	{
+		__m128i current = _mm_loadu_si128((const __m128i*)(row + x));
+		__m128i left = _mm_loadu_si128((const __m128i*)(row + x - bytes_per_pixel));
+		__m128i above = _mm_loadu_si128((const __m128i*)(prior + x));
+		__m128i upper_left = _mm_loadu_si128((const __m128i*)(prior + x - bytes_per_pixel));
+
+		// _mm_avg_epu8 rounds up, the PNG average rounds down
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(left, above), _mm_and_si128(_mm_xor_si128(left, above), one));
+		__m128i paeth = _mm_packus_epi16(
+			paeth_epi16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(above, zero), _mm_unpacklo_epi8(upper_left, zero)),
+			paeth_epi16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(above, zero), _mm_unpackhi_epi8(upper_left, zero)));
+
+		__m128i r[5] = {
+			current,
+			_mm_sub_epi8(current, left),
+			_mm_sub_epi8(current, above),
+			_mm_sub_epi8(current, average),
+			_mm_sub_epi8(current, paeth),
+		};
+		totals[0] = _mm_add_epi64(totals[0], residual_cost_sse2(r[0]));
+		for (int32_t f = 1; f < 5; f++)
+		{
+			_mm_storeu_si128((__m128i*)(residuals[f - 1] + x), r[f]);
+			totals[f] = _mm_add_epi64(totals[f], residual_cost_sse2(r[f]));
+		}
+	}
+	for (int32_t f = 0; f < 5; f++)
+	{
+		costs[f] += (uint64_t)_mm_cvtsi128_si64(totals[f]) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(totals[f], totals[f]));
+	}
+	return x;
+}
+#endif
+
+// Writes the filter byte and the filtered row. Unless a filter is forced, it is the one with the
+// smallest sum of absolute residuals taken as signed bytes (the heuristic of the PNG specification).
+// scratch holds 4 * byte_width bytes; prior is a zero row above the image.
+static void filter_row(uint8_t* output, const uint8_t* row, const uint8_t* prior, int64_t byte_width, int64_t bytes_per_pixel, int32_t forced, uint8_t* scratch)
+{
+	uint8_t* const residuals[4] = { scratch, scratch + byte_width, scratch + 2 * byte_width, scratch + 3 * byte_width };
+	uint64_t costs[5] = { 0 };
+	int64_t head = bytes_per_pixel < byte_width ? bytes_per_pixel : byte_width;
+	filter_bytes(residuals, costs, row, prior, 0, head, bytes_per_pixel);
+	int64_t x = head;
+#if defined __SSE2__
+	x = filter_bytes_sse2(residuals, costs, row, prior, byte_width, bytes_per_pixel);
+#endif
+	filter_bytes(residuals, costs, row, prior, x, byte_width, bytes_per_pixel);
+
+	uint8_t best = None;
+	for (uint8_t f = Sub; f <= Paeth; f++)
+	{
+		if (costs[f] < costs[best])
+			best = f;
+	}
+	if (forced >= 0)
+		best = (uint8_t)forced;
+	output[0] = best;
+	memcpy(output + 1, best == None ? row : residuals[best - 1], byte_width);
+}
+
+static void store_big_endian_32(uint8_t* output, uint32_t value)
+{
+	output[0] = (uint8_t)(value >> 24);
+	output[1] = (uint8_t)(value >> 16);
+	output[2] = (uint8_t)(value >> 8);
+	output[3] = (uint8_t)value;
+}
+
+// fills in the length, type and CRC around data_length bytes at chunk + 8
+static void finish_chunk(uint8_t* chunk, chunk_type_t type, int64_t data_length)
+{
+	uint32_t type_bytes = (uint32_t)type;
+	store_big_endian_32(chunk, (uint32_t)data_length);
+	memcpy(chunk + 4, &type_bytes, 4);
+	store_big_endian_32(chunk + 8 + data_length, crc32_calculate(0, chunk + 4, data_length + 4));
+}
+
+typedef struct png_band_t_tag
+{
+	uint8_t* m_chunk;	 // a whole IDAT chunk
+	int64_t m_data_length;
+	int64_t m_filtered_length;
+	uLong m_adler;	  // of this band's filtered bytes alone
+	size_t m_code;
+} png_band_t;
+
+// Deflates one band as a raw deflate stream primed with the 32 KiB before it. Every band but the
+// last ends with a sync flush on a byte boundary, so the bands concatenate into one stream.
+static size_t compress_band(png_band_t* band, const uint8_t* filtered, int64_t start, int32_t level, int first, int last)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		fprintf(stderr, "deflateInit2 failed");
+		return ERROR_MEMORY;
+	}
+	int64_t dictionary_length = start < DICTIONARY_BYTES ? start : DICTIONARY_BYTES;
+	if (dictionary_length && deflateSetDictionary(&stream, filtered + start - dictionary_length, (uInt)dictionary_length) != Z_OK)
+	{
+		deflateEnd(&stream);
+		fprintf(stderr, "deflateSetDictionary failed");
+		return ERROR_UNKNOWN;
+	}
+
+	// zlib header in the first band, a 5-byte sync marker, adler32 and CRC after the last
+	int64_t header_length = first ? 2 : 0;
+	int64_t bound = deflateBound(&stream, band->m_filtered_length) + 16;
+	band->m_chunk = malloc(8 + header_length + bound + 4 + 4);
+	if (!band->m_chunk)
+	{
+		deflateEnd(&stream);
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+	stream.next_in = (Bytef*)(filtered + start);
+	stream.avail_in = (uInt)band->m_filtered_length;
+	stream.next_out = band->m_chunk + 8 + header_length;
+	stream.avail_out = (uInt)bound;
+	int status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+	int complete = last ? status == Z_STREAM_END : status == Z_OK && !stream.avail_in && stream.avail_out;
+	int64_t compressed_length = stream.total_out;
+	deflateEnd(&stream);
+	if (!complete)
+	{
+		fprintf(stderr, "deflate failed");
+		return ERROR_UNKNOWN;
+	}
+
+	if (first)
+	{
+		// CMF: deflate with a 32K window; FLG: level hint, FCHECK makes CMF * 256 + FLG a multiple of 31
+		uint8_t level_hint = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+		uint32_t header = 0x7800 | (level_hint << 6);
+		header += 31 - header % 31;
+		band->m_chunk[8] = (uint8_t)(header >> 8);
+		band->m_chunk[9] = (uint8_t)header;
+	}
+	band->m_data_length = header_length + compressed_length;
+	band->m_adler = adler32(adler32(0, Z_NULL, 0), filtered + start, (uInt)band->m_filtered_length);
+	if (!last)
+		finish_chunk(band->m_chunk, IDAT, band->m_data_length);
+	return ERROR_SUCCESS;
+}
+
+static size_t write_png(const uint8_t* header, int64_t header_length, png_band_t* bands, int64_t band_count, const uint8_t* trailer, FILE* file)
+{
+#if defined POSIX_IO
+	// signature, IHDR, every IDAT and IEND with a few system calls, bypassing the stdio buffer
+	if (fflush(file))
+	{
+		fprintf(stderr, "fflush failed");
+		return ERROR_UNKNOWN;
+	}
+	struct iovec vectors[WRITE_BATCH];
+	int count = 0;
+	for (int64_t b = -1; b <= band_count; b++)
+	{
+		if (b < 0)
+			vectors[count] = (struct iovec){ (void*)header, header_length };
+		else if (b == band_count)
+			vectors[count] = (struct iovec){ (void*)trailer, 12 };
+		else
+			vectors[count] = (struct iovec){ bands[b].m_chunk, bands[b].m_data_length + 12 };
+		if (++count == WRITE_BATCH || b == band_count)
+		{
+			size_t code = write_vectors(fileno(file), vectors, count);
+			if (code)
+				return code;
+			count = 0;
+		}
+	}
+	return ERROR_SUCCESS;
+#else
+	size_t code = write_to_file(header, header_length, file);
+	for (int64_t b = 0; b < band_count && !code; b++)
+		code = write_to_file(bands[b].m_chunk, bands[b].m_data_length + 12, file);
+	if (!code)
+		code = write_to_file(trailer, 12, file);
+	return code;
+#endif
+}
+
+size_t save_png_by_file_handle(const png_t* png, FILE* file, const png_encoder_options_t* options)
+{
+	size_t code;
+
+	uint8_t bit_depth;
+	uint8_t color_type;
+	code = get_png_format(png, &bit_depth, &color_type);
+	if (code)
+		return code;
+	if (!png->m_width || !png->m_height || png->m_width > 0x7FFFFFFF || png->m_height > 0x7FFFFFFF)
+	{
+		fprintf(stderr, "Invalid image size");
+		return ERROR_INVALID_PARAMETER;
+	}
+	if (options->m_level < 0 || options->m_level > 9 || options->m_band_rows < 0 || options->m_filter < -1 || options->m_filter > Paeth)
+	{
+		fprintf(stderr, "Invalid encoder options");
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	int64_t width = png->m_width;
+	int64_t height = png->m_height;
+	int64_t pixel_bytes = (int64_t)png->m_channels * png->m_sample_bytes;
+	int64_t source_width = width * pixel_bytes;
+	int64_t byte_width = bit_depth < 8 ? (width * bit_depth + 7) / 8 : source_width;
+	int64_t filtered_width = byte_width + 1;
+
+	int64_t band_rows = options->m_band_rows ? options->m_band_rows : BAND_BYTES / filtered_width + 1;
+	if (band_rows > MAX_BAND_BYTES / filtered_width)
+		band_rows = MAX_BAND_BYTES / filtered_width;
+	if (band_rows < 1)
+	{
+		fprintf(stderr, "Image row is too long");
+		return ERROR_UNSUPPORTED;
+	}
+	int64_t band_count = (height + band_rows - 1) / band_rows;
+
+	const uint8_t* pixels = png->m_image_data;
+	uint8_t* rescaled = 0;
+	if (bit_depth >= 8 && png->m_max_value != (1u << bit_depth) - 1)
+	{
+		rescaled = malloc(height * source_width);
+		if (!rescaled)
+		{
+			fprintf(stderr, "cannot allocate memory");
+			return ERROR_MEMORY;
+		}
+		PARALLEL_FOR
+		for (int64_t y = 0; y < height; y++)
+		{
+			rescale_samples(rescaled + y * source_width, pixels + y * source_width, width * png->m_channels, png->m_sample_bytes, png->m_max_value);
+		}
+		pixels = rescaled;
+	}
+
+	int64_t thread_count = THREAD_COUNT;
+	uint8_t* filtered = malloc(height * filtered_width);
+	uint8_t* zero_row = calloc(source_width, 1);
+	uint8_t* scratch = malloc(4 * byte_width * thread_count);
+	png_band_t* bands = calloc(band_count, sizeof(png_band_t));
+	if (!filtered || !zero_row || !scratch || !bands)
+	{
+		free(filtered);
+		free(zero_row);
+		free(scratch);
+		free(bands);
+		free(rescaled);
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_MEMORY;
+	}
+
+	// filtering reads only source rows, so all bands filter independently
+	PARALLEL_FOR
+	for (int64_t b = 0; b < band_count; b++)
+	{
+		int64_t last_row = (b + 1) * band_rows < height ? (b + 1) * band_rows : height;
+		uint8_t* thread_scratch = scratch + 4 * byte_width * THREAD_INDEX;
+		for (int64_t y = b * band_rows; y < last_row; y++)
+		{
+			const uint8_t* row = pixels + y * source_width;
+			uint8_t* output = filtered + y * filtered_width;
+			if (bit_depth < 8)
+			{
+				// filters rarely pay off below 8 bits, the specification recommends None
+				output[0] = None;
+				pack_samples(output + 1, row, width, bit_depth);
+			}
+			else
+				filter_row(output, row, y ? row - source_width : zero_row, byte_width, pixel_bytes, options->m_filter, thread_scratch);
+		}
+		bands[b].m_filtered_length = (last_row - b * band_rows) * filtered_width;
+	}
+
+	// pigz-style: bands deflate in parallel, each primed with the filtered bytes before it
+	PARALLEL_FOR
+	for (int64_t b = 0; b < band_count; b++)
+	{
+		bands[b].m_code = compress_band(&bands[b], filtered, b * band_rows * filtered_width, options->m_level, b == 0, b == band_count - 1);
+	}
+	for (int64_t b = 0; b < band_count && !code; b++)
+	{
+		code = bands[b].m_code;
+	}
+
+	if (!code)
+	{
+		// the stream's adler32 joins the per-band checksums, then closes the last IDAT
+		uLong adler = bands[0].m_adler;
+		for (int64_t b = 1; b < band_count; b++)
+		{
+			adler = adler32_combine(adler, bands[b].m_adler, bands[b].m_filtered_length);
+		}
+		png_band_t* last = &bands[band_count - 1];
+		store_big_endian_32(last->m_chunk + 8 + last->m_data_length, (uint32_t)adler);
+		last->m_data_length += 4;
+		finish_chunk(last->m_chunk, IDAT, last->m_data_length);
+
+		uint8_t header[8 + 12 + 13] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		uint8_t* ihdr = header + 8;
+		store_big_endian_32(ihdr + 8, png->m_width);
+		store_big_endian_32(ihdr + 12, png->m_height);
+		ihdr[16] = bit_depth;
+		ihdr[17] = color_type;
+		ihdr[18] = 0;	 // deflate
+		ihdr[19] = 0;	 // adaptive filtering
+		ihdr[20] = 0;	 // not interlaced
+		finish_chunk(ihdr, IHDR, 13);
+
+		uint8_t trailer[12];
+		finish_chunk(trailer, IEND, 0);
+
+		code = write_png(header, sizeof(header), bands, band_count, trailer, file);
+	}
+
+	for (int64_t b = 0; b < band_count; b++)
+	{
+		free(bands[b].m_chunk);
+	}
+	free(bands);
+	free(scratch);
+	free(zero_row);
+	free(filtered);
+	free(rescaled);
+	return code;
+}
@@ -0,0 +1,137 @@
+// Shared by the decoder and the encoder, not part of the library interface
+#pragma once
+
+#include "../common/file_io.h"
+#include "png.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined __unix__ || defined __APPLE__
+#	define POSIX_IO
+#	include <pthread.h>
+#	include <sys/uio.h>
+#	include <unistd.h>
+#endif
+
+// one-time initialization of process-wide tables, whichever thread gets there first
+#if defined POSIX_IO
+typedef pthread_once_t once_t;
+#	define ONCE_INIT PTHREAD_ONCE_INIT
+#	define run_once pthread_once
+#else
+#	include <threads.h>
+typedef once_flag once_t;
+#	define ONCE_INIT ONCE_FLAG_INIT
+#	define run_once call_once
+#endif
+
+#if defined __SSE2__
+#	include <emmintrin.h>
+#endif
+
+#if defined ZLIB
+#	include <zlib.h>
+#elif defined LIBDEFLATE
+#	error("libdeflate is not currently supported")
+#	include <libdeflate.h>
+#elif defined ISAL
+#	error("isa-l is not currently supported")
+#	include <include/igzip_lib.h>
+#else
+#	error("A deflate decoding library must be selected")
+#endif
+
+#if defined _OPENMP
+#	include <omp.h>
+#	define PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic)")
+#	define THREAD_COUNT omp_get_max_threads()
+#	define THREAD_INDEX omp_get_thread_num()
+#else
+#	define PARALLEL_FOR
+#	define THREAD_COUNT 1
+#	define THREAD_INDEX 0
+#endif
+
+static inline uint32_t reverse_byte_order_32(uint32_t x)
+{
+	return ((x & 0x000000FF) << 0x18) | ((x & 0x0000FF00) << 0x08) | ((x & 0x00FF0000) >> 0x08) | ((x & 0xFF000000) >> 0x18);
+}
+
+typedef enum chunk_type_t_tag
+{
+#define BYTES_TO_INT(b0, b1, b2, b3) (b0 << 0x00) | (b1 << 0x08) | (b2 << 0x10) | (b3 << 0x18)
+
+	IHDR = BYTES_TO_INT('I', 'H', 'D', 'R'),
+	PLTE = BYTES_TO_INT('P', 'L', 'T', 'E'),
+	IDAT = BYTES_TO_INT('I', 'D', 'A', 'T'),
+	IEND = BYTES_TO_INT('I', 'E', 'N', 'D'),
+	tRNS = BYTES_TO_INT('t', 'R', 'N', 'S'),
+#undef BYTES_TO_INT
+} chunk_type_t;
+
+typedef enum filter_type_t_tag
+{
+	None,
+	Sub,
+	Up,
+	Average,
+	Paeth,
+} filter_type_t;
+
+static inline uint8_t paeth_predictor(int32_t left, int32_t above, int32_t upper_left)
+{
+	int32_t distance = above + left - upper_left;	 // Alan Paeth method
+	int32_t dist_l = abs(distance - left);
+	int32_t dist_a = abs(distance - above);
+	int32_t dist_ul = abs(distance - upper_left);
+	if ((dist_l <= dist_a) && (dist_l <= dist_ul))
+		return (uint8_t)left;
+	if (dist_a <= dist_ul)
+		return (uint8_t)above;
+	return (uint8_t)upper_left;
+}
+
+// decoding state of one image, the decoder owns the buffers
+typedef struct png_reader_t_tag
+{
+	const uint8_t* m_data;
+	int64_t m_length;
+	int64_t m_cursor;
+	const png_options_t* m_options;
+	png_decoder_t* m_decoder;
+
+	// IDAT payloads are inflated where they are in m_data, chunk after chunk from m_idat_start to m_idat_end
+	int64_t m_idat_start;
+	int64_t m_idat_cursor;
+	int64_t m_idat_end;
+	int64_t m_compressed_data_length;	 // of all IDAT payloads
+	uint8_t* m_filtered_data;
+	int64_t m_filtered_data_length;
+} png_reader_t;
+
+typedef struct png_chunk_t_tag
+{
+	uint32_t m_length;
+	uint32_t m_type;
+	const uint8_t* m_data;
+	uint32_t m_crc;
+} png_chunk_t;
+
+// decoder stages, also timed one by one in benchmark.c
+size_t read_chunk(png_chunk_t* chunk, png_reader_t* reader);	// reads and checks the next chunk, the data stays in place
+size_t unfilter_row(uint8_t* output, const uint8_t* input, const uint8_t* prior, int64_t byte_width, int64_t bytes_per_pixel, uint8_t filter);
+
+// png_layout.c: rows arrive packed in the pixel format of png and leave in the requested layout
+int64_t get_layout_pixel_bytes(const png_t* png, png_layout_t layout);
+void set_layout_format(png_t* png, png_layout_t layout);	// after the row is converted, not before
+void convert_row(uint8_t* image, const uint8_t* row, int64_t y, const png_t* png, png_layout_t layout, uint8_t* scratch);
+
+size_t read_from_file(void* buffer, size_t size, FILE* file);
+size_t get_file_length(int64_t* length, FILE* file);
+#if defined POSIX_IO
+size_t write_vectors(int descriptor, struct iovec* vectors, int count);
+#else
+size_t write_to_file(const void* buffer, size_t size, FILE* file);
+#endif
@@ -0,0 +1,329 @@
+#include "png_internal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined __x86_64__ || defined __i386__
+#	define X86_LAYOUT
+#	include <immintrin.h>
+#endif
+
+int64_t get_layout_pixel_bytes(const png_t* png, png_layout_t layout)
+{
+	switch (layout)
+	{
+	case LayoutRgba32:
+		return 4;
+	case LayoutFloat:
+		return png->m_channels * (int64_t)sizeof(float);
+	default:
+		return png->m_channels * png->m_sample_bytes;
+	}
+}
+
+void set_layout_format(png_t* png, png_layout_t layout)
+{
+	png->m_layout = (uint8_t)layout;
+	if (layout == LayoutRgba32)
+	{
+		png->m_channels = 4;
+		png->m_sample_bytes = 1;
+		png->m_max_value = 255;
+	}
+	else if (layout == LayoutFloat)
+	{
+		png->m_sample_bytes = sizeof(float);
+		png->m_max_value = 1;
+	}
+}
+
+// samples as bytes over the whole 0..255 range: the high byte of 16-bit samples, sub-byte greyscale stretched
+static const uint8_t* get_full_range_bytes(const uint8_t* row, int64_t count, const png_t* png, uint8_t* scratch)
+{
+	if (png->m_sample_bytes == 2)
+	{
+		for (int64_t i = 0; i < count; i++)
+			scratch[i] = row[2 * i];
+		return scratch;
+	}
+	if (png->m_max_value == 255)
+		return row;
+	for (int64_t i = 0; i < count; i++)
+		scratch[i] = (uint8_t)((row[i] * 255 + png->m_max_value / 2) / png->m_max_value);
+	return scratch;
+}
+
+#if defined X86_LAYOUT
+static int ssse3_support = -1;
+
+static int has_ssse3(void)
+{
+	if (ssse3_support < 0)
+	{
+		__builtin_cpu_init();
+		ssse3_support = __builtin_cpu_supports("ssse3");
+	}
+	return ssse3_support;
+}
+
+// 4 pixels per shuffle; stops 2 pixels early so the 16-byte loads stay inside the row
+__attribute__((target("ssse3"))) static int64_t rgba_from_rgb_ssse3(uint8_t* output, const uint8_t* input, int64_t count)
+{
+	__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	int64_t x = 0;
+	for (; x + 6 <= count; x += 4)
+	{
+		__m128i rgb = _mm_loadu_si128((const __m128i*)(input + x * 3));
+		_mm_storeu_si128((__m128i*)(output + x * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+	}
+	return x;
+}
+
+// 16 pixels from three loads: each plane gathers its bytes from every load with its own shuffle
+__attribute__((target("ssse3"))) static int64_t planes_from_rgb_ssse3(uint8_t* const planes[4], const uint8_t* input, int64_t count)
+{
+	__m128i masks[3][3];
+	for (int32_t c = 0; c < 3; c++)
+	{
+		int8_t bytes[3][16];
+		memset(bytes, -1, sizeof(bytes));
+		for (int32_t i = 0; i < 16; i++)
+		{
+			int32_t source = 3 * i + c;
+			bytes[source / 16][i] = (int8_t)(source % 16);
+		}
+		for (int32_t v = 0; v < 3; v++)
+			masks[c][v] = _mm_loadu_si128((const __m128i*)bytes[v]);
+	}
+	int64_t x = 0;
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i v[3] = {
+			_mm_loadu_si128((const __m128i*)(input + x * 3)),
+			_mm_loadu_si128((const __m128i*)(input + x * 3 + 16)),
+			_mm_loadu_si128((const __m128i*)(input + x * 3 + 32)),
+		};
+		for (int32_t c = 0; c < 3; c++)
+		{
+			__m128i plane = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], masks[c][0]), _mm_shuffle_epi8(v[1], masks[c][1])),
+										 _mm_shuffle_epi8(v[2], masks[c][2]));
+			_mm_storeu_si128((__m128i*)(planes[c] + x), plane);
+		}
+	}
+	return x;
+}
+#endif
+
+static void rgba_from_bytes(uint8_t* output, const uint8_t* input, int64_t count, int64_t channels)
+{
+	int64_t x = 0;
+	switch (channels)
+	{
+	case 1:
+#if defined __SSE2__
+		for (; x + 16 <= count; x += 16)
+		{
+			// (g, g) pairs interleaved with (g, 255) pairs make (g, g, g, 255)
+			__m128i grey = _mm_loadu_si128((const __m128i*)(input + x));
+			__m128i opaque = _mm_set1_epi8((char)0xFF);
+			__m128i pairs_low = _mm_unpacklo_epi8(grey, grey);
+			__m128i pairs_high = _mm_unpackhi_epi8(grey, grey);
+			__m128i alpha_low = _mm_unpacklo_epi8(grey, opaque);
+			__m128i alpha_high = _mm_unpackhi_epi8(grey, opaque);
+			_mm_storeu_si128((__m128i*)(output + x * 4), _mm_unpacklo_epi16(pairs_low, alpha_low));
+			_mm_storeu_si128((__m128i*)(output + x * 4 + 16), _mm_unpackhi_epi16(pairs_low, alpha_low));
+			_mm_storeu_si128((__m128i*)(output + x * 4 + 32), _mm_unpacklo_epi16(pairs_high, alpha_high));
+			_mm_storeu_si128((__m128i*)(output + x * 4 + 48), _mm_unpackhi_epi16(pairs_high, alpha_high));
+		}
+#endif
+		for (; x < count; x++)
+		{
+			uint8_t* pixel = output + x * 4;
+			pixel[0] = pixel[1] = pixel[2] = input[x];
+			pixel[3] = 255;
+		}
+		break;
+	case 2:
+#if defined __SSE2__
+		for (; x + 8 <= count; x += 8)
+		{
+			// each (g, a) pair doubled to (g, a, g, a), then the second byte replaced by g
+			__m128i pairs = _mm_loadu_si128((const __m128i*)(input + x * 2));
+			__m128i keep = _mm_set1_epi32((int)0xFFFF00FF);
+			__m128i grey = _mm_set1_epi32(0x0000FF00);
+			__m128i low = _mm_unpacklo_epi16(pairs, pairs);
+			__m128i high = _mm_unpackhi_epi16(pairs, pairs);
+			low = _mm_or_si128(_mm_and_si128(low, keep), _mm_and_si128(_mm_slli_epi32(low, 8), grey));
+			high = _mm_or_si128(_mm_and_si128(high, keep), _mm_and_si128(_mm_slli_epi32(high, 8), grey));
+			_mm_storeu_si128((__m128i*)(output + x * 4), low);
+			_mm_storeu_si128((__m128i*)(output + x * 4 + 16), high);
+		}
+#endif
+		for (; x < count; x++)
+		{
+			uint8_t* pixel = output + x * 4;
+			pixel[0] = pixel[1] = pixel[2] = input[x * 2];
+			pixel[3] = input[x * 2 + 1];
+		}
+		break;
+	case 3:
+#if defined X86_LAYOUT
+		if (has_ssse3())
+			x = rgba_from_rgb_ssse3(output, input, count);
+#endif
+		for (; x < count; x++)
+		{
+			uint8_t* pixel = output + x * 4;
+			pixel[0] = input[x * 3];
+			pixel[1] = input[x * 3 + 1];
+			pixel[2] = input[x * 3 + 2];
+			pixel[3] = 255;
+		}
+		break;
+	default:
+		memcpy(output, input, count * 4);
+		break;
+	}
+}
+
+static void planes_from_bytes(uint8_t* const planes[4], const uint8_t* input, int64_t count, int64_t channels)
+{
+	int64_t x = 0;
+	if (channels == 1)
+	{
+		memcpy(planes[0], input, count);
+		return;
+	}
+#if defined __SSE2__
+	if (channels == 2)
+	{
+		// even bytes by masking, odd bytes by shifting, both packed back to bytes
+		__m128i low_bytes = _mm_set1_epi16(0x00FF);
+		for (; x + 16 <= count; x += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(input + x * 2));
+			__m128i b = _mm_loadu_si128((const __m128i*)(input + x * 2 + 16));
+			_mm_storeu_si128((__m128i*)(planes[0] + x), _mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_and_si128(b, low_bytes)));
+			_mm_storeu_si128((__m128i*)(planes[1] + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+		}
+	}
+	else if (channels == 4)
+	{
+		// every channel is one byte of the 32-bit pixel: shifted down, masked and packed twice
+		__m128i low_byte = _mm_set1_epi32(0xFF);
+		for (; x + 16 <= count; x += 16)
+		{
+			__m128i v[4];
+			for (int32_t i = 0; i < 4; i++)
+				v[i] = _mm_loadu_si128((const __m128i*)(input + x * 4 + i * 16));
+			for (int32_t c = 0; c < 4; c++)
+			{
+				__m128i s[4];
+				for (int32_t i = 0; i < 4; i++)
+					s[i] = _mm_and_si128(_mm_srli_epi32(v[i], 8 * c), low_byte);
+				__m128i words = _mm_packs_epi32(s[0], s[1]);
+				__m128i more_words = _mm_packs_epi32(s[2], s[3]);
+				_mm_storeu_si128((__m128i*)(planes[c] + x), _mm_packus_epi16(words, more_words));
+			}
+		}
+	}
+#endif
+#if defined X86_LAYOUT
+	if ((channels == 3) && has_ssse3())
+		x = planes_from_rgb_ssse3(planes, input, count);
+#endif
+	for (; x < count; x++)
+	{
+		for (int64_t c = 0; c < channels; c++)
+			planes[c][x] = input[x * channels + c];
+	}
+}
+
+static void floats_from_bytes(float* output, const uint8_t* input, int64_t count, float scale)
+{
+	int64_t i = 0;
+#if defined __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128 factor = _mm_set1_ps(scale);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(input + i));
+		__m128i words[2] = { _mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero) };
+		for (int32_t w = 0; w < 2; w++)
+		{
+			__m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words[w], zero));
+			__m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words[w], zero));
+			_mm_storeu_ps(output + i + w * 8, _mm_mul_ps(low, factor));
+			_mm_storeu_ps(output + i + w * 8 + 4, _mm_mul_ps(high, factor));
+		}
+	}
+#endif
+	for (; i < count; i++)
+		output[i] = input[i] * scale;
+}
+
+static void floats_from_words(float* output, const uint8_t* input, int64_t count, float scale)
+{
+	int64_t i = 0;
+#if defined __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128 factor = _mm_set1_ps(scale);
+	for (; i + 8 <= count; i += 8)
+	{
+		// big-endian samples: bytes of every word swapped before widening
+		__m128i words = _mm_loadu_si128((const __m128i*)(input + i * 2));
+		words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+		__m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		__m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+		_mm_storeu_ps(output + i, _mm_mul_ps(low, factor));
+		_mm_storeu_ps(output + i + 4, _mm_mul_ps(high, factor));
+	}
+#endif
+	for (; i < count; i++)
+		output[i] = ((input[i * 2] << 8) | input[i * 2 + 1]) * scale;
+}
+
+void convert_row(uint8_t* image, const uint8_t* row, int64_t y, const png_t* png, png_layout_t layout, uint8_t* scratch)
+{
+	int64_t width = png->m_width;
+	int64_t channels = png->m_channels;
+	int64_t sample_bytes = png->m_sample_bytes;
+	switch (layout)
+	{
+	case LayoutPlanar:
+		if (sample_bytes == 2)
+		{
+			int64_t plane_length = width * png->m_height * 2;
+			for (int64_t x = 0; x < width; x++)
+			{
+				for (int64_t c = 0; c < channels; c++)
+					memcpy(image + c * plane_length + (y * width + x) * 2, row + (x * channels + c) * 2, 2);
+			}
+		}
+		else
+		{
+			int64_t plane_length = width * png->m_height;
+			uint8_t* const planes[4] = {
+				image + y * width,
+				image + plane_length + y * width,
+				image + 2 * plane_length + y * width,
+				image + 3 * plane_length + y * width,
+			};
+			planes_from_bytes(planes, row, width, channels);
+		}
+		break;
+	case LayoutRgba32:
+		rgba_from_bytes(image + y * width * 4, get_full_range_bytes(row, width * channels, png, scratch), width, channels);
+		break;
+	case LayoutFloat:
+		if (sample_bytes == 2)
+			floats_from_words((float*)image + y * width * channels, row, width * channels, 1.0f / png->m_max_value);
+		else
+			floats_from_bytes((float*)image + y * width * channels, row, width * channels, 1.0f / png->m_max_value);
+		break;
+	default:
+		memcpy(image + y * width * channels * sample_bytes, row, width * channels * sample_bytes);
+		break;
+	}
+}
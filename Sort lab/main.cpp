@@ -1,14 +1,36 @@
+#include "../common/file_io.h"
 #include "phonebook.h"
 #include "quicksort.h"
-#include "return_codes.h"
+#include "../common/return_codes.h"
 
 #include <cstdlib>
 #include <iostream>
 
 using namespace std;
 
+static bool read_value(text_t* in, int& value)
+{
+	return read_int(in, &value);
+}
+
+static bool read_value(text_t* in, float& value)
+{
+	return read_float(in, &value);
+}
+
+static void write_value(FILE* out, int value)
+{
+	fprintf(out, "%d\n", value);
+}
+
+// what cout prints for a float
+static void write_value(FILE* out, float value)
+{
+	fprintf(out, "%g\n", value);
+}
+
 template< typename T, bool descending >
-size_t qs(FILE* out, int size)
+int qs(text_t* in, FILE* out, int size)
 {
 	T* res = new T[size];
 	if (res == nullptr)
@@ -18,19 +40,42 @@ size_t qs(FILE* out, int size)
 	}
 	for (int i = 0; i < size; i++)
 	{
-		cin >> res[i];
+		if (!read_value(in, res[i]))
+		{
+			cerr << "invalid value " << i;
+			delete[](res);
+			return ERROR_INVALID_DATA;
+		}
 	}
 	int l = 0;
 	quicksort< T, descending >(res, l, size);
 	for (size_t i = 0; i < size; i++)
 	{
-		cout << res[i] << "\n";
+		write_value(out, res[i]);
 	}
 	delete[](res);
-	fclose(out);
 	return ERROR_SUCCESS;
 }
 
+template< bool descending >
+int qs(const string& type, text_t* in, FILE* out, int size)
+{
+	if (type == "int")
+	{
+		return qs< int, descending >(in, out, size);
+	}
+	else if (type == "float")
+	{
+		return qs< float, descending >(in, out, size);
+	}
+	else if (type == "phonebook")
+	{
+		return qs< phonebook, descending >(in, out, size);
+	}
+	cerr << "unknown type";
+	return ERROR_NOT_IMPLEMENTED;
+}
+
 int main(int argc, char** argv)
 {
 	if (argc != 3)
@@ -38,61 +83,55 @@ int main(int argc, char** argv)
 		cerr << "wrong number of arguments\n";
 		return ERROR_INVALID_DATA;
 	}
-	FILE* in = freopen(argv[1], "r", stdin);
-	if (in == nullptr)
+	mapped_file_t input;
+	int code = map_file(&input, argv[1]);
+	if (code)
 	{
 		cerr << "cannot open an input file\n";
-		return ERROR_FILE_NOT_FOUND;
+		return code;
 	}
-	FILE* out = freopen(argv[2], "w", stdout);
-	if (out == nullptr)
+	output_file_t output;
+	code = open_output(&output, argv[2], "w");
+	if (code)
 	{
 		cerr << "cannot open an output file\n";
-		return ERROR_FILE_NOT_FOUND;
+		unmap_file(&input);
+		return code;
 	}
+	text_t in = { input.m_data, input.m_data + input.m_length };
+	const char* token;
+	size_t length;
 	string type, mode;
-	cin >> type >> mode;
+	if (read_token(&in, &token, &length))
+		type.assign(token, length);
+	if (read_token(&in, &token, &length))
+		mode.assign(token, length);
 
 	int size;
-	cin >> size;
-
-	if (mode == "descending")
+	if (mode != "descending" && mode != "ascending")
 	{
-		if (type == "int")
-		{
-			qs< int, true >(out, size);
-		}
-		else if (type == "float")
-		{
-			qs< float, true >(out, size);
-		}
-		else if (type == "phonebook")
-		{
-			qs< phonebook, true >(out, size);
-		}
+		cerr << "unknown mode";
+		code = ERROR_NOT_IMPLEMENTED;
 	}
-	else if (mode == "ascending")
+	else if (!read_int(&in, &size) || size < 0)
 	{
-		if (type == "int")
-		{
-			qs< int, false >(out, size);
-		}
-		else if (type == "float")
-		{
-			qs< float, false >(out, size);
-		}
-		else if (type == "phonebook")
-		{
-			qs< phonebook, false >(out, size);
-		}
+		cerr << "invalid size";
+		code = ERROR_INVALID_DATA;
+	}
+	else if (mode == "descending")
+	{
+		code = qs< true >(type, &in, output.m_file, size);
 	}
 	else
 	{
-		cerr << "unknown mode";
-		return ERROR_NOT_IMPLEMENTED;
+		code = qs< false >(type, &in, output.m_file, size);
 	}
 
-	fclose(in);
-
-	return 0;
+	unmap_file(&input);
+	if (close_output(&output) && !code)
+	{
+		cerr << "cannot write the output file\n";
+		code = ERROR_UNKNOWN;
+	}
+	return code;
 }
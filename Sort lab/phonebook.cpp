@@ -29,6 +29,30 @@ std::istream &operator>>(std::istream &is, phonebook &phonebook)
 	return is;
 }
 
+bool read_value(text_t *text, phonebook &phonebook)
+{
+	std::string *fields[] = { &phonebook.surname, &phonebook.name, &phonebook.patronym };
+	for (std::string *field : fields)
+	{
+		const char *token;
+		size_t length;
+		if (!read_token(text, &token, &length))
+			return false;
+		field->assign(token, length);
+	}
+	return read_int(text, &phonebook.number);
+}
+
+void write_value(FILE *out, const phonebook &phonebook)
+{
+	fprintf(out,
+			"%s %s %s %d\n",
+			phonebook.surname.c_str(),
+			phonebook.name.c_str(),
+			phonebook.patronym.c_str(),
+			phonebook.number);
+}
+
 bool phonebook::operator<(const phonebook &second) const
 {
 	if (surname < second.surname)
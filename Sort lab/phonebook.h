@@ -1,3 +1,5 @@
+#include "../common/file_io.h"
+
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -23,3 +25,7 @@ struct phonebook
 	bool operator<(const phonebook &second) const;
 	bool operator>(const phonebook &second) const;
 };
+
+// the fields operator>> and operator<< read and write, from a mapped text and to an output file
+bool read_value(text_t *text, phonebook &phonebook);
+void write_value(FILE *out, const phonebook &phonebook);
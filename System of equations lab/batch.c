@@ -0,0 +1,148 @@
+#include "batch.h"
+
+#include "lu.h"
+#include "refine.h"
+#include "../common/return_codes.h"
+#include "row_update.h"
+
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined _OPENMP
+#	define PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic) num_threads(threads) if (threads > 1)")
+#else
+#	define PARALLEL_FOR
+#endif
+
+// a where mask is set, b elsewhere, for the lanes_t and lane_mask_t of the kernel
+#define SELECT_LANES(mask, a, b) ((lanes_t)(((mask) & (lane_mask_t)(a)) | (~(mask) & (lane_mask_t)(b))))
+
+#define LANES_WIDTH 4
+#define LANES_NAME(x) x##_generic
+#define LANES_TARGET
+#include "batch_lanes.h"
+#undef LANES_WIDTH
+#undef LANES_NAME
+#undef LANES_TARGET
+
+#if defined __x86_64__ || defined __i386__
+#	define LANES_WIDTH 8
+#	define LANES_NAME(x) x##_avx2
+#	define LANES_TARGET __attribute__((target("avx2,fma")))
+#	include "batch_lanes.h"
+#	undef LANES_WIDTH
+#	undef LANES_NAME
+#	undef LANES_TARGET
+
+#	define LANES_WIDTH 16
+#	define LANES_NAME(x) x##_avx512
+#	define LANES_TARGET __attribute__((target("avx512f")))
+#	include "batch_lanes.h"
+#	undef LANES_WIDTH
+#	undef LANES_NAME
+#	undef LANES_TARGET
+#endif
+
+void solve_batch_lanes(float *A, int size, float *x, int *solutions)
+{
+#if defined __x86_64__ || defined __i386__
+	switch (get_row_kernel())
+	{
+	case RowKernelAvx512:
+		solve_lanes_avx512(A, size, x, solutions);
+		return;
+	case RowKernelAvx2:
+		solve_lanes_avx2(A, size, x, solutions);
+		return;
+	default:
+		break;
+	}
+#endif
+	solve_lanes_generic(A, size, x, solutions);
+}
+
+// count systems of one block, BATCH_TILES * BATCH_LANES at a time
+static int solve_batch_block(text_t *in, int size, int count, float *A, float *x, int *solutions, FILE *out)
+{
+#if defined _OPENMP
+	int threads = get_lu_threads();
+#endif
+	int width = size + 1;
+	int tile_floats = size * width * BATCH_LANES;
+	get_row_kernel();	 // resolved before the threads use it
+	for (int first = 0; first < count; first += BATCH_TILES * BATCH_LANES)
+	{
+		int systems = count - first < BATCH_TILES * BATCH_LANES ? count - first : BATCH_TILES * BATCH_LANES;
+		int tiles = (systems + BATCH_LANES - 1) / BATCH_LANES;
+		for (int s = 0; s < tiles * BATCH_LANES; s++)
+		{
+			float *lane = A + s / BATCH_LANES * tile_floats + s % BATCH_LANES;
+			for (int e = 0; e < size * width; e++)
+			{
+				if (s >= systems)
+					lane[e * BATCH_LANES] = e / width == e % width;	  // lanes past the end solve x = 0
+				else if (!read_float(in, &lane[e * BATCH_LANES]))
+				{
+					printf("invalid batch system %d", first + s);
+					return ERROR_INVALID_DATA;
+				}
+			}
+		}
+
+		PARALLEL_FOR
+		for (int t = 0; t < tiles; t++)
+		{
+			solve_batch_lanes(A + t * tile_floats, size, x + t * size * BATCH_LANES, solutions + t * BATCH_LANES);
+		}
+
+		for (int s = 0; s < systems; s++)
+		{
+			const float *solution = x + s / BATCH_LANES * size * BATCH_LANES + s % BATCH_LANES;
+			if (solutions[s] == SolutionNone)
+				fprintf(out, "no solution\n");
+			else if (solutions[s] == SolutionMany)
+				fprintf(out, "many solutions\n");
+			else
+			{
+				for (int i = 0; i < size; i++)
+				{
+					fprintf(out, i ? " %g" : "%g", solution[i * BATCH_LANES]);
+				}
+				fprintf(out, "\n");
+			}
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+int solve_batch_text(text_t *in, FILE *out)
+{
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * BATCH_TILES * BATCH_MAX_SIZE * (BATCH_MAX_SIZE + 1) * BATCH_LANES);
+	float *x = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * BATCH_TILES * BATCH_MAX_SIZE * BATCH_LANES);
+	int *solutions = malloc(sizeof(int) * BATCH_TILES * BATCH_LANES);
+	int code = ERROR_SUCCESS;
+	if (A == NULL || x == NULL || solutions == NULL)
+	{
+		printf("cannot allocate memory");
+		code = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	while (!code && !is_text_end(in))
+	{
+		int size;
+		int count;
+		if (!read_word(in, "batch") || !read_int(in, &size) || !read_int(in, &count) || size < 1 || size > BATCH_MAX_SIZE || count < 0)
+		{
+			printf("invalid batch header, sizes 1 to %d", BATCH_MAX_SIZE);
+			code = ERROR_INVALID_DATA;
+		}
+		else
+			code = solve_batch_block(in, size, count, A, x, solutions, out);
+	}
+
+	free(A);
+	free(x);
+	free(solutions);
+	return code;
+}
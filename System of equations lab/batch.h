@@ -0,0 +1,23 @@
+#pragma once
+
+#include "matrix_io.h"
+
+#include <stdio.h>
+
+// Many small systems at once: BATCH_LANES systems of the same size are stored structure of arrays,
+// element (i, j) of all of them in one vector, and eliminated together, one system per vector lane
+#define BATCH_LANES 16	   // floats of an AVX-512 vector
+#define BATCH_MAX_SIZE 16
+#define BATCH_TILES 256	   // groups of BATCH_LANES systems read and eliminated at a time
+
+// A size x (size + 1) augmented matrices, element (i, j) of lane l at A[(i * (size + 1) + j) * BATCH_LANES + l],
+// aligned to ROW_ALIGNMENT. Gauss-Jordan elimination with partial pivoting in every lane; entries up to
+// size * FLT_EPSILON * ||A b|| of their system count as 0, the tolerance of solve_refined().
+// x[j * BATCH_LANES + l] is the solution of unique lanes, solutions[l] their solution_t.
+// Uses the vectors of get_row_kernel(), 4, 8 or 16 lanes at a time.
+void solve_batch_lanes(float *A, int size, float *x, int *solutions);
+
+// Blocks "batch size count" followed by count augmented systems (size rows of size + 1 values),
+// one after the other to the end of the text. Every system gets a line of output: its solution,
+// "no solution" or "many solutions".
+int solve_batch_text(text_t *in, FILE *out);
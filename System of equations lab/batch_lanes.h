@@ -0,0 +1,115 @@
+// Body of the batch kernels, included by batch.c once per vector width with
+//   LANES_WIDTH    systems per vector, BATCH_LANES of them are eliminated LANES_WIDTH at a time
+//   LANES_NAME(x)  x with a suffix of this width
+//   LANES_TARGET   target attribute of the functions
+// The vectors are the ones of the target: wider ones would be split by the compiler, their
+// comparisons into scalars.
+
+typedef float LANES_NAME(lanes_t) __attribute__((vector_size(LANES_WIDTH * sizeof(float)), may_alias));
+typedef int32_t LANES_NAME(mask_t) __attribute__((vector_size(LANES_WIDTH * sizeof(int32_t)), may_alias));
+
+// element e of LANES_WIDTH systems
+#define LANES_AT(A, e) (*(LANES_NAME(lanes_t) *)((A) + (e) * BATCH_LANES))
+
+// Column by column every lane takes the largest entry of the rows it has not used as pivots yet and
+// eliminates the column from all other rows. The pivot rows differ between lanes, so the pivot row is
+// put together by a select per row; that is as much work as the elimination itself at these sizes.
+// Rows never used as pivots are the zero rows of the echelon form.
+LANES_TARGET static void LANES_NAME(eliminate)(float *A, int size, float *x, int *solutions)
+{
+	typedef LANES_NAME(lanes_t) lanes_t;
+	typedef LANES_NAME(mask_t) lane_mask_t;
+	int width = size + 1;
+	const lanes_t zero = { 0 };
+	const lane_mask_t none = { 0 };
+	const lane_mask_t magnitude = none + 0x7FFFFFFF;
+	lane_mask_t used[BATCH_MAX_SIZE];
+	lane_mask_t pivots[BATCH_MAX_SIZE];	   // pivot row of each column, -1 if it was skipped
+	lane_mask_t rank = none;
+	lanes_t norm = zero;
+	for (int k = 0; k < size; k++)
+	{
+		used[k] = none;
+		lanes_t sum = zero;
+		for (int l = 0; l < width; l++)
+		{
+			sum += (lanes_t)((lane_mask_t)LANES_AT(A, k * width + l) & magnitude);
+		}
+		norm = SELECT_LANES(sum > norm, sum, norm);
+	}
+	const lanes_t tolerance = norm * (size * FLT_EPSILON);
+
+	for (int j = 0; j < size; j++)
+	{
+		lanes_t best = zero;
+		lane_mask_t best_row = none - 1;
+		for (int k = 0; k < size; k++)
+		{
+			lanes_t a = (lanes_t)((lane_mask_t)LANES_AT(A, k * width + j) & magnitude);
+			lane_mask_t better = ~used[k] & (a > best);
+			best = SELECT_LANES(better, a, best);
+			best_row = (better & k) | (~better & best_row);
+		}
+		lane_mask_t found = best > tolerance;	 // for many solutions and no solutions
+		rank -= found;
+		pivots[j] = (found & best_row) | ~found;
+
+		lanes_t pivot_row[BATCH_MAX_SIZE + 1];
+		for (int l = j; l < width; l++)
+		{
+			pivot_row[l] = zero;
+		}
+		for (int k = 0; k < size; k++)
+		{
+			lane_mask_t is_pivot = found & (best_row == k);
+			for (int l = j; l < width; l++)
+			{
+				pivot_row[l] = SELECT_LANES(is_pivot, LANES_AT(A, k * width + l), pivot_row[l]);
+			}
+			used[k] |= is_pivot;
+		}
+
+		lanes_t inverse = 1 / pivot_row[j];
+		for (int k = 0; k < size; k++)
+		{
+			lanes_t coef = SELECT_LANES(found & (best_row != k), LANES_AT(A, k * width + j) * inverse, zero);
+			for (int l = j; l < width; l++)
+			{
+				LANES_AT(A, k * width + l) -= coef * pivot_row[l];
+			}
+		}
+	}
+
+	lane_mask_t inconsistent = none;
+	for (int k = 0; k < size; k++)
+	{
+		lanes_t b = (lanes_t)((lane_mask_t)LANES_AT(A, k * width + size) & magnitude);
+		inconsistent |= ~used[k] & (b > tolerance);
+	}
+	for (int j = 0; j < size; j++)
+	{
+		lanes_t b = zero;
+		lanes_t d = zero + 1;
+		for (int k = 0; k < size; k++)
+		{
+			lane_mask_t is_pivot = pivots[j] == k;
+			b = SELECT_LANES(is_pivot, LANES_AT(A, k * width + size), b);
+			d = SELECT_LANES(is_pivot, LANES_AT(A, k * width + j), d);
+		}
+		LANES_AT(x, j) = b / d;
+	}
+	for (int l = 0; l < LANES_WIDTH; l++)
+	{
+		solutions[l] = inconsistent[l] ? SolutionNone : rank[l] == size ? SolutionUnique : SolutionMany;
+	}
+}
+
+LANES_TARGET static void LANES_NAME(solve_lanes)(float *A, int size, float *x, int *solutions)
+{
+	for (int group = 0; group < BATCH_LANES; group += LANES_WIDTH)
+	{
+		LANES_NAME(eliminate)(A + group, size, x + group, solutions + group);
+	}
+}
+
+#undef LANES_AT
@@ -0,0 +1,788 @@
+#include "batch.h"
+#include "lu.h"
+#include "matrix_io.h"
+#include "refine.h"
+#include "../common/return_codes.h"
+#include "row_update.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REFERENCE_MAX_SIZE 2048	   // the unblocked scalar loops take minutes beyond that
+
+static double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// random diagonally dominant system, so every strategy finds the same n pivots
+static void make_system(float *A, int size, int stride)
+{
+	unsigned seed = 1;
+	for (int i = 0; i < size; i++)
+	{
+		float sum = 0;
+		for (int l = 0; l < size + 1; l++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			A[i * stride + l] = (float)((seed >> 8) & 0xFFFF) / 0x8000 - 1;
+			sum += A[i * stride + l] < 0 ? -A[i * stride + l] : A[i * stride + l];
+		}
+		A[i * stride + i] = sum;
+	}
+}
+
+// the elimination loop lu_factor replaced: first nonzero pivot, every column of every row
+static int eliminate_unblocked(float *A, int size)
+{
+	int rank = size;
+	int i = 0;
+	int j = 0;
+	while (i < size && j < size)
+	{
+		if (equals(A[i * (size + 1) + j], 0))
+		{
+			for (int k = i + 1; k < size; k++)
+			{
+				if (!equals(A[k * (size + 1) + j], 0))
+				{
+					for (int l = 0; l < size + 1; l++)
+					{
+						float t = A[k * (size + 1) + l];
+						A[k * (size + 1) + l] = A[i * (size + 1) + l];
+						A[i * (size + 1) + l] = t;
+					}
+
+					break;
+				}
+			}
+		}
+		if (!equals(A[i * (size + 1) + j], 0))
+		{
+			for (int k = i + 1; k < size; k++)
+			{
+				float coef = A[k * (size + 1) + j] / A[i * (size + 1) + j];
+				for (int l = 0; l < size + 1; l++)
+				{
+					A[k * (size + 1) + l] = A[k * (size + 1) + l] - A[i * (size + 1) + l] * coef;
+				}
+			}
+			i++;
+			j++;
+		}
+		else
+		{
+			rank--;
+			j++;
+		}
+	}
+	return rank;
+}
+
+// GFLOP/s of one factorization, 2/3 n^3 flops; 0 if the rank came out wrong
+static double time_factor(float *A, const float *source, int *pivots, int size, int stride, int kernel)
+{
+	memcpy(A, source, sizeof(float) * size * stride);
+	double start = now();
+	int rank;
+	if (kernel >= 0)
+	{
+		set_row_kernel((row_kernel_t)kernel);
+		rank = lu_factor(A, size, stride, pivots, pivots + size, LU_TOLERANCE);
+	}
+	else
+	{
+		rank = eliminate_unblocked(A, size);
+	}
+	double elapsed = now() - start;
+	return rank == size ? 2.0 / 3 * size * size * (double)size / elapsed / 1e9 : 0;
+}
+
+// GFLOP/s of lu_factor on 1, 2, 4... threads up to the OpenMP default, with the best kernel
+static int benchmark_threads(int size)
+{
+	int stride = get_row_stride(size);
+	float *source = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	int *pivots = malloc(sizeof(int) * 2 * size);	// and pivot columns
+	if (!source || !A || !pivots)
+	{
+		printf("cannot allocate memory");
+		free(source);
+		free(A);
+		free(pivots);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	make_system(source, size, stride);
+	int max_threads = get_lu_threads();
+	printf("%-8s %10s %10s\n", "threads", "GFLOP/s", "speedup");
+	double single = 0;
+	for (int threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+	{
+		set_lu_threads(threads);
+		double gflops = time_factor(A, source, pivots, size, stride, get_row_kernel());
+		single = single ? single : gflops;
+		printf("%-8d %10.2f %10.2f\n", threads, gflops, gflops / single);
+		if (threads == max_threads)
+			break;
+	}
+	free(source);
+	free(A);
+	free(pivots);
+	return ERROR_SUCCESS;
+}
+
+#define BATCH_SYSTEMS (1 << 16)
+
+// Millions of size x size systems per second: solve_batch_lanes with each kernel against lu_factor and
+// back substitution system by system, with the allocations solve_dense() makes for each
+static int benchmark_batch(int size)
+{
+	int width = size + 1;
+	int stride = get_row_stride(size);
+	int tiles = BATCH_SYSTEMS / BATCH_LANES;
+	float *lanes = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * BATCH_SYSTEMS * size * width);
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * BATCH_SYSTEMS * size * width);
+	float *x = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * BATCH_SYSTEMS * size);
+	int *solutions = malloc(sizeof(int) * BATCH_SYSTEMS);
+	float *system = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	if (!lanes || !A || !x || !solutions || !system)
+	{
+		printf("cannot allocate memory");
+		free(lanes);
+		free(A);
+		free(x);
+		free(solutions);
+		free(system);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (int s = 0; s < BATCH_SYSTEMS; s++)
+	{
+		make_system(system, size, stride);
+		for (int e = 0; e < size * width; e++)
+		{
+			// different systems from the same generator: rotate the rows
+			float value = system[((e / width + s) % size) * stride + e % width];
+			lanes[(s / BATCH_LANES * size * width + e) * BATCH_LANES + s % BATCH_LANES] = value;
+		}
+	}
+
+	printf("%-12s %12s\n", "kernel", "Msystems/s");
+	const char *names[] = { "scalar", "avx2", "avx512" };
+	for (int k = RowKernelScalar; k <= RowKernelAvx512; k++)
+	{
+		if (!has_row_kernel((row_kernel_t)k))
+			continue;
+		set_row_kernel((row_kernel_t)k);
+		memcpy(A, lanes, sizeof(float) * BATCH_SYSTEMS * size * width);
+		double start = now();
+		for (int t = 0; t < tiles; t++)
+		{
+			solve_batch_lanes(A + t * size * width * BATCH_LANES, size, x + t * size * BATCH_LANES, solutions + t * BATCH_LANES);
+		}
+		printf("%-12s %12.2f\n", names[k], BATCH_SYSTEMS / (now() - start) / 1e6);
+	}
+
+	double start = now();
+	for (int s = 0; s < BATCH_SYSTEMS; s++)
+	{
+		for (int e = 0; e < size * width; e++)
+		{
+			system[e / width * stride + e % width] = lanes[(s / BATCH_LANES * size * width + e) * BATCH_LANES + s % BATCH_LANES];
+		}
+		int *pivots = malloc(sizeof(int) * 2 * size);
+		float *res = malloc(sizeof(float) * size);
+		if (lu_factor(system, size, stride, pivots, pivots + size, get_lu_tolerance(system, size, stride, size)) == size)
+		{
+			for (int i = size - 1; i >= 0; i--)
+			{
+				float d = 0;
+				for (int j = i + 1; j < size; j++)
+				{
+					d += system[i * stride + j] * res[j];
+				}
+				res[i] = (system[i * stride + size] - d) / system[i * stride + i];
+			}
+		}
+		free(pivots);
+		free(res);
+	}
+	printf("%-12s %12.2f\n", "lu_factor", BATCH_SYSTEMS / (now() - start) / 1e6);
+
+	free(lanes);
+	free(A);
+	free(x);
+	free(solutions);
+	free(system);
+	return ERROR_SUCCESS;
+}
+
+#define SUITE_MIN_SIZE 16
+#define SUITE_MAX_SIZE 16384
+#define SUITE_TEXT_MAX_SIZE 4096	// larger systems go through the binary format, text would take gigabytes
+
+typedef enum suite_kind_t_tag
+{
+	SuiteRandom,
+	SuiteDominant,
+	SuiteHilbert,
+	SuiteSingular,		 // many solutions
+	SuiteInconsistent,	 // no solution
+} suite_kind_t;
+
+static const char *suite_kinds[] = { "random", "dominant", "hilbert", "singular", "inconsistent" };
+static const char *suite_results[] = { "unique", "none", "many" };	  // solution_t
+
+// The classification each kind of system is built with. Hilbert systems are nonsingular, but rounded to
+// floats they are singular to working precision from 16 on: whatever a solver answers is shown, not
+// checked.
+static const int suite_expected[] = { SolutionUnique, SolutionUnique, -1, SolutionMany, SolutionNone };
+
+// The systems of the suite. Singular and inconsistent ones have small integer entries, so their last
+// row is exactly the sum of the first two (plus 1 in b for inconsistent ones) and the expected
+// classification holds in exact arithmetic; the others are nonsingular.
+static void make_suite_system(float *A, int size, int stride, suite_kind_t kind)
+{
+	if (kind == SuiteDominant)
+	{
+		make_system(A, size, stride);
+		return;
+	}
+	unsigned seed = 1;
+	for (int i = 0; i < size; i++)
+	{
+		float *row = A + (size_t)i * stride;
+		for (int l = 0; l < size + 1; l++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			if (kind == SuiteHilbert)
+				row[l] = l < size ? 1.0f / (i + l + 1) : 0;
+			else if (kind == SuiteRandom)
+				row[l] = (float)((seed >> 8) & 0xFFFF) / 0x8000 - 1;
+			else
+				row[l] = (float)((seed >> 16) % 17) - 8;
+		}
+		if (kind == SuiteHilbert)
+		{
+			for (int l = 0; l < size; l++)
+			{
+				row[size] += row[l];	// x = 1
+			}
+		}
+	}
+	if ((kind == SuiteSingular || kind == SuiteInconsistent) && size > 2)
+	{
+		float *last = A + (size_t)(size - 1) * stride;
+		for (int l = 0; l < size + 1; l++)
+		{
+			last[l] = A[l] + A[stride + l];
+		}
+		last[size] += kind == SuiteInconsistent;
+	}
+}
+
+// The resident set high-water mark in MB since the last call, which resets it; 0 where /proc does not
+// have it
+static double get_peak_memory(void)
+{
+	double peak = 0;
+	FILE *status = fopen("/proc/self/status", "r");
+	if (status)
+	{
+		char line[128];
+		long kb;
+		while (fgets(line, sizeof(line), status))
+		{
+			if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+				peak = kb / 1024.0;
+		}
+		fclose(status);
+	}
+	FILE *clear = fopen("/proc/self/clear_refs", "w");	  // "5" resets VmHWM
+	if (clear)
+	{
+		fputs("5", clear);
+		fclose(clear);
+	}
+	return peak;
+}
+
+// The system written to a temporary file (text, or binary beyond SUITE_TEXT_MAX_SIZE) and loaded back
+// the way main does, load time in *seconds
+static int load_suite_system(const float *source, int size, int stride, mapped_file_t *file, float **A, int *a_stride, double *seconds)
+{
+	char path[] = "/tmp/equations_suite_XXXXXX";
+	int fd = mkstemp(path);
+	FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (out == NULL)
+	{
+		printf("cannot create a temporary file");
+		if (fd >= 0)
+			close(fd);
+		return ERROR_FILE_NOT_FOUND;
+	}
+	int code = ERROR_SUCCESS;
+	if (size > SUITE_TEXT_MAX_SIZE)
+		code = write_binary_matrix(out, source, size, size + 1, stride);
+	else
+	{
+		fprintf(out, "%d\n", size);
+		for (int i = 0; i < size; i++)
+		{
+			for (int l = 0; l < size + 1; l++)
+			{
+				fprintf(out, l ? " %.9g" : "%.9g", source[(size_t)i * stride + l]);
+			}
+			fprintf(out, "\n");
+		}
+	}
+	if (fclose(out) && !code)
+	{
+		printf("cannot write the temporary file");
+		code = ERROR_INVALID_DATA;
+	}
+
+	double start = now();
+	if (!code && map_file(file, path))
+	{
+		printf("cannot read the temporary file");
+		code = ERROR_FILE_NOT_FOUND;
+	}
+	unlink(path);	 // the mapping keeps it
+	if (code)
+		return code;
+	int extra = 1;
+	int loaded;
+	code = load_dense_matrix(file, &extra, A, &loaded, a_stride, get_lu_threads());
+	*seconds = now() - start;
+	if (code)
+		unmap_file(file);
+	return code;
+}
+
+// ||b - A x|| / (||A|| ||x|| + ||b||) in the infinity norm, in double like solve_refined() reports it
+static double get_suite_residual(const float *A, int size, int stride, const float *x)
+{
+	double a_norm = 0;
+	double b_norm = 0;
+	double x_norm = 0;
+	double r_norm = 0;
+	for (int i = 0; i < size; i++)
+	{
+		const float *row = A + (size_t)i * stride;
+		double sum = row[size];
+		double a = 0;
+		for (int j = 0; j < size; j++)
+		{
+			sum -= (double)row[j] * x[(size_t)j * ROW_FLOATS];
+			a += fabs(row[j]);
+		}
+		a_norm = a > a_norm ? a : a_norm;
+		b_norm = fabs(row[size]) > b_norm ? fabs(row[size]) : b_norm;
+		x_norm = fabs(x[(size_t)i * ROW_FLOATS]) > x_norm ? fabs(x[(size_t)i * ROW_FLOATS]) : x_norm;
+		r_norm = fabs(sum) > r_norm ? fabs(sum) : r_norm;
+	}
+	double scale = a_norm * x_norm + b_norm;
+	return scale > 0 ? r_norm / scale : 0;
+}
+
+// The classification of solve_dense(): lu_factor of the augmented matrix in A with the tolerance of
+// its size columns, no solution where a zero row keeps a right-hand side above that of all columns
+static solution_t classify_float(float *A, int size, int stride, int *pivots)
+{
+	float tolerance = get_lu_tolerance(A, size, stride, size);
+	float extended_tolerance = get_lu_tolerance(A, size, stride, size + 1);
+	int rank = lu_factor(A, size, stride, pivots, pivots + size, tolerance);
+	solution_t solution = rank == size ? SolutionUnique : SolutionMany;
+	for (int i = rank; i < size; i++)
+	{
+		if (fabsf(A[(size_t)i * stride + size]) > extended_tolerance)
+			solution = SolutionNone;
+	}
+	return solution;
+}
+
+// One system of the suite through the float path of main: load, lu_factor, the classification of
+// solve_dense(), lu_backward for unique solutions, then mixed precision. Returns 1 where either
+// classification differs from the one the system was built with, 0 where it does not, -1 on errors.
+static int run_suite_system(suite_kind_t kind, int size)
+{
+	int stride = get_row_stride(size);
+	float *source = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	float *x = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * ROW_FLOATS);	// one column of right-hand sides
+	int *pivots = malloc(sizeof(int) * 2 * size);	// and pivot columns
+	double *refined = malloc(sizeof(double) * size);
+	if (!source || !A || !x || !pivots || !refined)
+	{
+		printf("cannot allocate memory");
+		free(source);
+		free(A);
+		free(x);
+		free(pivots);
+		free(refined);
+		return -1;
+	}
+	make_suite_system(source, size, stride, kind);
+	get_peak_memory();
+
+	mapped_file_t file;
+	float *loaded;
+	int loaded_stride;
+	double load = 0;
+	int code = load_suite_system(source, size, stride, &file, &loaded, &loaded_stride, &load);
+	if (!code)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			memcpy(A + (size_t)i * stride, loaded + (size_t)i * loaded_stride, sizeof(float) * (size + 1));
+		}
+		free_dense_matrix(&file, loaded);
+		unmap_file(&file);
+	}
+
+	int solution = -1;
+	double gflops = 0;	  // 0 for rank deficient factorizations, which skip the work of their zero columns
+	double substitution = 0;
+	double residual = 0;
+	if (!code)
+	{
+		double start = now();
+		solution = classify_float(A, size, stride, pivots);
+		if (solution == SolutionUnique)
+		{
+			gflops = 2.0 / 3 * size * size * (double)size / (now() - start) / 1e9;
+			for (int i = 0; i < size; i++)
+			{
+				x[(size_t)i * ROW_FLOATS] = A[(size_t)i * stride + size];
+			}
+			start = now();
+			lu_backward(A, size, stride, x, 1, ROW_FLOATS);
+			substitution = now() - start;
+			residual = get_suite_residual(source, size, stride, x);
+		}
+	}
+
+	double peak = get_peak_memory();
+	refinement_t mixed;
+	if (solution >= 0 && solve_refined(source, size, stride, PrecisionMixed, refined, &mixed))
+		solution = -1;
+	int changed = -1;
+	if (solution >= 0)
+	{
+		int expected = suite_expected[kind];
+		changed = expected >= 0 && (solution != expected || (int)mixed.m_solution != expected);
+		printf("%-13s %6d %6s %9.3f", suite_kinds[kind], size, size > SUITE_TEXT_MAX_SIZE ? "binary" : "text", load);
+		if (gflops > 0)
+			printf(" %9.2f", gflops);
+		else
+			printf(" %9s", "-");
+		printf(" %10.3f", substitution * 1e3);
+		if (solution == SolutionUnique)
+			printf(" %10.2e", residual);
+		else
+			printf(" %10s", "-");
+		printf(" %9.1f %-7s %s%s\n", peak, suite_results[solution], suite_results[mixed.m_solution], expected < 0 ? " ill-conditioned" : changed ? " CHANGED" : "");
+		fflush(stdout);
+	}
+	free(source);
+	free(A);
+	free(x);
+	free(pivots);
+	free(refined);
+	return changed;
+}
+
+// Every kind of system at sizes SUITE_MIN_SIZE, 4 times that... up to max_size: load time, lu_factor
+// GFLOP/s (- where the matrix was rank deficient), lu_backward time, relative residual, peak memory, and
+// the classifications of the float path and of mixed precision. A classification other than the one the
+// system was built with is CHANGED and fails the run; Hilbert systems are marked ill-conditioned instead.
+static int benchmark_suite(int max_size)
+{
+	printf("%-13s %6s %6s %9s %9s %10s %10s %9s %-7s %s\n", "system", "n", "input", "load s", "GFLOP/s", "subst ms", "residual", "peak MB", "float", "mixed");
+	int changed = 0;
+	for (int kind = SuiteRandom; kind <= SuiteInconsistent; kind++)
+	{
+		for (int size = SUITE_MIN_SIZE; size <= max_size; size *= 4)
+		{
+			int code = run_suite_system((suite_kind_t)kind, size);
+			if (code < 0)
+				return ERROR_UNKNOWN;
+			changed += code;
+		}
+	}
+	if (changed)
+		printf("%d systems CHANGED\n", changed);
+	return changed ? ERROR_UNKNOWN : ERROR_SUCCESS;
+}
+
+#define REFINE_MAX_RESIDUAL 1e-12
+
+// The random system of the suite, well-conditioned, through the float path, mixed precision and double:
+// time, classification and residual of each. Every one must find the unique solution, mixed precision
+// and double to REFINE_MAX_RESIDUAL, else the run fails.
+static int benchmark_refine(int size)
+{
+	int stride = get_row_stride(size);
+	float *source = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+	int *pivots = malloc(sizeof(int) * 2 * size);	// and pivot columns
+	double *x = malloc(sizeof(double) * size);
+	if (!source || !A || !pivots || !x)
+	{
+		printf("cannot allocate memory");
+		free(source);
+		free(A);
+		free(pivots);
+		free(x);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	make_suite_system(source, size, stride, SuiteRandom);
+	memcpy(A, source, sizeof(float) * size * stride);
+
+	int code = ERROR_SUCCESS;
+	printf("%-7s %9s %-7s %10s\n", "solver", "s", "result", "residual");
+	double start = now();
+	solution_t solution = classify_float(A, size, stride, pivots);
+	printf("%-7s %9.3f %-7s %10s\n", "float", now() - start, suite_results[solution], "-");
+	if (solution != SolutionUnique)
+		code = ERROR_UNKNOWN;
+
+	const char *names[] = { "float", "mixed", "double" };
+	for (int precision = PrecisionMixed; precision <= PrecisionDouble && code != ERROR_NOT_ENOUGH_MEMORY; precision++)
+	{
+		refinement_t result;
+		start = now();
+		if (solve_refined(source, size, stride, (precision_t)precision, x, &result))
+		{
+			code = ERROR_NOT_ENOUGH_MEMORY;
+			break;
+		}
+		printf("%-7s %9.3f %-7s", names[precision], now() - start, suite_results[result.m_solution]);
+		if (result.m_solution == SolutionUnique)
+			printf(" %10.2e\n", result.m_residual);
+		else
+			printf(" %10s\n", "-");
+		if (result.m_solution != SolutionUnique || result.m_residual > REFINE_MAX_RESIDUAL)
+			code = ERROR_UNKNOWN;
+	}
+	free(source);
+	free(A);
+	free(pivots);
+	free(x);
+	return code;
+}
+
+#define CLASSIFY_SEEDS 8
+
+static const int classify_sizes[] = { 4, 5, 6, 8, 10, 12, 16, 20, 24, 32, 40, 48, 64, 80, 96, 112, 128 };
+
+static int next_entry(unsigned *seed, int range)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return (int)((*seed >> 16) % (2 * range + 1)) - range;
+}
+
+// A size x size system of integers from -9 to 9 with an exact classification: its last dependent rows
+// are integer combinations of 3 of the others (a right-hand side off by 1 or 2 in one of them for no
+// solution), unique systems are nonsingular in exact arithmetic for these seeds
+static void make_classify_system(float *A, int size, int stride, solution_t solution, int dependent, unsigned seed)
+{
+	for (int i = 0; i < size; i++)
+	{
+		for (int l = 0; l < size + 1; l++)
+		{
+			A[(size_t)i * stride + l] = (float)next_entry(&seed, 9);
+		}
+	}
+	for (int d = 0; d < dependent && solution != SolutionUnique; d++)
+	{
+		float *row = A + (size_t)(size - 1 - d) * stride;
+		memset(row, 0, sizeof(float) * (size + 1));
+		for (int s = 0; s < 3; s++)
+		{
+			int source = (int)((unsigned)(next_entry(&seed, 9) + 9) * (size - dependent) / 19);
+			int coefficient = next_entry(&seed, 3);
+			coefficient = coefficient ? coefficient : 1;
+			for (int l = 0; l < size + 1; l++)
+			{
+				row[l] += coefficient * A[(size_t)source * stride + l];
+			}
+		}
+	}
+	if (solution == SolutionNone)
+	{
+		int offset = next_entry(&seed, 2);
+		A[(size_t)(size - 1) * stride + size] += offset ? offset : 1;
+	}
+}
+
+// The float classification of generated integer systems whose answer is exact: unique, no solution
+// and many solutions with one or size / 4 dependent rows, from 4 to 128 unknowns, with every row kernel.
+// Rounding must not make the dependent rows look independent nor the others dependent; the wrong ones
+// are listed and fail the run.
+static int benchmark_classify(void)
+{
+	const char *names[] = { "scalar", "avx2", "avx512" };
+	const int max_size = 128;
+	int stride = get_row_stride(max_size);
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * max_size * stride);
+	int *pivots = malloc(sizeof(int) * 2 * max_size);	// and pivot columns
+	if (!A || !pivots)
+	{
+		printf("cannot allocate memory");
+		free(A);
+		free(pivots);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	int wrong = 0;
+	int systems = 0;
+	for (int k = RowKernelScalar; k <= RowKernelAvx512; k++)
+	{
+		if (!has_row_kernel((row_kernel_t)k))
+			continue;
+		set_row_kernel((row_kernel_t)k);
+		for (size_t n = 0; n < sizeof(classify_sizes) / sizeof(classify_sizes[0]); n++)
+		{
+			int size = classify_sizes[n];
+			stride = get_row_stride(size);
+			for (unsigned seed = 1; seed <= CLASSIFY_SEEDS; seed++)
+			{
+				for (int kind = 0; kind < 4; kind++)
+				{
+					solution_t expected = kind == 0 ? SolutionUnique : kind == 1 ? SolutionNone : SolutionMany;
+					int dependent = kind == 3 && size >= 8 ? size / 4 : 1;
+					make_classify_system(A, size, stride, expected, dependent, seed * 4 + kind);
+					solution_t solution = classify_float(A, size, stride, pivots);
+					systems++;
+					if (solution != expected)
+					{
+						wrong++;
+						printf("%-7s n %3d seed %2u dependent %2d: %s instead of %s\n", names[k], size, seed, expected == SolutionUnique ? 0 : dependent, suite_results[solution], suite_results[expected]);
+					}
+				}
+			}
+		}
+	}
+	printf("%d of %d systems classified wrong\n", wrong, systems);
+	free(A);
+	free(pivots);
+	return wrong ? ERROR_UNKNOWN : ERROR_SUCCESS;
+}
+
+// benchmark [max size]: GFLOP/s of the unblocked loop and of lu_factor with each row update kernel
+// benchmark threads [size]: scaling of lu_factor over threads
+// benchmark batch [size]: small systems per second, SIMD across systems against one by one
+// benchmark suite [max size]: the float solver on generated well and ill-conditioned, singular and
+// inconsistent systems from 16 to max size (4096, at most 16384), fails on a CHANGED classification
+// benchmark refine [size]: the well-conditioned random system of the suite (4096) with every precision,
+// fails unless each finds the unique solution
+// benchmark classify: the float classification of exactly singular, inconsistent and nonsingular
+// integer systems with every kernel, fails on a wrong one
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "classify"))
+		return benchmark_classify();
+	if (argc > 1 && !strcmp(argv[1], "refine"))
+	{
+		int size = argc > 2 ? atoi(argv[2]) : 4096;
+		if (size < 1 || size > SUITE_MAX_SIZE)
+		{
+			printf("Wrong size");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_refine(size);
+	}
+	if (argc > 1 && !strcmp(argv[1], "suite"))
+	{
+		int max_size = argc > 2 ? atoi(argv[2]) : 4096;
+		if (max_size < SUITE_MIN_SIZE || max_size > SUITE_MAX_SIZE)
+		{
+			printf("Wrong size");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_suite(max_size);
+	}
+	if (argc > 1 && !strcmp(argv[1], "batch"))
+	{
+		int size = argc > 2 ? atoi(argv[2]) : 8;
+		if (size < 1 || size > BATCH_MAX_SIZE)
+		{
+			printf("Wrong size");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_batch(size);
+	}
+	if (argc > 1 && !strcmp(argv[1], "threads"))
+	{
+		int size = argc > 2 ? atoi(argv[2]) : 4096;
+		if (size < 1)
+		{
+			printf("Wrong size");
+			return ERROR_INVALID_PARAMETER;
+		}
+		return benchmark_threads(size);
+	}
+	int max_size = argc > 1 ? atoi(argv[1]) : 8192;
+	if (max_size < 256)
+	{
+		printf("Wrong size");
+		return ERROR_INVALID_PARAMETER;
+	}
+	const char *names[] = { "unblocked", "scalar", "avx2", "avx512" };
+	int kernels[] = { -1, RowKernelScalar, RowKernelAvx2, RowKernelAvx512 };
+
+	printf("%-6s", "n");
+	for (int k = 0; k < 4; k++)
+	{
+		printf(" %10s", names[k]);
+	}
+	printf("   GFLOP/s\n");
+	for (int size = 256; size <= max_size; size *= 2)
+	{
+		int stride = get_row_stride(size);
+		// the unblocked loop works on unpadded rows, which fit in the same buffers
+		float *source = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+		float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * size * stride);
+		float *unpadded = malloc(sizeof(float) * size * (size + 1));
+		int *pivots = malloc(sizeof(int) * 2 * size);	// and pivot columns
+		if (!source || !A || !unpadded || !pivots)
+		{
+			printf("cannot allocate memory");
+			free(source);
+			free(A);
+			free(unpadded);
+			free(pivots);
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		make_system(source, size, stride);
+		for (int i = 0; i < size; i++)
+		{
+			memcpy(unpadded + i * (size + 1), source + i * stride, sizeof(float) * (size + 1));
+		}
+
+		printf("%-6d", size);
+		for (int k = 0; k < 4; k++)
+		{
+			if ((kernels[k] >= 0 && !has_row_kernel((row_kernel_t)kernels[k])) || (k < 2 && size > REFERENCE_MAX_SIZE))
+				printf(" %10s", "-");
+			else if (kernels[k] >= 0)
+				printf(" %10.2f", time_factor(A, source, pivots, size, stride, kernels[k]));
+			else
+				printf(" %10.2f", time_factor(A, unpadded, pivots, size, size + 1, kernels[k]));
+			fflush(stdout);
+		}
+		printf("\n");
+		free(source);
+		free(A);
+		free(unpadded);
+		free(pivots);
+	}
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,219 @@
+#include "lu.h"
+#include "row_update.h"
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+
+#if defined _OPENMP
+#	include <omp.h>
+#	define PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic) num_threads(threads) if (threads > 1)")
+#else
+#	define PARALLEL_FOR
+#endif
+
+static int thread_count;
+
+void set_lu_threads(int threads)
+{
+	thread_count = threads > 0 ? threads : 0;
+}
+
+int get_lu_threads(void)
+{
+#if defined _OPENMP
+	return thread_count ? thread_count : omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+int equals(float num, float zero)
+{
+	return fabsf(num - zero) <= 1e-5f ? 1 : 0;
+}
+
+float get_lu_tolerance(const float *A, int size, int stride, int columns)
+{
+	float largest = 0;
+	for (int i = 0; i < size; i++)
+	{
+		for (int l = 0; l < columns; l++)
+		{
+			largest = fmaxf(largest, fabsf(A[(size_t)i * stride + l]));
+		}
+	}
+	return 8 * size * FLT_EPSILON * largest;
+}
+
+static void swap_rows(float *A, int stride, int a, int b, int count)
+{
+	for (int l = 0; l < count; l++)
+	{
+		float t = A[a * stride + l];
+		A[a * stride + l] = A[b * stride + l];
+		A[b * stride + l] = t;
+	}
+}
+
+// Unblocked elimination of the panel columns [*j, end) from row *i down; only the panel columns
+// are updated. Returns the number of pivots found, their columns go to panel_columns too.
+static int factor_panel(float *A, int size, int stride, int *i, int *j, int end, int *pivots, int *columns, int *panel_columns, float tolerance, int *rank)
+{
+	int count = 0;
+	for (; *j < end && *i < size; (*j)++)
+	{
+		int p = *i;
+		for (int k = *i + 1; k < size; k++)
+		{
+			if (fabsf(A[k * stride + *j]) > fabsf(A[p * stride + *j]))
+				p = k;
+		}
+		if (fabsf(A[p * stride + *j]) <= tolerance)	// for many solutions and no solutions
+		{
+			(*rank)--;
+			continue;
+		}
+		if (p != *i)
+			swap_rows(A, stride, *i, p, size + 1);
+		pivots[*i] = p;
+		columns[*i] = *j;
+
+		float *pivot_row = A + *i * stride;
+		for (int k = *i + 1; k < size; k++)
+		{
+			float *row = A + k * stride;
+			float coef = row[*j] / pivot_row[*j];
+			row[*j] = coef;
+			row_update(row + *j + 1, pivot_row + *j + 1, coef, end - *j - 1);
+		}
+		panel_columns[count++] = *j;
+		(*i)++;
+	}
+	return count;
+}
+
+int lu_factor(float *A, int size, int stride, int *pivots, int *columns, float tolerance)
+{
+	int rank = size;
+	int panel_columns[LU_BLOCK];
+#if defined _OPENMP
+	int threads = get_lu_threads();
+#endif
+	get_row_kernel();	 // resolved before the threads use it
+	int i = 0;
+	int j = 0;
+	while (i < size && j < size)
+	{
+		int first = i;
+		int end = j + LU_BLOCK < size ? j + LU_BLOCK : size;
+		int count = factor_panel(A, size, stride, &i, &j, end, pivots, columns, panel_columns, tolerance, &rank);
+		if (!count)
+			continue;
+
+		// Every row and column tile below is updated on its own, so tasks of LU_ROWS rows by one tile are
+		// spread over the threads. Each element sees the same operations in the same order whatever the
+		// thread count, the result does not depend on it.
+		int tiles = (size + 1 - end + LU_TILE - 1) / LU_TILE;
+		int blocks = (size - i + LU_ROWS - 1) / LU_ROWS;
+
+		// pivot rows right of the panel: forward substitution with the unit lower triangle of the panel
+		PARALLEL_FOR
+		for (int tile = 0; tile < tiles; tile++)
+		{
+			int c = end + tile * LU_TILE;
+			int width = size + 1 - c < LU_TILE ? size + 1 - c : LU_TILE;
+			for (int s = 1; s < count; s++)
+			{
+				float *row = A + (first + s) * stride;
+				for (int t = 0; t < s; t++)
+				{
+					row_update(row + c, A + (first + t) * stride + c, row[panel_columns[t]], width);
+				}
+			}
+		}
+
+		// trailing matrix minus multipliers times pivot rows
+		PARALLEL_FOR
+		for (int task = 0; task < blocks * tiles; task++)
+		{
+			int c = end + task % tiles * LU_TILE;
+			int width = size + 1 - c < LU_TILE ? size + 1 - c : LU_TILE;
+			int last = i + (task / tiles + 1) * LU_ROWS < size ? i + (task / tiles + 1) * LU_ROWS : size;
+			for (int k = i + task / tiles * LU_ROWS; k < last; k++)
+			{
+				float *row = A + k * stride;
+				float coefs[LU_BLOCK];
+				for (int t = 0; t < count; t++)
+				{
+					coefs[t] = row[panel_columns[t]];
+				}
+				rows_update(row + c, A + first * stride + c, stride, coefs, count, width);
+			}
+		}
+	}
+	return rank;
+}
+
+void lu_forward(const float *A, int size, int stride, const int *pivots, const int *columns, int rank, float *B, int count, int b_stride)
+{
+#if defined _OPENMP
+	int threads = get_lu_threads();
+#endif
+	get_row_kernel();
+	int tiles = (count + LU_RHS - 1) / LU_RHS;
+
+	// the right-hand sides are independent, every task substitutes LU_RHS of them through all rows
+	PARALLEL_FOR
+	for (int tile = 0; tile < tiles; tile++)
+	{
+		int c = tile * LU_RHS;
+		int width = count - c < LU_RHS ? count - c : LU_RHS;
+		for (int i = 0; i < rank; i++)
+		{
+			if (pivots[i] != i)
+				swap_rows(B + c, b_stride, i, pivots[i], width);
+		}
+		// row k minus its multipliers times the rows above, LU_BLOCK of them per rows_update
+		for (int k = 1; k < size; k++)
+		{
+			const float *row = A + k * stride;
+			int above = k < rank ? k : rank;
+			for (int t = 0; t < above; t += LU_BLOCK)
+			{
+				float coefs[LU_BLOCK];
+				int rows = above - t < LU_BLOCK ? above - t : LU_BLOCK;
+				for (int s = 0; s < rows; s++)
+				{
+					coefs[s] = row[columns[t + s]];
+				}
+				rows_update(B + k * b_stride + c, B + t * b_stride + c, b_stride, coefs, rows, width);
+			}
+		}
+	}
+}
+
+void lu_backward(const float *A, int size, int stride, float *B, int count, int b_stride)
+{
+#if defined _OPENMP
+	int threads = get_lu_threads();
+#endif
+	get_row_kernel();
+	int tiles = (count + LU_RHS - 1) / LU_RHS;
+
+	PARALLEL_FOR
+	for (int tile = 0; tile < tiles; tile++)
+	{
+		int c = tile * LU_RHS;
+		int width = count - c < LU_RHS ? count - c : LU_RHS;
+		for (int i = size - 1; i >= 0; i--)
+		{
+			float *row = B + i * b_stride + c;
+			rows_update(row, row + b_stride, b_stride, A + i * stride + i + 1, size - i - 1, width);
+			for (int l = 0; l < width; l++)
+			{
+				row[l] /= A[i * stride + i];
+			}
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// Panel width of the blocked factorization and column tile of its trailing update: a tile of
+// LU_BLOCK pivot rows (32 KB) stays in L1 while every row below is updated with it
+#define LU_BLOCK 32
+#define LU_TILE 256
+#define LU_ROWS 64	  // rows of one trailing update task
+#define LU_RHS 64	  // right-hand sides of one substitution task
+
+// Threads of lu_factor when built with OpenMP: 0 (the default) lets OpenMP decide
+void set_lu_threads(int threads);
+int get_lu_threads(void);
+
+int equals(float num, float zero);
+#define LU_TOLERANCE 1e-5f	  // the one of equals(), the absolute tolerance of the original elimination
+
+// Entries up to this magnitude count as 0 after the float elimination of the size x columns matrix A:
+// 8 * size * FLT_EPSILON times its largest entry. What rounding leaves of an exactly dependent row stays
+// below size * FLT_EPSILON times it with every row kernel, the pivots of a nonsingular matrix far above.
+float get_lu_tolerance(const float *A, int size, int stride, int columns);
+
+// Row echelon form of the augmented size x (size + 1) matrix A, rows are stride floats apart
+// (get_row_stride() keeps trailing updates on aligned vectors).
+// Blocked right-looking LU with partial pivoting: the largest entry of a column is its pivot, a
+// column without one (all entries up to tolerance in magnitude) is skipped like in unblocked elimination. Multipliers
+// are left below the pivots, row i was swapped with row pivots[i] at step i and has its pivot in
+// column columns[i]. Returns the rank of the coefficient part; its pivots are on the first rank rows.
+int lu_factor(float *A, int size, int stride, int *pivots, int *columns, float tolerance);
+
+// Substitutions with a factored A for count right-hand sides at once: B holds them as columns, its
+// rows are b_stride floats apart (a multiple of ROW_FLOATS, B aligned to ROW_ALIGNMENT).
+// lu_forward applies the row swaps and the unit lower triangle; then rows rank.. of B are 0 (up to
+// get_lu_tolerance()) for the right-hand sides with solutions. lu_backward needs rank == size and leaves the solutions in B.
+void lu_forward(const float *A, int size, int stride, const int *pivots, const int *columns, int rank, float *B, int count, int b_stride);
+void lu_backward(const float *A, int size, int stride, float *B, int count, int b_stride);
@@ -0,0 +1,145 @@
+#include "lu_cache.h"
+
+#include "../common/file_io.h"
+#include "../common/return_codes.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char magic[4] = { 'L', 'U', 'C', '3' };
+
+#define CACHE_HEADER 28	   // magic, size and rank, hash of the matrix, checksum of the rest
+#define FNV_BASIS 14695981039346656037ull
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	for (size_t l = 0; l < length; l++)
+	{
+		hash = (hash ^ bytes[l]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t hash_matrix(const float *A, int size, int stride)
+{
+	uint64_t hash = FNV_BASIS;
+	for (int i = 0; i < size; i++)
+	{
+		hash = fnv1a(hash, A + i * stride, sizeof(float) * size);
+	}
+	return hash;
+}
+
+// The whole file is checked in its mapping before anything is copied out of it, so a damaged cache
+// leaves A, pivots and columns as they were
+int load_lu_cache(const char *path, float *A, int size, int stride, uint64_t hash, int *pivots, int *columns, int *rank)
+{
+	mapped_file_t file;
+	if (map_file(&file, path))
+		return ERROR_NOT_FOUND;
+
+	const char *data = file.m_data;
+	int32_t dimensions[2];
+	uint64_t source;
+	uint64_t checksum;
+	int code = ERROR_SUCCESS;
+	if (file.m_length < CACHE_HEADER || memcmp(data, magic, 4))
+		code = ERROR_INVALID_DATA;
+	else
+	{
+		memcpy(dimensions, data + 4, sizeof(dimensions));
+		memcpy(&source, data + 12, sizeof(source));
+		memcpy(&checksum, data + 20, sizeof(checksum));
+	}
+	if (!code && (dimensions[0] != size || source != hash))
+		code = ERROR_NOT_FOUND;
+
+	const char *body = data + CACHE_HEADER;
+	size_t body_length = 0;
+	if (!code)
+	{
+		body_length = sizeof(int32_t) * 2 * (size_t)(dimensions[1] > 0 ? dimensions[1] : 0) + sizeof(float) * (size_t)size * size;
+		if (dimensions[1] < 0 || dimensions[1] > size || file.m_length != CACHE_HEADER + body_length ||
+			fnv1a(FNV_BASIS, body, body_length) != checksum)
+			code = ERROR_INVALID_DATA;
+	}
+
+	int count = code ? 0 : dimensions[1];
+	for (int i = 0; i < count && !code; i++)
+	{
+		int32_t pivot;
+		int32_t column;
+		memcpy(&pivot, body + sizeof(int32_t) * i, sizeof(pivot));
+		memcpy(&column, body + sizeof(int32_t) * (count + i), sizeof(column));
+		if (pivot < i || pivot >= size || column < 0 || column >= size)
+			code = ERROR_INVALID_DATA;
+	}
+
+	if (!code)
+	{
+		*rank = count;
+		for (int i = 0; i < count; i++)
+		{
+			int32_t value;
+			memcpy(&value, body + sizeof(int32_t) * i, sizeof(value));
+			pivots[i] = value;
+			memcpy(&value, body + sizeof(int32_t) * (count + i), sizeof(value));
+			columns[i] = value;
+		}
+		const char *rows = body + sizeof(int32_t) * 2 * count;
+		for (int i = 0; i < size; i++)
+		{
+			memcpy(A + i * stride, rows + sizeof(float) * (size_t)i * size, sizeof(float) * size);
+		}
+	}
+	unmap_file(&file);
+	return code;
+}
+
+int save_lu_cache(const char *path, const float *A, int size, int stride, uint64_t hash, const int *pivots, const int *columns, int rank)
+{
+	uint64_t checksum = FNV_BASIS;
+	for (int i = 0; i < rank; i++)
+	{
+		int32_t value = pivots[i];
+		checksum = fnv1a(checksum, &value, sizeof(value));
+	}
+	for (int i = 0; i < rank; i++)
+	{
+		int32_t value = columns[i];
+		checksum = fnv1a(checksum, &value, sizeof(value));
+	}
+	for (int i = 0; i < size; i++)
+	{
+		checksum = fnv1a(checksum, A + i * stride, sizeof(float) * size);
+	}
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL)
+		return ERROR_FILE_NOT_FOUND;
+
+	int32_t dimensions[2] = { size, rank };
+	int ok = fwrite(magic, 1, 4, out) == 4 && fwrite(dimensions, sizeof(int32_t), 2, out) == 2 && fwrite(&hash, sizeof(hash), 1, out) == 1 &&
+			 fwrite(&checksum, sizeof(checksum), 1, out) == 1;
+	for (int i = 0; i < rank && ok; i++)
+	{
+		int32_t value = pivots[i];
+		ok = fwrite(&value, sizeof(value), 1, out) == 1;
+	}
+	for (int i = 0; i < rank && ok; i++)
+	{
+		int32_t value = columns[i];
+		ok = fwrite(&value, sizeof(value), 1, out) == 1;
+	}
+	for (int i = 0; i < size && ok; i++)
+	{
+		ok = fwrite(A + i * stride, sizeof(float), size, out) == (size_t)size;
+	}
+	if (fclose(out) || !ok)
+	{
+		remove(path);
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
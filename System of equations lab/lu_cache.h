@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Factorization of one coefficient matrix kept on disk between runs. The file is "LUC3", then int32
+// size and rank, the uint64 hash_matrix() of the matrix it was made from, the uint64 FNV-1a checksum
+// of the rest of the file, rank pivots and rank pivot columns (int32), and the size x size factored
+// matrix; native byte order, for this machine only.
+
+// FNV-1a of the size x size coefficients
+uint64_t hash_matrix(const float *A, int size, int stride);
+
+// ERROR_SUCCESS if path holds the factorization of a matrix of this size and hash, ERROR_NOT_FOUND
+// if it does not exist or is for another matrix, ERROR_INVALID_DATA if it is damaged (wrong length,
+// checksum or pivots). A, pivots, columns and rank change only on success.
+int load_lu_cache(const char *path, float *A, int size, int stride, uint64_t hash, int *pivots, int *columns, int *rank);
+int save_lu_cache(const char *path, const float *A, int size, int stride, uint64_t hash, const int *pivots, const int *columns, int rank);
@@ -1,106 +1,143 @@
-#include "return_codes.h"
+#include "batch.h"
+#include "lu.h"
+#include "lu_cache.h"
+#include "matrix_io.h"
+#include "refine.h"
+#include "../common/return_codes.h"
+#include "row_update.h"
+#include "sparse.h"
 
 #include <malloc.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int equals(float num, float zero)
+// main input output [--threads=N] [--precision=float|mixed|double] [--rhs=file [--factor=file]] [--to-binary]
+// The input is a dense augmented matrix ("size" then size rows of size + 1 values, or the binary format
+// of matrix_io.h), a sparse system ("sparse size count", see read_sparse_system) or blocks of small
+// systems ("batch size count", see solve_batch_text), solved in float only.
+// With --rhs the input is the coefficient matrix alone ("size" then size rows of size values), factored
+// once for all the right-hand sides of the rhs file ("count" then count vectors of size values). Every
+// one of them gets a line of output: its solution, "no solution" or "many solutions".
+// --factor keeps the factorization in a file and reuses it while the matrix stays the same.
+// --to-binary writes the dense input matrix to output in the binary format instead of solving it.
+// --precision=mixed refines the float solution in double, double solves in double (see refine.h); both
+// write solutions with 15 digits and report the refinement.
+typedef struct options_t_tag
 {
-	return fabsf(num - zero) <= 1e-5f ? 1 : 0;
-}
+	precision_t m_precision;
+	const char *m_rhs_path;
+	const char *m_factor_path;
+	int m_to_binary;
+} options_t;
 
-int main(int argc, char **argv)
+static int parse_options(int argc, char **argv, options_t *options)
 {
-	if (argc != 3)
+	memset(options, 0, sizeof(*options));
+	for (int i = 0; i < argc; i++)
 	{
-		printf("Wrong number of arguments");
-		return ERROR_INVALID_DATA;
+		char end;
+		int threads;
+		if (!strncmp(argv[i], "--threads=", 10) && sscanf(argv[i] + 10, "%d%c", &threads, &end) == 1 && threads > 0)
+			set_lu_threads(threads);
+		else if (!strncmp(argv[i], "--rhs=", 6) && argv[i][6])
+			options->m_rhs_path = argv[i] + 6;
+		else if (!strncmp(argv[i], "--factor=", 9) && argv[i][9])
+			options->m_factor_path = argv[i] + 9;
+		else if (!strcmp(argv[i], "--precision=float"))
+			options->m_precision = PrecisionFloat;
+		else if (!strcmp(argv[i], "--precision=mixed"))
+			options->m_precision = PrecisionMixed;
+		else if (!strcmp(argv[i], "--precision=double"))
+			options->m_precision = PrecisionDouble;
+		else if (!strcmp(argv[i], "--to-binary"))
+			options->m_to_binary = 1;
+		else
+		{
+			printf("Unknown option %s", argv[i]);
+			return ERROR_INVALID_PARAMETER;
+		}
 	}
-
-	int size = 0;
-	int rank;
-	int extended_rank;
-
-	FILE *in = fopen(argv[1], "r");
-
-	if (in == NULL)
+	if (options->m_factor_path && !options->m_rhs_path)
 	{
-		printf("cannot open an input file");
-		return ERROR_FILE_NOT_FOUND;
+		printf("--factor needs --rhs");
+		return ERROR_INVALID_PARAMETER;
 	}
-
-	FILE *out = fopen(argv[2], "w");
-
-	if (out == NULL)
+	if (options->m_precision != PrecisionFloat && options->m_rhs_path)
 	{
-		printf("cannot open an output file");
-		fclose(in);
-		return ERROR_FILE_NOT_FOUND;
+		printf("--rhs solves in float only");
+		return ERROR_INVALID_PARAMETER;
 	}
+	return ERROR_SUCCESS;
+}
 
-	fscanf(in, "%i", &size);
+#define SPARSE_CLASSIFY_LIMIT 2048	// largest sparse system solved by dense elimination in the first place
+#define SPARSE_DENSE_LIMIT 8192	// largest one that falls back to it when the iterations fail
 
-	float *A = malloc(sizeof(float) * size * (size + 1));
-	if (A == NULL)
+static int solve_dense_refined(const float *A, int size, int stride, precision_t precision, FILE *out)
+{
+	double *x = malloc(sizeof(double) * (size > 0 ? size : 1));
+	if (x == NULL)
 	{
 		printf("cannot allocate memory");
-		fclose(in);
-		fclose(out);
 		return ERROR_NOT_ENOUGH_MEMORY;
 	}
-
-	rank = size;
-
-	for (int i = 0; i < size * (size + 1); i++)
+	refinement_t result;
+	int code = solve_refined(A, size, stride, precision, x, &result);
+	if (!code && result.m_solution == SolutionUnique)
 	{
-		fscanf(in, "%f", &A[i]);
+		for (int i = 0; i < size; i++)
+		{
+			fprintf(out, "%.15g\n", x[i]);
+		}
+		if (precision == PrecisionMixed && !result.m_double)
+			printf("%d refinement iterations, residual %g\n", result.m_iterations, result.m_residual);
+		else if (precision == PrecisionMixed)
+			printf("refinement failed after %d iterations, solved in double, residual %g\n", result.m_iterations, result.m_residual);
+		else
+			printf("solved in double, residual %g\n", result.m_residual);
 	}
+	else if (!code)
+	{
+		fprintf(out, result.m_solution == SolutionNone ? "no solution\n" : "many solutions\n");
+		printf("rank deficient at tolerance %g\n", result.m_tolerance);
+	}
+	free(x);
+	return code;
+}
 
-	int i = 0;
-	int j = 0;
-	while (i < size && j < size)
+// Factors the augmented matrix and writes the solution, "no solution" or "many solutions"
+static int solve_dense(float *A, int size, int stride, precision_t precision, FILE *out)
+{
+	if (precision != PrecisionFloat)
+		return solve_dense_refined(A, size, stride, precision, out);
+
+	int rank;
+	int extended_rank;
+	int *pivots = malloc(sizeof(int) * (size > 0 ? size : 1));
+	int *columns = malloc(sizeof(int) * (size > 0 ? size : 1));
+	if (pivots == NULL || columns == NULL)
 	{
-		if (equals(A[i * (size + 1) + j], 0))
-		{
-			for (int k = i + 1; k < size; k++)
-			{
-				if (!equals(A[k * (size + 1) + j], 0))
-				{
-					for (int l = 0; l < size + 1; l++)
-					{
-						float t = A[k * (size + 1) + l];
-						A[k * (size + 1) + l] = A[i * (size + 1) + l];
-						A[i * (size + 1) + l] = t;
-					}
-
-					break;
-				}
-			}
-		}
-		if (!equals(A[i * (size + 1) + j], 0))
-		{
-			for (int k = i + 1; k < size; k++)
-			{
-				float coef = A[k * (size + 1) + j] / A[i * (size + 1) + j];
-				for (int l = 0; l < size + 1; l++)
-				{
-					A[k * (size + 1) + l] = A[k * (size + 1) + l] - A[i * (size + 1) + l] * coef;
-				}
-			}
-			i++;
-			j++;
-		}
-		else	// for  many solutions and no solutions
-		{
-			rank--;
-			j++;
-		}
+		printf("cannot allocate memory");
+		free(pivots);
+		free(columns);
+		return ERROR_NOT_ENOUGH_MEMORY;
 	}
 
+	// the right-hand side is rounded like the rest of its row, its tolerance takes it in
+	float tolerance = get_lu_tolerance(A, size, stride, size);
+	float extended_tolerance = get_lu_tolerance(A, size, stride, size + 1);
+	rank = lu_factor(A, size, stride, pivots, columns, tolerance);
+	free(pivots);
+	free(columns);
+
+	int i;
+	int j;
 	extended_rank = rank;
 	for (i = 0; i < size - rank; i++)
 	{
-		if (!equals(A[(size - i - 1) * (size + 1) + size], 0))	  // for no solutions
+		if (fabsf(A[(size - i - 1) * stride + size]) > extended_tolerance)	// for no solutions
 		{
 			extended_rank++;
 			break;
@@ -117,9 +154,6 @@ int main(int argc, char **argv)
 		if (res == NULL)
 		{
 			printf("cannot allocate memory");
-			fclose(in);
-			fclose(out);
-			free(A);
 			return ERROR_NOT_ENOUGH_MEMORY;
 		}
 		for (i = size - 1; i > -1; i--)
@@ -127,10 +161,10 @@ int main(int argc, char **argv)
 			float d = 0;
 			for (j = i + 1; j < size; j++)
 			{
-				float s = A[i * (size + 1) + j] * res[j];
+				float s = A[i * stride + j] * res[j];
 				d += s;
 			}
-			res[i] = (A[i * (size + 1) + size] - d) / A[i * (size + 1) + i];
+			res[i] = (A[i * stride + size] - d) / A[i * stride + i];
 		}
 		for (i = 0; i < size; i++)
 		{
@@ -143,8 +177,300 @@ int main(int argc, char **argv)
 	{
 		fprintf(out, "many solutions\n");
 	}
-	fclose(in);
-	fclose(out);
+	return ERROR_SUCCESS;
+}
+
+static int solve_dense_file(mapped_file_t *in, precision_t precision, FILE *out)
+{
+	int extra = 1;
+	int size;
+	int stride;
+	float *A;
+	int code = load_dense_matrix(in, &extra, &A, &size, &stride, get_lu_threads());
+	if (code)
+		return code;
+
+	code = solve_dense(A, size, stride, precision, out);
+	free_dense_matrix(in, A);
+	return code;
+}
+
+#define RHS_BATCH 256	 // right-hand sides read and substituted together
+
+// Writes a line for each of the count right-hand sides in the columns of B, after lu_forward;
+// tolerance is the one the matrix was factored with
+static int solve_rhs_batch(const float *A, int size, int stride, const int *pivots, const int *columns, int rank, float tolerance, float *B, int count, FILE *out)
+{
+	float tolerances[RHS_BATCH];
+	for (int r = 0; r < count && rank < size; r++)
+	{
+		float own = get_lu_tolerance(B + r, size, RHS_BATCH, 1);
+		tolerances[r] = own > tolerance ? own : tolerance;
+	}
+	lu_forward(A, size, stride, pivots, columns, rank, B, count, RHS_BATCH);
+	if (rank == size)
+		lu_backward(A, size, stride, B, count, RHS_BATCH);
+	for (int r = 0; r < count; r++)
+	{
+		if (rank == size)
+		{
+			for (int i = 0; i < size; i++)
+			{
+				fprintf(out, i ? " %g" : "%g", B[i * RHS_BATCH + r]);
+			}
+			fprintf(out, "\n");
+			continue;
+		}
+		int consistent = 1;
+		for (int i = rank; i < size && consistent; i++)
+		{
+			consistent = fabsf(B[i * RHS_BATCH + r]) <= tolerances[r];
+		}
+		fprintf(out, consistent ? "many solutions\n" : "no solution\n");
+	}
+	return ERROR_SUCCESS;
+}
+
+// Factorization of the matrix in A with tolerance, from factor_path if it holds the one of this
+// matrix; a new one is saved there
+static int factor_cached(float *A, int size, int stride, int *pivots, int *columns, int *rank, float tolerance, const char *factor_path)
+{
+	uint64_t hash = hash_matrix(A, size, stride);
+	if (factor_path && !load_lu_cache(factor_path, A, size, stride, hash, pivots, columns, rank))
+		return ERROR_SUCCESS;
+
+	*rank = lu_factor(A, size, stride, pivots, columns, tolerance);
+	if (factor_path && save_lu_cache(factor_path, A, size, stride, hash, pivots, columns, *rank))
+	{
+		printf("cannot write the factorization to %s", factor_path);
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
+
+static int solve_rhs_file(const float *A, int size, int stride, const int *pivots, const int *columns, int rank, float tolerance, float *B, const char *rhs_path, FILE *out)
+{
+	mapped_file_t file;
+	int code = map_file(&file, rhs_path);
+	if (code)
+	{
+		printf("cannot open a right-hand side file");
+		return code;
+	}
+
+	text_t rhs = { file.m_data, file.m_data + file.m_length };
+	int count;
+	if (!read_int(&rhs, &count) || count < 0)
+	{
+		printf("invalid right-hand side count");
+		code = ERROR_INVALID_DATA;
+	}
+	for (int first = 0; first < count && !code; first += RHS_BATCH)
+	{
+		int batch = count - first < RHS_BATCH ? count - first : RHS_BATCH;
+		for (int r = 0; r < batch && !code; r++)
+		{
+			for (int i = 0; i < size && !code; i++)
+			{
+				if (!read_float(&rhs, &B[i * RHS_BATCH + r]))
+				{
+					printf("invalid right-hand side %d", first + r);
+					code = ERROR_INVALID_DATA;
+				}
+			}
+		}
+		if (!code)
+			code = solve_rhs_batch(A, size, stride, pivots, columns, rank, tolerance, B, batch, out);
+	}
+	unmap_file(&file);
+	return code;
+}
+
+// Factors the matrix of in once, then solves every right-hand side of rhs_path with O(size^2)
+// substitutions
+static int solve_factored_file(mapped_file_t *in, FILE *out, const char *rhs_path, const char *factor_path)
+{
+	int extra = 0;
+	int size;
+	int stride;
+	float *A;
+	int code = load_dense_matrix(in, &extra, &A, &size, &stride, get_lu_threads());
+	if (code)
+		return code;
+
+	int rows = size > 0 ? size : 1;
+	float *B = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * rows * RHS_BATCH);
+	int *pivots = malloc(sizeof(int) * rows);
+	int *columns = malloc(sizeof(int) * rows);
+	if (B == NULL || pivots == NULL || columns == NULL)
+	{
+		printf("cannot allocate memory");
+		code = ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	for (int i = 0; i < size && !code; i++)
+	{
+		A[i * stride + size] = 0;	 // lu_factor carries an augmented column along
+	}
+
+	int rank;
+	float tolerance = get_lu_tolerance(A, size, stride, size);
+	if (!code)
+		code = factor_cached(A, size, stride, pivots, columns, &rank, tolerance, factor_path);
+	if (!code)
+		code = solve_rhs_file(A, size, stride, pivots, columns, rank, tolerance, B, rhs_path, out);
+
+	free_dense_matrix(in, A);
+	free(B);
+	free(pivots);
+	free(columns);
+	return code;
+}
+
+static int convert_to_binary(mapped_file_t *in, FILE *out)
+{
+	int extra = -1;
+	int size;
+	int stride;
+	float *A;
+	int code = load_dense_matrix(in, &extra, &A, &size, &stride, get_lu_threads());
+	if (code)
+		return code;
+
+	code = write_binary_matrix(out, A, size, size + extra, stride);
+	free_dense_matrix(in, A);
+	return code;
+}
+
+// Dense elimination of the sparse system, which tells a unique solution from many and none
+static int solve_expanded(const csr_matrix_t *matrix, const float *rhs, precision_t precision, FILE *out)
+{
+	int size = matrix->m_size;
+	int stride = get_row_stride(size);
+	float *A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * (size > 0 ? size : 1) * stride);
+	if (A == NULL)
+	{
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	expand_sparse_system(A, stride, matrix, rhs);
+	int code = solve_dense(A, size, stride, precision, out);
 	free(A);
-	return 0;
+	return code;
+}
+
+// Systems up to SPARSE_CLASSIFY_LIMIT are solved by dense elimination. Larger ones are solved
+// iteratively; the iterations converge for singular consistent systems too, to one of their solutions,
+// so that output is labelled as not checked for rank. A system the iterations cannot solve (inconsistent
+// or too ill-conditioned) is classified by dense elimination if it is small enough.
+static int solve_sparse_file(text_t *in, precision_t precision, FILE *out)
+{
+	csr_matrix_t matrix;
+	float *rhs;
+	int code = read_sparse_system(&matrix, &rhs, in);
+	if (code)
+		return code;
+
+	int size = matrix.m_size;
+	if (size <= SPARSE_CLASSIFY_LIMIT)
+	{
+		code = solve_expanded(&matrix, rhs, precision, out);
+		free(rhs);
+		free_csr_matrix(&matrix);
+		return code;
+	}
+
+	double *x = malloc(sizeof(double) * size);
+	if (x == NULL)
+	{
+		printf("cannot allocate memory");
+		code = ERROR_NOT_ENOUGH_MEMORY;
+	}
+	int iterations;
+	double residual;
+	if (!code)
+		code = solve_sparse(&matrix, rhs, x, &iterations, &residual);
+	if (!code)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			fprintf(out, "%g\n", (float)x[i]);
+		}
+		printf("iterative solution, rank not checked (one of many if the matrix is singular): %d iterations, residual %g\n", iterations, residual);
+	}
+	else if (code == ERROR_UNSUPPORTED && size <= SPARSE_DENSE_LIMIT)
+	{
+		code = solve_expanded(&matrix, rhs, precision, out);
+	}
+	else if (code == ERROR_UNSUPPORTED)
+	{
+		printf("iterative solver stopped at residual %g after %d iterations", residual, iterations);
+	}
+
+	free(x);
+	free(rhs);
+	free_csr_matrix(&matrix);
+	return code;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		printf("Wrong number of arguments");
+		return ERROR_INVALID_DATA;
+	}
+	options_t options;
+	if (parse_options(argc - 3, argv + 3, &options))
+	{
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	mapped_file_t in;
+	int code = map_file(&in, argv[1]);
+	if (code)
+	{
+		printf("cannot open an input file");
+		return code;
+	}
+
+	output_file_t output;
+	code = open_output(&output, argv[2], options.m_to_binary ? "wb" : "w");
+	if (code)
+	{
+		printf("cannot open an output file");
+		unmap_file(&in);
+		return code;
+	}
+	FILE *out = output.m_file;
+
+	// sparse systems and batches start with a keyword, dense ones with their size or the binary header
+	text_t text = { in.m_data, in.m_data + in.m_length };
+	text_t keyword = text;
+	int is_sparse = read_word(&keyword, "sparse");
+	keyword = text;
+	int is_batch = read_word(&keyword, "batch");
+	if (options.m_to_binary)
+		code = convert_to_binary(&in, out);
+	else if (options.m_rhs_path)
+		code = solve_factored_file(&in, out, options.m_rhs_path, options.m_factor_path);
+	else if (is_sparse)
+		code = solve_sparse_file(&text, options.m_precision, out);
+	else if (is_batch && options.m_precision != PrecisionFloat)
+	{
+		printf("batch systems are solved in float only");
+		code = ERROR_INVALID_PARAMETER;
+	}
+	else if (is_batch)
+		code = solve_batch_text(&text, out);
+	else
+		code = solve_dense_file(&in, options.m_precision, out);
+
+	unmap_file(&in);
+	if (close_output(&output) && !code)
+	{
+		printf("cannot write the output file");
+		code = ERROR_UNKNOWN;
+	}
+	return code;
 }
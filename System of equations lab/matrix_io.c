@@ -0,0 +1,297 @@
+#include "matrix_io.h"
+
+#include "../common/return_codes.h"
+#include "row_update.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined _OPENMP
+#	define PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic) num_threads(threads) if (threads > 1)")
+#else
+#	define PARALLEL_FOR
+#endif
+
+#define PARSE_CHUNK (1 << 16)	// smallest text range of one parsing task
+
+#if FILE_ALIGNMENT < ROW_ALIGNMENT
+#	error("copies of files are used in place as matrices")
+#endif
+
+// Start of chunk k of chunks: the first token starting in its share of the text
+static const char *get_chunk_start(const char *begin, const char *end, int k, int chunks)
+{
+	const char *p = begin + (size_t)(end - begin) * (size_t)k / (size_t)chunks;
+	if (p > begin && !is_space(p[-1]))
+		p = skip_token(p, end);
+	return p;
+}
+
+static int64_t count_tokens(const char *p, const char *end)
+{
+	int64_t tokens = 0;
+	int space = 1;	  // ranges start after white space or at it
+	for (; p < end; p++)
+	{
+		int next = is_space(*p);
+		tokens += space & !next;
+		space = next;
+	}
+	return tokens;
+}
+
+// Values index..last - 1 of a matrix of columns values per row, rows stride floats apart, from the tokens
+// at p; stops early at the end of the text. Returns the text after them or NULL for an invalid number.
+static const char *parse_range(const char *p, const char *end, float *A, int columns, int stride, int64_t *index, int64_t last)
+{
+	if (*index >= last)
+		return p;
+	int row = (int)(*index / columns);
+	int column = (int)(*index % columns);
+	for (p = skip_space(p, end); *index < last && p < end; (*index)++)
+	{
+		p = parse_float(p, end, &A[(size_t)row * stride + column]);
+		if (p == NULL)
+			return NULL;
+		p = skip_space(p, end);
+		if (++column == columns)
+		{
+			column = 0;
+			row++;
+		}
+	}
+	return p;
+}
+
+// The first count tokens of the text into the matrix; *found is the number of tokens of the text.
+// On several threads the tokens are counted per chunk first, so each chunk knows the index of its
+// first value and all of them are parsed at the same time.
+static int parse_values(const char *begin, const char *end, float *A, int columns, int stride, int64_t count, int threads, int64_t *found)
+{
+	int chunks = threads > 1 ? threads * 4 : 1;
+	if ((size_t)(end - begin) / PARSE_CHUNK + 1 < (size_t)chunks)
+		chunks = (int)((size_t)(end - begin) / PARSE_CHUNK + 1);
+	if (chunks == 1)
+	{
+		*found = 0;
+		const char *p = parse_range(begin, end, A, columns, stride, found, count);
+		if (p == NULL)
+			return ERROR_INVALID_DATA;
+		*found += count_tokens(p, end);
+		return ERROR_SUCCESS;
+	}
+
+	int64_t *firsts = malloc(sizeof(int64_t) * (chunks + 1));
+	int *failed = calloc(chunks, sizeof(int));
+	if (firsts == NULL || failed == NULL)
+	{
+		free(firsts);
+		free(failed);
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	PARALLEL_FOR
+	for (int k = 0; k < chunks; k++)
+	{
+		firsts[k + 1] = count_tokens(get_chunk_start(begin, end, k, chunks), get_chunk_start(begin, end, k + 1, chunks));
+	}
+	firsts[0] = 0;
+	for (int k = 0; k < chunks; k++)
+	{
+		firsts[k + 1] += firsts[k];
+	}
+	*found = firsts[chunks];
+
+	PARALLEL_FOR
+	for (int k = 0; k < chunks; k++)
+	{
+		int64_t index = firsts[k];
+		int64_t last = firsts[k + 1] < count ? firsts[k + 1] : count;
+		failed[k] = !parse_range(get_chunk_start(begin, end, k, chunks), end, A, columns, stride, &index, last);
+	}
+
+	int code = ERROR_SUCCESS;
+	for (int k = 0; k < chunks; k++)
+	{
+		if (failed[k])
+			code = ERROR_INVALID_DATA;
+	}
+	free(firsts);
+	free(failed);
+	return code;
+}
+
+static int load_text_matrix(mapped_file_t *file, int *extra, float **A, int *size, int *stride, int threads)
+{
+	text_t text = { file->m_data, file->m_data + file->m_length };
+	if (!read_int(&text, size) || *size < 0 || *size > (1 << 20))
+	{
+		printf("invalid matrix size");
+		return ERROR_INVALID_DATA;
+	}
+	*stride = get_row_stride(*size);
+	*A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * (*size > 0 ? *size : 1) * *stride);
+	if (*A == NULL)
+	{
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	// with extra unknown all values are counted first, there may be size + 1 or size per row
+	int columns = *size + (*extra < 0 ? 1 : *extra);
+	int64_t found;
+	int code = parse_values(text.m_cursor, text.m_end, *A, columns, *stride, *extra < 0 ? 0 : (int64_t)*size * columns, threads, &found);
+	if (!code && *extra < 0)
+	{
+		*extra = found == (int64_t)*size * (*size + 1) ? 1 : 0;
+		columns = *size + *extra;
+		code = parse_values(text.m_cursor, text.m_end, *A, columns, *stride, (int64_t)*size * columns, threads, &found);
+	}
+	if (!code && found != (int64_t)*size * columns)
+	{
+		printf("%lld values for a %d x %d matrix", (long long)found, *size, columns);
+		code = ERROR_INVALID_DATA;
+	}
+	else if (code == ERROR_INVALID_DATA)
+	{
+		printf("invalid number in the matrix");
+	}
+	if (code)
+	{
+		free(*A);
+		*A = NULL;
+	}
+	return code;
+}
+
+static uint32_t load_le32(const char *p)
+{
+	const unsigned char *bytes = (const unsigned char *)p;
+	return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static int is_little_endian(void)
+{
+	const uint32_t one = 1;
+	return *(const unsigned char *)&one == 1;
+}
+
+static int load_binary_matrix(mapped_file_t *file, int *extra, float **A, int *size, int *stride)
+{
+	binary_header_t header;
+	memcpy(header.m_magic, file->m_data, 4);
+	header.m_value_bytes = load_le32(file->m_data + 4);
+	header.m_rows = load_le32(file->m_data + 8);
+	header.m_columns = load_le32(file->m_data + 12);
+	header.m_stride = load_le32(file->m_data + 16);
+	uint64_t length = BINARY_MATRIX_HEADER + (uint64_t)header.m_rows * header.m_stride * header.m_value_bytes;
+	if ((header.m_value_bytes != 4 && header.m_value_bytes != 8) || header.m_rows > (1u << 20) ||
+		(header.m_columns != header.m_rows && header.m_columns != header.m_rows + 1) || header.m_stride < header.m_columns ||
+		length > file->m_length)
+	{
+		printf("invalid binary matrix header");
+		return ERROR_INVALID_DATA;
+	}
+	if (*extra >= 0 && header.m_columns != header.m_rows + *extra)
+	{
+		printf("the binary matrix has %u columns, %u expected", header.m_columns, header.m_rows + *extra);
+		return ERROR_INVALID_DATA;
+	}
+	*extra = (int)(header.m_columns - header.m_rows);
+	*size = (int)header.m_rows;
+	*stride = get_row_stride(*size);
+
+	const char *values = file->m_data + BINARY_MATRIX_HEADER;
+	if (header.m_value_bytes == 4 && header.m_stride == (uint32_t)*stride && is_little_endian())
+	{
+		*A = (float *)values;	 // the mapping is aligned and private, elimination may work in it
+		return ERROR_SUCCESS;
+	}
+
+	*A = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * (*size > 0 ? *size : 1) * *stride);
+	if (*A == NULL)
+	{
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (int i = 0; i < *size; i++)
+	{
+		const char *row = values + (size_t)i * header.m_stride * header.m_value_bytes;
+		for (uint32_t l = 0; l < header.m_columns; l++)
+		{
+			if (header.m_value_bytes == 4)
+			{
+				uint32_t bits = load_le32(row + l * 4);
+				memcpy(&(*A)[(size_t)i * *stride + l], &bits, 4);
+			}
+			else
+			{
+				uint64_t bits = load_le32(row + l * 8) | (uint64_t)load_le32(row + l * 8 + 4) << 32;
+				double value;
+				memcpy(&value, &bits, 8);
+				(*A)[(size_t)i * *stride + l] = (float)value;
+			}
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+int load_dense_matrix(mapped_file_t *file, int *extra, float **A, int *size, int *stride, int threads)
+{
+	*A = NULL;
+	if (file->m_length >= BINARY_MATRIX_HEADER && !memcmp(file->m_data, BINARY_MATRIX_MAGIC, 4))
+		return load_binary_matrix(file, extra, A, size, stride);
+	return load_text_matrix(file, extra, A, size, stride, threads);
+}
+
+void free_dense_matrix(const mapped_file_t *file, float *A)
+{
+	uintptr_t address = (uintptr_t)A;
+	if (address < (uintptr_t)file->m_data || address >= (uintptr_t)file->m_data + file->m_length)
+		free(A);
+}
+
+static void store_le32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)value;
+	p[1] = (unsigned char)(value >> 8);
+	p[2] = (unsigned char)(value >> 16);
+	p[3] = (unsigned char)(value >> 24);
+}
+
+int write_binary_matrix(FILE *out, const float *A, int rows, int columns, int stride)
+{
+	int padded = get_row_stride(rows);
+	unsigned char header[BINARY_MATRIX_HEADER] = { 0 };
+	memcpy(header, BINARY_MATRIX_MAGIC, 4);
+	store_le32(header + 4, 4);
+	store_le32(header + 8, (uint32_t)rows);
+	store_le32(header + 12, (uint32_t)columns);
+	store_le32(header + 16, (uint32_t)padded);
+
+	unsigned char *row = calloc((size_t)padded, 4);
+	if (row == NULL)
+	{
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	int ok = fwrite(header, 1, BINARY_MATRIX_HEADER, out) == BINARY_MATRIX_HEADER;
+	for (int i = 0; i < rows && ok; i++)
+	{
+		for (int l = 0; l < columns; l++)
+		{
+			uint32_t bits;
+			memcpy(&bits, &A[(size_t)i * stride + l], 4);
+			store_le32(row + l * 4, bits);
+		}
+		ok = fwrite(row, 4, (size_t)padded, out) == (size_t)padded;
+	}
+	free(row);
+	if (!ok)
+	{
+		printf("cannot write the binary matrix");
+		return ERROR_UNKNOWN;
+	}
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "../common/file_io.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Binary matrix: this 64 byte header ("EQMB", then little-endian uint32 fields and zeros), then rows
+// of m_stride little-endian floats or doubles, of which the first m_columns are the matrix.
+// A float file with the stride of get_row_stride() is used in place of a copy.
+#define BINARY_MATRIX_MAGIC "EQMB"
+#define BINARY_MATRIX_HEADER 64
+
+typedef struct binary_header_t_tag
+{
+	char m_magic[4];
+	uint32_t m_value_bytes;	   // 4 or 8
+	uint32_t m_rows;
+	uint32_t m_columns;
+	uint32_t m_stride;
+} binary_header_t;
+
+// Dense size x (size + extra) matrix in the get_row_stride(size) layout, extra 1 for an augmented
+// system and 0 for coefficients alone, -1 for whichever the file holds. Text is "size" and the values
+// row by row, parsed over threads row ranges; binary is the format above. A points into the mapping of
+// file or into aligned memory of its own, free_dense_matrix() tells which.
+int load_dense_matrix(mapped_file_t *file, int *extra, float **A, int *size, int *stride, int threads);
+void free_dense_matrix(const mapped_file_t *file, float *A);
+
+// rows x columns of A in the binary format, padded to get_row_stride(rows) so it loads in place
+int write_binary_matrix(FILE *out, const float *A, int rows, int columns, int stride);
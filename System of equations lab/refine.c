@@ -0,0 +1,255 @@
+#include "refine.h"
+
+#include "lu.h"
+#include "../common/return_codes.h"
+#include "row_update.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined _OPENMP
+#	define PARALLEL_FOR _Pragma("omp parallel for schedule(static) num_threads(threads) if (threads > 1)")
+#else
+#	define PARALLEL_FOR
+#endif
+
+static double get_vector_norm(const double *x, int size)
+{
+	double norm = 0;
+	for (int i = 0; i < size; i++)
+	{
+		norm = fabs(x[i]) > norm ? fabs(x[i]) : norm;
+	}
+	return norm;
+}
+
+// r = b - A x in double, returns ||r||
+static double get_residual(const float *A, int size, int stride, const double *x, double *r)
+{
+#if defined _OPENMP
+	int threads = get_lu_threads();
+#endif
+	PARALLEL_FOR
+	for (int i = 0; i < size; i++)
+	{
+		const float *row = A + (size_t)i * stride;
+		double sum = row[size];
+		for (int j = 0; j < size; j++)
+		{
+			sum -= (double)row[j] * x[j];
+		}
+		r[i] = sum;
+	}
+	return get_vector_norm(r, size);
+}
+
+// b = LU^-1 b with a float factorization of full rank, sums in double
+static void substitute(const float *LU, int size, int stride, const int *pivots, double *b)
+{
+	for (int i = 0; i < size; i++)
+	{
+		double t = b[i];
+		b[i] = b[pivots[i]];
+		b[pivots[i]] = t;
+	}
+	for (int k = 1; k < size; k++)
+	{
+		const float *row = LU + (size_t)k * stride;
+		double sum = b[k];
+		for (int i = 0; i < k; i++)
+		{
+			sum -= row[i] * b[i];
+		}
+		b[k] = sum;
+	}
+	for (int i = size - 1; i >= 0; i--)
+	{
+		const float *row = LU + (size_t)i * stride;
+		double sum = b[i];
+		for (int j = i + 1; j < size; j++)
+		{
+			sum -= row[j] * b[j];
+		}
+		b[i] = sum / row[i];
+	}
+}
+
+// Float factorization and refinement; *converged stays 0 if the factorization is singular at the
+// tolerance or the residual does not get small enough
+static int solve_mixed(const float *A, int size, int stride, double a_norm, double *x, refinement_t *result, int *converged)
+{
+	int rows = size > 0 ? size : 1;
+	float *LU = aligned_alloc(ROW_ALIGNMENT, sizeof(float) * rows * stride);
+	int *pivots = malloc(sizeof(int) * 2 * rows);	 // and pivot columns
+	double *r = malloc(sizeof(double) * rows);
+	if (LU == NULL || pivots == NULL || r == NULL)
+	{
+		printf("cannot allocate memory");
+		free(LU);
+		free(pivots);
+		free(r);
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	memcpy(LU, A, sizeof(float) * size * stride);
+
+	*converged = 0;
+	if (lu_factor(LU, size, stride, pivots, pivots + size, (float)result->m_tolerance) == size)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			x[i] = A[(size_t)i * stride + size];
+		}
+		substitute(LU, size, stride, pivots, x);
+		for (result->m_iterations = 0;; result->m_iterations++)
+		{
+			double r_norm = get_residual(A, size, stride, x, r);
+			if (r_norm <= sqrt(size) * DBL_EPSILON * a_norm * get_vector_norm(x, size))
+			{
+				*converged = 1;
+				break;
+			}
+			if (result->m_iterations == REFINE_MAX_ITERATIONS || !isfinite(r_norm))
+				break;
+			// the correction in the range of floats whatever the size of the residual
+			for (int i = 0; i < size; i++)
+			{
+				r[i] /= r_norm;
+			}
+			substitute(LU, size, stride, pivots, r);
+			for (int i = 0; i < size; i++)
+			{
+				x[i] += r[i] * r_norm;
+			}
+		}
+	}
+
+	free(LU);
+	free(pivots);
+	free(r);
+	return ERROR_SUCCESS;
+}
+
+// Gaussian elimination with partial pivoting in double; columns without an entry above the
+// tolerance are skipped, a zero row is inconsistent past the tolerance of the augmented matrix
+static int solve_double(const float *A, int size, int stride, double *x, refinement_t *result)
+{
+#if defined _OPENMP
+	int threads = get_lu_threads();
+#endif
+	int width = size + 1;
+	double *D = malloc(sizeof(double) * (size > 0 ? size : 1) * width);
+	if (D == NULL)
+	{
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	for (int i = 0; i < size; i++)
+	{
+		for (int l = 0; l < width; l++)
+		{
+			D[(size_t)i * width + l] = A[(size_t)i * stride + l];
+		}
+	}
+
+	double tolerance = result->m_tolerance;
+	double extended_tolerance = get_lu_tolerance(A, size, stride, size + 1);
+	int rank = 0;
+	for (int j = 0; j < size && rank < size; j++)
+	{
+		int p = rank;
+		for (int k = rank + 1; k < size; k++)
+		{
+			if (fabs(D[(size_t)k * width + j]) > fabs(D[(size_t)p * width + j]))
+				p = k;
+		}
+		if (fabs(D[(size_t)p * width + j]) <= tolerance)
+			continue;
+		for (int l = j; l < width && p != rank; l++)
+		{
+			double t = D[(size_t)rank * width + l];
+			D[(size_t)rank * width + l] = D[(size_t)p * width + l];
+			D[(size_t)p * width + l] = t;
+		}
+
+		const double *pivot_row = D + (size_t)rank * width;
+		PARALLEL_FOR
+		for (int k = rank + 1; k < size; k++)
+		{
+			double *restrict row = D + (size_t)k * width;
+			double coef = row[j] / pivot_row[j];
+			for (int l = j; l < width; l++)
+			{
+				row[l] -= coef * pivot_row[l];
+			}
+		}
+		rank++;
+	}
+
+	result->m_solution = rank == size ? SolutionUnique : SolutionMany;
+	for (int i = rank; i < size; i++)
+	{
+		if (fabs(D[(size_t)i * width + size]) > extended_tolerance)
+			result->m_solution = SolutionNone;
+	}
+	if (result->m_solution == SolutionUnique)
+	{
+		for (int i = size - 1; i >= 0; i--)
+		{
+			const double *row = D + (size_t)i * width;
+			double sum = row[size];
+			for (int j = i + 1; j < size; j++)
+			{
+				sum -= row[j] * x[j];
+			}
+			x[i] = sum / row[i];
+		}
+	}
+	free(D);
+	return ERROR_SUCCESS;
+}
+
+int solve_refined(const float *A, int size, int stride, precision_t precision, double *x, refinement_t *result)
+{
+	double a_norm = 0;
+	double b_norm = 0;
+	for (int i = 0; i < size; i++)
+	{
+		double sum = 0;
+		for (int j = 0; j < size; j++)
+		{
+			sum += fabs(A[(size_t)i * stride + j]);
+		}
+		double b = fabs(A[(size_t)i * stride + size]);
+		a_norm = sum > a_norm ? sum : a_norm;
+		b_norm = b > b_norm ? b : b_norm;
+	}
+
+	memset(result, 0, sizeof(*result));
+	result->m_tolerance = get_lu_tolerance(A, size, stride, size);
+	int converged = 0;
+	int code = ERROR_SUCCESS;
+	if (precision == PrecisionMixed)
+		code = solve_mixed(A, size, stride, a_norm, x, result, &converged);
+	if (!code && !converged)
+	{
+		result->m_double = 1;
+		code = solve_double(A, size, stride, x, result);
+	}
+	if (!code && result->m_solution == SolutionUnique)
+	{
+		double *r = malloc(sizeof(double) * (size > 0 ? size : 1));
+		if (r == NULL)
+		{
+			printf("cannot allocate memory");
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		double scale = a_norm * get_vector_norm(x, size) + b_norm;
+		double r_norm = get_residual(A, size, stride, x, r);
+		result->m_residual = scale > 0 ? r_norm / scale : 0;
+		free(r);
+	}
+	return code;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#define REFINE_MAX_ITERATIONS 30
+
+typedef enum precision_t_tag
+{
+	PrecisionFloat,	   // float elimination, entries up to get_lu_tolerance() are 0
+	PrecisionMixed,	   // float factorization refined in double, a double solve where that fails
+	PrecisionDouble,
+} precision_t;
+
+typedef enum solution_t_tag
+{
+	SolutionUnique,
+	SolutionNone,
+	SolutionMany,
+} solution_t;
+
+typedef struct refinement_t_tag
+{
+	solution_t m_solution;
+	int m_iterations;	 // refinement steps
+	int m_double;		 // solved in double: asked for, or the float factorization was singular or did not converge
+	double m_tolerance;
+	double m_residual;	  // ||b - A x|| / (||A|| ||x|| + ||b||) in the infinity norm, for unique solutions
+} refinement_t;
+
+// Solves the augmented size x (size + 1) float matrix A (rows stride floats apart, left unchanged)
+// with PrecisionMixed or PrecisionDouble, the solution goes to x. The inputs are floats, so pivots and
+// right-hand sides count as 0 up to the get_lu_tolerance() of the float path when rank and consistency
+// are decided: relative to the largest entry, it does not grow with the norm of the rows.
+// Mixed precision factors in float and refines x with residuals computed in double until
+// ||b - A x|| <= sqrt(size) * DBL_EPSILON * ||A|| ||x||, like LAPACK dsgesv.
+int solve_refined(const float *A, int size, int stride, precision_t precision, double *x, refinement_t *result);
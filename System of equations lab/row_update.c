@@ -0,0 +1,243 @@
+#include "row_update.h"
+
+#if defined __x86_64__ || defined __i386__
+#	define X86_ROW_UPDATE
+#	include <immintrin.h>
+#endif
+
+static void row_update_scalar(float *restrict y, const float *restrict x, float coef, int count)
+{
+	for (int l = 0; l < count; l++)
+	{
+		y[l] -= x[l] * coef;
+	}
+}
+
+static void rows_update_scalar(float *restrict y, const float *restrict x, int stride, const float *restrict coefs, int rows, int count)
+{
+	for (int t = 0; t < rows; t++)
+	{
+		row_update_scalar(y, x + t * stride, coefs[t], count);
+	}
+}
+
+#if defined X86_ROW_UPDATE
+__attribute__((target("avx2,fma"))) static inline __m256i get_tail_mask_avx2(int count)
+{
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2,fma"))) static void row_update_avx2(float *restrict y, const float *restrict x, float coef, int count)
+{
+	__m256 c = _mm256_set1_ps(coef);
+	int l = 0;
+	// four independent FMA chains keep both FMA ports busy
+	for (; l + 32 <= count; l += 32)
+	{
+		__m256 y0 = _mm256_fnmadd_ps(_mm256_loadu_ps(x + l), c, _mm256_loadu_ps(y + l));
+		__m256 y1 = _mm256_fnmadd_ps(_mm256_loadu_ps(x + l + 8), c, _mm256_loadu_ps(y + l + 8));
+		__m256 y2 = _mm256_fnmadd_ps(_mm256_loadu_ps(x + l + 16), c, _mm256_loadu_ps(y + l + 16));
+		__m256 y3 = _mm256_fnmadd_ps(_mm256_loadu_ps(x + l + 24), c, _mm256_loadu_ps(y + l + 24));
+		_mm256_storeu_ps(y + l, y0);
+		_mm256_storeu_ps(y + l + 8, y1);
+		_mm256_storeu_ps(y + l + 16, y2);
+		_mm256_storeu_ps(y + l + 24, y3);
+	}
+	for (; l + 8 <= count; l += 8)
+	{
+		_mm256_storeu_ps(y + l, _mm256_fnmadd_ps(_mm256_loadu_ps(x + l), c, _mm256_loadu_ps(y + l)));
+	}
+	if (l < count)
+	{
+		__m256i mask = get_tail_mask_avx2(count - l);
+		_mm256_maskstore_ps(y + l, mask, _mm256_fnmadd_ps(_mm256_maskload_ps(x + l, mask), c, _mm256_maskload_ps(y + l, mask)));
+	}
+}
+
+__attribute__((target("avx2,fma"))) static void rows_update_avx2(float *restrict y, const float *restrict x, int stride, const float *restrict coefs, int rows, int count)
+{
+	int t = 0;
+	for (; t + 4 <= rows; t += 4)
+	{
+		const float *x0 = x + t * stride;
+		const float *x1 = x0 + stride;
+		const float *x2 = x1 + stride;
+		const float *x3 = x2 + stride;
+		__m256 c0 = _mm256_set1_ps(coefs[t]);
+		__m256 c1 = _mm256_set1_ps(coefs[t + 1]);
+		__m256 c2 = _mm256_set1_ps(coefs[t + 2]);
+		__m256 c3 = _mm256_set1_ps(coefs[t + 3]);
+		int l = 0;
+		for (; l + 16 <= count; l += 16)
+		{
+			__m256 a = _mm256_loadu_ps(y + l);
+			__m256 b = _mm256_loadu_ps(y + l + 8);
+			a = _mm256_fnmadd_ps(_mm256_loadu_ps(x0 + l), c0, a);
+			b = _mm256_fnmadd_ps(_mm256_loadu_ps(x0 + l + 8), c0, b);
+			a = _mm256_fnmadd_ps(_mm256_loadu_ps(x1 + l), c1, a);
+			b = _mm256_fnmadd_ps(_mm256_loadu_ps(x1 + l + 8), c1, b);
+			a = _mm256_fnmadd_ps(_mm256_loadu_ps(x2 + l), c2, a);
+			b = _mm256_fnmadd_ps(_mm256_loadu_ps(x2 + l + 8), c2, b);
+			a = _mm256_fnmadd_ps(_mm256_loadu_ps(x3 + l), c3, a);
+			b = _mm256_fnmadd_ps(_mm256_loadu_ps(x3 + l + 8), c3, b);
+			_mm256_storeu_ps(y + l, a);
+			_mm256_storeu_ps(y + l + 8, b);
+		}
+		for (; l < count; l += 8)
+		{
+			__m256i mask = get_tail_mask_avx2(count - l);
+			__m256 a = _mm256_maskload_ps(y + l, mask);
+			a = _mm256_fnmadd_ps(_mm256_maskload_ps(x0 + l, mask), c0, a);
+			a = _mm256_fnmadd_ps(_mm256_maskload_ps(x1 + l, mask), c1, a);
+			a = _mm256_fnmadd_ps(_mm256_maskload_ps(x2 + l, mask), c2, a);
+			a = _mm256_fnmadd_ps(_mm256_maskload_ps(x3 + l, mask), c3, a);
+			_mm256_maskstore_ps(y + l, mask, a);
+		}
+	}
+	for (; t < rows; t++)
+	{
+		row_update_avx2(y, x + t * stride, coefs[t], count);
+	}
+}
+
+__attribute__((target("avx512f"))) static void row_update_avx512(float *restrict y, const float *restrict x, float coef, int count)
+{
+	__m512 c = _mm512_set1_ps(coef);
+	int l = 0;
+	for (; l + 32 <= count; l += 32)
+	{
+		__m512 y0 = _mm512_fnmadd_ps(_mm512_loadu_ps(x + l), c, _mm512_loadu_ps(y + l));
+		__m512 y1 = _mm512_fnmadd_ps(_mm512_loadu_ps(x + l + 16), c, _mm512_loadu_ps(y + l + 16));
+		_mm512_storeu_ps(y + l, y0);
+		_mm512_storeu_ps(y + l + 16, y1);
+	}
+	for (; l < count; l += 16)
+	{
+		__mmask16 mask = count - l >= 16 ? 0xFFFF : (__mmask16)((1u << (count - l)) - 1);
+		_mm512_mask_storeu_ps(y + l, mask, _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(mask, x + l), c, _mm512_maskz_loadu_ps(mask, y + l)));
+	}
+}
+
+__attribute__((target("avx512f"))) static void rows_update_avx512(float *restrict y, const float *restrict x, int stride, const float *restrict coefs, int rows, int count)
+{
+	int t = 0;
+	for (; t + 4 <= rows; t += 4)
+	{
+		const float *x0 = x + t * stride;
+		const float *x1 = x0 + stride;
+		const float *x2 = x1 + stride;
+		const float *x3 = x2 + stride;
+		__m512 c0 = _mm512_set1_ps(coefs[t]);
+		__m512 c1 = _mm512_set1_ps(coefs[t + 1]);
+		__m512 c2 = _mm512_set1_ps(coefs[t + 2]);
+		__m512 c3 = _mm512_set1_ps(coefs[t + 3]);
+		int l = 0;
+		for (; l + 32 <= count; l += 32)
+		{
+			__m512 a = _mm512_loadu_ps(y + l);
+			__m512 b = _mm512_loadu_ps(y + l + 16);
+			a = _mm512_fnmadd_ps(_mm512_loadu_ps(x0 + l), c0, a);
+			b = _mm512_fnmadd_ps(_mm512_loadu_ps(x0 + l + 16), c0, b);
+			a = _mm512_fnmadd_ps(_mm512_loadu_ps(x1 + l), c1, a);
+			b = _mm512_fnmadd_ps(_mm512_loadu_ps(x1 + l + 16), c1, b);
+			a = _mm512_fnmadd_ps(_mm512_loadu_ps(x2 + l), c2, a);
+			b = _mm512_fnmadd_ps(_mm512_loadu_ps(x2 + l + 16), c2, b);
+			a = _mm512_fnmadd_ps(_mm512_loadu_ps(x3 + l), c3, a);
+			b = _mm512_fnmadd_ps(_mm512_loadu_ps(x3 + l + 16), c3, b);
+			_mm512_storeu_ps(y + l, a);
+			_mm512_storeu_ps(y + l + 16, b);
+		}
+		for (; l < count; l += 16)
+		{
+			__mmask16 mask = count - l >= 16 ? 0xFFFF : (__mmask16)((1u << (count - l)) - 1);
+			__m512 a = _mm512_maskz_loadu_ps(mask, y + l);
+			a = _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(mask, x0 + l), c0, a);
+			a = _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(mask, x1 + l), c1, a);
+			a = _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(mask, x2 + l), c2, a);
+			a = _mm512_fnmadd_ps(_mm512_maskz_loadu_ps(mask, x3 + l), c3, a);
+			_mm512_mask_storeu_ps(y + l, mask, a);
+		}
+	}
+	for (; t < rows; t++)
+	{
+		row_update_avx512(y, x + t * stride, coefs[t], count);
+	}
+}
+#endif
+
+int has_row_kernel(row_kernel_t kernel)
+{
+#if defined X86_ROW_UPDATE
+	__builtin_cpu_init();
+	switch (kernel)
+	{
+	case RowKernelAvx2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case RowKernelAvx512:
+		return __builtin_cpu_supports("avx512f");
+	default:
+		return 1;
+	}
+#else
+	return kernel == RowKernelScalar;
+#endif
+}
+
+static row_kernel_t current_kernel;
+static void (*row_implementation)(float *restrict y, const float *restrict x, float coef, int count);
+static void (*rows_implementation)(float *restrict y, const float *restrict x, int stride, const float *restrict coefs, int rows, int count);
+
+void set_row_kernel(row_kernel_t kernel)
+{
+	current_kernel = kernel;
+	row_implementation = row_update_scalar;
+	rows_implementation = rows_update_scalar;
+#if defined X86_ROW_UPDATE
+	if (kernel == RowKernelAvx2)
+	{
+		row_implementation = row_update_avx2;
+		rows_implementation = rows_update_avx2;
+	}
+	else if (kernel == RowKernelAvx512)
+	{
+		row_implementation = row_update_avx512;
+		rows_implementation = rows_update_avx512;
+	}
+#endif
+}
+
+static void resolve(void)
+{
+	if (has_row_kernel(RowKernelAvx512))
+		set_row_kernel(RowKernelAvx512);
+	else if (has_row_kernel(RowKernelAvx2))
+		set_row_kernel(RowKernelAvx2);
+	else
+		set_row_kernel(RowKernelScalar);
+}
+
+row_kernel_t get_row_kernel(void)
+{
+	if (!row_implementation)
+		resolve();
+	return current_kernel;
+}
+
+void row_update(float *restrict y, const float *restrict x, float coef, int count)
+{
+	if (!row_implementation)
+		resolve();
+	row_implementation(y, x, coef, count);
+}
+
+void rows_update(float *restrict y, const float *restrict x, int stride, const float *restrict coefs, int rows, int count)
+{
+	if (!rows_implementation)
+		resolve();
+	rows_implementation(y, x, stride, coefs, rows, count);
+}
+
+int get_row_stride(int size)
+{
+	return (size + 1 + ROW_FLOATS - 1) / ROW_FLOATS * ROW_FLOATS;
+}
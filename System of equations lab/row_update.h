@@ -0,0 +1,28 @@
+#pragma once
+
+// Row operations of elimination. Rows are aligned to ROW_ALIGNMENT bytes and padded to a multiple
+// of ROW_FLOATS floats, so updates starting at a multiple of ROW_FLOATS columns use aligned vectors only.
+#define ROW_ALIGNMENT 64
+#define ROW_FLOATS (ROW_ALIGNMENT / (int)sizeof(float))
+
+typedef enum row_kernel_t_tag
+{
+	RowKernelScalar,
+	RowKernelAvx2,	  // AVX2 and FMA
+	RowKernelAvx512,
+} row_kernel_t;
+
+// y -= x * coef over count floats
+void row_update(float *restrict y, const float *restrict x, float coef, int count);
+
+// y -= sum of x[t * stride] * coefs[t] over rows rows: several pivot rows at once, so y is loaded and
+// stored once for every four of them
+void rows_update(float *restrict y, const float *restrict x, int stride, const float *restrict coefs, int rows, int count);
+
+// Both use the best kernels of this CPU unless set_row_kernel() chose others, for benchmarks
+row_kernel_t get_row_kernel(void);
+int has_row_kernel(row_kernel_t kernel);
+void set_row_kernel(row_kernel_t kernel);	 // only with has_row_kernel(kernel)
+
+// floats per row of a size x (size + 1) augmented matrix
+int get_row_stride(int size);
@@ -0,0 +1,417 @@
+#include "sparse.h"
+
+#include "../common/return_codes.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void free_csr_matrix(csr_matrix_t *matrix)
+{
+	free(matrix->m_row_starts);
+	free(matrix->m_columns);
+	free(matrix->m_values);
+	matrix->m_row_starts = NULL;
+	matrix->m_columns = NULL;
+	matrix->m_values = NULL;
+}
+
+// Triplets to rows by two stable counting sorts, by column and then by row, so the columns of
+// every row come out sorted and duplicates next to each other
+static int build_csr(csr_matrix_t *matrix, const int *rows, const int *columns, const float *values, int count)
+{
+	int size = matrix->m_size;
+	int *order = malloc(sizeof(int) * (count > 0 ? count : 1));
+	int *starts = calloc(size + 1, sizeof(int));
+	matrix->m_row_starts = calloc(size + 1, sizeof(int));
+	matrix->m_columns = malloc(sizeof(int) * (count > 0 ? count : 1));
+	matrix->m_values = malloc(sizeof(float) * (count > 0 ? count : 1));
+	if (order == NULL || starts == NULL || matrix->m_row_starts == NULL || matrix->m_columns == NULL || matrix->m_values == NULL)
+	{
+		free(order);
+		free(starts);
+		free_csr_matrix(matrix);
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	for (int k = 0; k < count; k++)
+	{
+		starts[columns[k] + 1]++;
+	}
+	for (int c = 0; c < size; c++)
+	{
+		starts[c + 1] += starts[c];
+	}
+	for (int k = 0; k < count; k++)
+	{
+		order[starts[columns[k]]++] = k;
+	}
+
+	int *row_starts = matrix->m_row_starts;
+	for (int k = 0; k < count; k++)
+	{
+		row_starts[rows[k] + 1]++;
+	}
+	for (int i = 0; i < size; i++)
+	{
+		row_starts[i + 1] += row_starts[i];
+	}
+	memcpy(starts, row_starts, sizeof(int) * size);
+	for (int n = 0; n < count; n++)
+	{
+		int k = order[n];
+		int position = starts[rows[k]]++;
+		matrix->m_columns[position] = columns[k];
+		matrix->m_values[position] = values[k];
+	}
+
+	// duplicates added up, rows compacted in place
+	int kept = 0;
+	for (int i = 0; i < size; i++)
+	{
+		int begin = row_starts[i];
+		int end = row_starts[i + 1];
+		row_starts[i] = kept;
+		for (int k = begin; k < end; k++)
+		{
+			if (kept > row_starts[i] && matrix->m_columns[kept - 1] == matrix->m_columns[k])
+			{
+				matrix->m_values[kept - 1] += matrix->m_values[k];
+				continue;
+			}
+			matrix->m_columns[kept] = matrix->m_columns[k];
+			matrix->m_values[kept] = matrix->m_values[k];
+			kept++;
+		}
+	}
+	row_starts[size] = kept;
+	matrix->m_count = kept;
+
+	free(order);
+	free(starts);
+	return ERROR_SUCCESS;
+}
+
+int read_sparse_system(csr_matrix_t *matrix, float **rhs, text_t *in)
+{
+	int size;
+	int count;
+	memset(matrix, 0, sizeof(*matrix));
+	*rhs = NULL;
+	if (!read_word(in, "sparse") || !read_int(in, &size) || !read_int(in, &count) || size < 1 || count < 0)
+	{
+		printf("invalid sparse header");
+		return ERROR_INVALID_DATA;
+	}
+	matrix->m_size = size;
+
+	int *rows = malloc(sizeof(int) * (count > 0 ? count : 1));
+	int *columns = malloc(sizeof(int) * (count > 0 ? count : 1));
+	float *values = malloc(sizeof(float) * (count > 0 ? count : 1));
+	*rhs = malloc(sizeof(float) * size);
+	if (rows == NULL || columns == NULL || values == NULL || *rhs == NULL)
+	{
+		printf("cannot allocate memory");
+		free(rows);
+		free(columns);
+		free(values);
+		free(*rhs);
+		*rhs = NULL;
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	int code = ERROR_SUCCESS;
+	for (int k = 0; k < count && !code; k++)
+	{
+		if (!read_int(in, &rows[k]) || !read_int(in, &columns[k]) || !read_float(in, &values[k]) || rows[k] < 0 || rows[k] >= size ||
+			columns[k] < 0 || columns[k] >= size)
+		{
+			printf("invalid sparse entry %d", k);
+			code = ERROR_INVALID_DATA;
+		}
+	}
+	for (int i = 0; i < size && !code; i++)
+	{
+		if (!read_float(in, &(*rhs)[i]))
+		{
+			printf("invalid right-hand side");
+			code = ERROR_INVALID_DATA;
+		}
+	}
+	if (!code)
+		code = build_csr(matrix, rows, columns, values, count);
+
+	free(rows);
+	free(columns);
+	free(values);
+	if (code)
+	{
+		free(*rhs);
+		*rhs = NULL;
+	}
+	return code;
+}
+
+static void multiply(double *y, const csr_matrix_t *matrix, const double *x)
+{
+	for (int i = 0; i < matrix->m_size; i++)
+	{
+		double sum = 0;
+		for (int k = matrix->m_row_starts[i]; k < matrix->m_row_starts[i + 1]; k++)
+		{
+			sum += matrix->m_values[k] * x[matrix->m_columns[k]];
+		}
+		y[i] = sum;
+	}
+}
+
+static double dot(const double *a, const double *b, int size)
+{
+	double sum = 0;
+	for (int i = 0; i < size; i++)
+	{
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+// the value at (row, column), 0 if it is not stored
+static float get_entry(const csr_matrix_t *matrix, int row, int column)
+{
+	int low = matrix->m_row_starts[row];
+	int high = matrix->m_row_starts[row + 1];
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (matrix->m_columns[middle] < column)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low < matrix->m_row_starts[row + 1] && matrix->m_columns[low] == column ? matrix->m_values[low] : 0;
+}
+
+static int is_symmetric_positive(const csr_matrix_t *matrix)
+{
+	for (int i = 0; i < matrix->m_size; i++)
+	{
+		if (get_entry(matrix, i, i) <= 0)
+			return 0;
+		for (int k = matrix->m_row_starts[i]; k < matrix->m_row_starts[i + 1]; k++)
+		{
+			if (get_entry(matrix, matrix->m_columns[k], i) != matrix->m_values[k])
+				return 0;
+		}
+	}
+	return 1;
+}
+
+// inverse diagonal, 1 where the diagonal is 0
+static void get_jacobi(double *inverse, const csr_matrix_t *matrix)
+{
+	for (int i = 0; i < matrix->m_size; i++)
+	{
+		float diagonal = get_entry(matrix, i, i);
+		inverse[i] = diagonal != 0 ? 1.0 / diagonal : 1.0;
+	}
+}
+
+// scratch: 4 * size doubles
+static int solve_cg(const csr_matrix_t *matrix, const double *b, double *x, const double *inverse, double *scratch, int *iterations, double *residual)
+{
+	int size = matrix->m_size;
+	double *r = scratch;
+	double *z = r + size;
+	double *p = z + size;
+	double *q = p + size;
+	double norm = sqrt(dot(b, b, size));
+	if (norm == 0)
+		norm = 1;
+
+	memset(x, 0, sizeof(double) * size);
+	memcpy(r, b, sizeof(double) * size);
+	for (int i = 0; i < size; i++)
+	{
+		z[i] = inverse[i] * r[i];
+	}
+	memcpy(p, z, sizeof(double) * size);
+	double rz = dot(r, z, size);
+	for (*iterations = 0; *iterations < SPARSE_MAX_ITERATIONS; (*iterations)++)
+	{
+		*residual = sqrt(dot(r, r, size)) / norm;
+		if (*residual < SPARSE_TOLERANCE)
+			return ERROR_SUCCESS;
+		multiply(q, matrix, p);
+		double pq = dot(p, q, size);
+		if (pq <= 0)	// not positive definite after all
+			return ERROR_UNSUPPORTED;
+		double alpha = rz / pq;
+		for (int i = 0; i < size; i++)
+		{
+			x[i] += alpha * p[i];
+			r[i] -= alpha * q[i];
+			z[i] = inverse[i] * r[i];
+		}
+		double next = dot(r, z, size);
+		for (int i = 0; i < size; i++)
+		{
+			p[i] = z[i] + next / rz * p[i];
+		}
+		rz = next;
+	}
+	*residual = sqrt(dot(r, r, size)) / norm;
+	return *residual < SPARSE_TOLERANCE ? ERROR_SUCCESS : ERROR_UNSUPPORTED;
+}
+
+// Right preconditioned GMRES(GMRES_RESTART): the Krylov basis is built for A M^-1 and the update
+// mapped back through M^-1. scratch: (GMRES_RESTART + 3) * size doubles
+static int solve_gmres(const csr_matrix_t *matrix, const double *b, double *x, const double *inverse, double *scratch, int *iterations, double *residual)
+{
+	int size = matrix->m_size;
+	double *basis = scratch;	// GMRES_RESTART + 1 vectors
+	double *w = basis + (GMRES_RESTART + 1) * size;
+	double *t = w + size;
+	double h[GMRES_RESTART + 1][GMRES_RESTART];
+	double cs[GMRES_RESTART];
+	double sn[GMRES_RESTART];
+	double g[GMRES_RESTART + 1];
+	double y[GMRES_RESTART];
+	double norm = sqrt(dot(b, b, size));
+	if (norm == 0)
+		norm = 1;
+
+	memset(x, 0, sizeof(double) * size);
+	*iterations = 0;
+	for (;;)
+	{
+		// r = b - A x as the first basis vector
+		multiply(w, matrix, x);
+		for (int i = 0; i < size; i++)
+		{
+			w[i] = b[i] - w[i];
+		}
+		double beta = sqrt(dot(w, w, size));
+		*residual = beta / norm;
+		if (*residual < SPARSE_TOLERANCE)
+			return ERROR_SUCCESS;
+		if (*iterations >= SPARSE_MAX_ITERATIONS)
+			return ERROR_UNSUPPORTED;
+		for (int i = 0; i < size; i++)
+		{
+			basis[i] = w[i] / beta;
+		}
+		memset(g, 0, sizeof(g));
+		g[0] = beta;
+
+		int m = 0;
+		while (m < GMRES_RESTART && *iterations < SPARSE_MAX_ITERATIONS)
+		{
+			double *v = basis + m * size;
+			for (int i = 0; i < size; i++)
+			{
+				t[i] = inverse[i] * v[i];
+			}
+			multiply(w, matrix, t);
+			// modified Gram-Schmidt
+			for (int k = 0; k <= m; k++)
+			{
+				h[k][m] = dot(w, basis + k * size, size);
+				for (int i = 0; i < size; i++)
+				{
+					w[i] -= h[k][m] * basis[k * size + i];
+				}
+			}
+			h[m + 1][m] = sqrt(dot(w, w, size));
+			// earlier rotations, then a new one to zero h[m + 1][m]
+			for (int k = 0; k < m; k++)
+			{
+				double temp = cs[k] * h[k][m] + sn[k] * h[k + 1][m];
+				h[k + 1][m] = -sn[k] * h[k][m] + cs[k] * h[k + 1][m];
+				h[k][m] = temp;
+			}
+			double r = hypot(h[m][m], h[m + 1][m]);
+			double next = h[m + 1][m];
+			cs[m] = r != 0 ? h[m][m] / r : 1;
+			sn[m] = r != 0 ? h[m + 1][m] / r : 0;
+			h[m][m] = r;
+			h[m + 1][m] = 0;
+			g[m + 1] = -sn[m] * g[m];
+			g[m] = cs[m] * g[m];
+			m++;
+			(*iterations)++;
+			if (fabs(g[m]) / norm < SPARSE_TOLERANCE || next == 0)
+				break;
+			for (int i = 0; i < size; i++)
+			{
+				basis[m * size + i] = w[i] / next;
+			}
+		}
+
+		// least squares on the triangle, x += M^-1 V y
+		for (int k = m - 1; k >= 0; k--)
+		{
+			double sum = g[k];
+			for (int l = k + 1; l < m; l++)
+			{
+				sum -= h[k][l] * y[l];
+			}
+			y[k] = h[k][k] != 0 ? sum / h[k][k] : 0;
+		}
+		memset(t, 0, sizeof(double) * size);
+		for (int k = 0; k < m; k++)
+		{
+			for (int i = 0; i < size; i++)
+			{
+				t[i] += y[k] * basis[k * size + i];
+			}
+		}
+		for (int i = 0; i < size; i++)
+		{
+			x[i] += inverse[i] * t[i];
+		}
+		// no progress in a whole cycle: singular or stagnating
+		if (fabs(g[m]) >= beta * (1 - 1e-12))
+		{
+			*residual = fabs(g[m]) / norm;
+			return ERROR_UNSUPPORTED;
+		}
+	}
+}
+
+int solve_sparse(const csr_matrix_t *matrix, const float *rhs, double *x, int *iterations, double *residual)
+{
+	int size = matrix->m_size;
+	int symmetric = is_symmetric_positive(matrix);
+	int vectors = symmetric ? 6 : GMRES_RESTART + 5;
+	double *b = malloc(sizeof(double) * size * vectors);
+	if (b == NULL)
+	{
+		printf("cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	double *inverse = b + size;
+	for (int i = 0; i < size; i++)
+	{
+		b[i] = rhs[i];
+	}
+	get_jacobi(inverse, matrix);
+	int code = symmetric ? solve_cg(matrix, b, x, inverse, inverse + size, iterations, residual)
+						 : solve_gmres(matrix, b, x, inverse, inverse + size, iterations, residual);
+	free(b);
+	return code;
+}
+
+void expand_sparse_system(float *A, int stride, const csr_matrix_t *matrix, const float *rhs)
+{
+	for (int i = 0; i < matrix->m_size; i++)
+	{
+		float *row = A + (size_t)i * stride;
+		memset(row, 0, sizeof(float) * matrix->m_size);
+		for (int k = matrix->m_row_starts[i]; k < matrix->m_row_starts[i + 1]; k++)
+		{
+			row[matrix->m_columns[k]] = matrix->m_values[k];
+		}
+		row[matrix->m_size] = rhs[i];
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "matrix_io.h"
+
+// Compressed sparse rows: the nonzeros of row i are m_values[m_row_starts[i]..m_row_starts[i + 1]),
+// sorted by column, without duplicates
+typedef struct csr_matrix_t_tag
+{
+	int m_size;
+	int m_count;
+	int *m_row_starts;
+	int *m_columns;
+	float *m_values;
+} csr_matrix_t;
+
+// Sparse system after the "sparse" keyword: "size count", count "row column value" triplets
+// (0-based, any order, duplicates are added up), then the size values of the right-hand side
+int read_sparse_system(csr_matrix_t *matrix, float **rhs, text_t *in);
+void free_csr_matrix(csr_matrix_t *matrix);
+
+#define SPARSE_TOLERANCE 1e-9	 // residual norm relative to the right-hand side
+#define SPARSE_MAX_ITERATIONS 10000
+#define GMRES_RESTART 30
+
+// Jacobi preconditioned conjugate gradient for symmetric matrices with a positive diagonal, restarted
+// GMRES otherwise. Returns ERROR_SUCCESS once the relative residual is below SPARSE_TOLERANCE,
+// ERROR_UNSUPPORTED if the iterations ran out (inconsistent or too ill-conditioned for an iterative
+// solver). The rank is not checked: a singular consistent system converges to one of its solutions.
+int solve_sparse(const csr_matrix_t *matrix, const float *rhs, double *x, int *iterations, double *residual);
+
+// the augmented dense matrix with rows stride floats apart
+void expand_sparse_system(float *A, int stride, const csr_matrix_t *matrix, const float *rhs);
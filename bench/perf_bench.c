@@ -0,0 +1,478 @@
+// perf_bench [--runs=N] [--scale=F] [--output=file] [--sort=path] [--png=path] [--equations=path]
+// Runs the three tools on generated inputs and writes JSON: per workload the median over N runs of
+// wall time and of the task clock, cycles, instructions, cache misses and branch misses the tool and
+// its threads spent in user mode, counted with perf_event_open(). Counters the system does not offer
+// (virtual machines often have no hardware counters) are null. --scale multiplies the input sizes.
+// The tools default to the ones built next to it (SORT_TOOL, PNG_TOOL and EQUATIONS_TOOL).
+#include "../common/file_io.h"
+#include "../common/return_codes.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RUNS 101
+#define MAX_ARGUMENTS 8
+
+typedef enum counter_t_tag
+{
+	CounterTaskClock,	 // nanoseconds on a CPU
+	CounterCycles,
+	CounterInstructions,
+	CounterCacheMisses,
+	CounterBranchMisses,
+	COUNTERS,
+} counter_t;
+
+static const char *counter_names[] = { "task_clock_ns", "cycles", "instructions", "cache_misses", "branch_misses" };
+
+typedef enum tool_t_tag
+{
+	ToolSort,
+	ToolPng,
+	ToolEquations,
+	TOOLS,
+} tool_t;
+
+static const char *tool_names[] = { "sort", "png", "equations" };
+
+typedef struct workload_t_tag
+{
+	const char *m_name;
+	tool_t m_tool;
+	const char *m_what;	   // the code it is there to measure
+	int (*m_generate)(FILE *out, int64_t size);	   // NULL: the input is the output of the workload before
+	int64_t m_size;	   // at scale 1
+	const char *m_options[2];
+} workload_t;
+
+static double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return *seed >> 8;
+}
+
+static int generate_sort_int(FILE *out, int64_t size)
+{
+	uint32_t seed = 1;
+	fprintf(out, "int ascending\n%lld\n", (long long)size);
+	for (int64_t i = 0; i < size; i++)
+	{
+		fprintf(out, "%d\n", (int)(next_random(&seed) & 0xFFFFFF) - 0x800000);
+	}
+	return ERROR_SUCCESS;
+}
+
+static int generate_sort_phonebook(FILE *out, int64_t size)
+{
+	static const char *names[] = { "Ivanov", "Petrov", "Sidorov", "Smirnov", "Kuznetsov", "Popov", "Vasiliev", "Sokolov" };
+	uint32_t seed = 1;
+	fprintf(out, "phonebook descending\n%lld\n", (long long)size);
+	for (int64_t i = 0; i < size; i++)
+	{
+		fprintf(out, "%s %s %s %u\n", names[next_random(&seed) % 8], names[next_random(&seed) % 8], names[next_random(&seed) % 8], next_random(&seed) % 10000000);
+	}
+	return ERROR_SUCCESS;
+}
+
+// size x size RGB gradients with noise: compressible, but not trivially
+static int generate_pnm(FILE *out, int64_t size)
+{
+	uint32_t seed = 1;
+	uint8_t *row = malloc((size_t)size * 3);
+	if (row == NULL)
+	{
+		fprintf(stderr, "cannot allocate memory");
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+	fprintf(out, "P6\n%lld %lld\n255\n", (long long)size, (long long)size);
+	for (int64_t y = 0; y < size; y++)
+	{
+		for (int64_t x = 0; x < size; x++)
+		{
+			row[x * 3] = (uint8_t)(x * 255 / size);
+			row[x * 3 + 1] = (uint8_t)(y * 255 / size);
+			row[x * 3 + 2] = (uint8_t)((x + y) / 2 + (next_random(&seed) & 7));
+		}
+		fwrite(row, 3, (size_t)size, out);
+	}
+	free(row);
+	return ERROR_SUCCESS;
+}
+
+// diagonally dominant, so the elimination loop runs through all size columns
+static int generate_dense_system(FILE *out, int64_t size)
+{
+	uint32_t seed = 1;
+	fprintf(out, "%lld\n", (long long)size);
+	for (int64_t i = 0; i < size; i++)
+	{
+		for (int64_t l = 0; l <= size; l++)
+		{
+			float value = (float)(next_random(&seed) & 0xFFFF) / 0x8000 - 1;
+			fprintf(out, l ? " %.6g" : "%.6g", l == i ? value + size : value);
+		}
+		fprintf(out, "\n");
+	}
+	return ERROR_SUCCESS;
+}
+
+static int generate_batch_systems(FILE *out, int64_t size)
+{
+	uint32_t seed = 1;
+	fprintf(out, "batch 8 %lld\n", (long long)size);
+	for (int64_t s = 0; s < size; s++)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			for (int l = 0; l <= 8; l++)
+			{
+				fprintf(out, l ? " %d" : "%d", (int)(next_random(&seed) % 19) - 9);
+			}
+			fprintf(out, "\n");
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+static const workload_t workloads[] = {
+	{ "sort_int", ToolSort, "quicksort.h", generate_sort_int, 1000000, { NULL } },
+	{ "sort_phonebook", ToolSort, "quicksort.h, phonebook comparisons", generate_sort_phonebook, 200000, { NULL } },
+	{ "png_encode", ToolPng, "deflate bands and filters of the encoder", generate_pnm, 2048, { "--encode", NULL } },
+	{ "png_decode", ToolPng, "on_iend: inflate, unfilter, layout", NULL, 2048, { NULL } },
+	{ "equations_dense", ToolEquations, "lu_factor elimination loop", generate_dense_system, 1024, { NULL } },
+	{ "equations_batch", ToolEquations, "solve_batch_lanes", generate_batch_systems, 100000, { NULL } },
+};
+
+#define WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static int open_counter(counter_t counter, pid_t pid)
+{
+	static const uint64_t configs[] = {
+		PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+	};
+	struct perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.type = counter == CounterTaskClock ? PERF_TYPE_SOFTWARE : PERF_TYPE_HARDWARE;
+	attributes.config = configs[counter];
+	attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attributes.disabled = 1;
+	attributes.enable_on_exec = 1;	  // the tool, not the fork before it
+	attributes.inherit = 1;			  // and its OpenMP threads
+	attributes.exclude_kernel = 1;	  // allowed without privileges
+	attributes.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attributes, pid, -1, -1, 0);
+}
+
+// the count scaled up for the time the counter was multiplexed out, -1 if there is none
+static int64_t read_counter(int descriptor)
+{
+	uint64_t values[3];
+	if (descriptor < 0 || read(descriptor, values, sizeof(values)) != sizeof(values) || !values[2])
+		return -1;
+	return (int64_t)((double)values[0] * values[1] / values[2]);
+}
+
+// One run of the tool with argv, its output to /dev/null: wall time and counters (-1 for the missing)
+static int run_tool(char *const *argv, double *wall, int64_t *counts, int *exit_code)
+{
+	int ready[2];
+	if (pipe(ready))
+	{
+		fprintf(stderr, "pipe failed");
+		return ERROR_UNKNOWN;
+	}
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "fork failed");
+		close(ready[0]);
+		close(ready[1]);
+		return ERROR_UNKNOWN;
+	}
+	if (pid == 0)
+	{
+		// waits until the counters are attached, they start counting at the exec
+		char go;
+		close(ready[1]);
+		if (read(ready[0], &go, 1) != 1)
+			_exit(127);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(ready[0]);
+	int descriptors[COUNTERS];
+	for (int c = 0; c < COUNTERS; c++)
+	{
+		descriptors[c] = open_counter((counter_t)c, pid);
+	}
+	double start = now();
+	int status = 0;
+	int released = write(ready[1], "1", 1) == 1;
+	close(ready[1]);
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+	*wall = now() - start;
+	for (int c = 0; c < COUNTERS; c++)
+	{
+		counts[c] = read_counter(descriptors[c]);
+		if (descriptors[c] >= 0)
+			close(descriptors[c]);
+	}
+	*exit_code = !released ? -1 : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	return ERROR_SUCCESS;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// median of the runs that have the counter, -1 if none has it
+static int64_t get_median_count(int64_t *counts, int runs)
+{
+	int valid = 0;
+	for (int r = 0; r < runs; r++)
+	{
+		if (counts[r] >= 0)
+			counts[valid++] = counts[r];
+	}
+	if (!valid)
+		return -1;
+	qsort(counts, valid, sizeof(int64_t), compare_counts);
+	return counts[valid / 2];
+}
+
+static void print_json_string(FILE *out, const char *text)
+{
+	fputc('"', out);
+	for (; *text; text++)
+	{
+		unsigned char c = (unsigned char)*text;
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+typedef struct options_t_tag
+{
+	int m_runs;
+	double m_scale;
+	const char *m_output;
+	const char *m_tools[TOOLS];
+} options_t;
+
+static int parse_options(int argc, char **argv, options_t *options)
+{
+#if defined SORT_TOOL && defined PNG_TOOL && defined EQUATIONS_TOOL
+	const char *tools[TOOLS] = { SORT_TOOL, PNG_TOOL, EQUATIONS_TOOL };
+#else
+	const char *tools[TOOLS] = { NULL };
+#endif
+	memset(options, 0, sizeof(*options));
+	options->m_runs = 5;
+	options->m_scale = 1;
+	memcpy(options->m_tools, tools, sizeof(tools));
+	for (int i = 0; i < argc; i++)
+	{
+		char end;
+		if (!strncmp(argv[i], "--runs=", 7) && sscanf(argv[i] + 7, "%d%c", &options->m_runs, &end) == 1 && options->m_runs > 0 && options->m_runs <= MAX_RUNS)
+			;
+		else if (!strncmp(argv[i], "--scale=", 8) && sscanf(argv[i] + 8, "%lf%c", &options->m_scale, &end) == 1 && options->m_scale > 0)
+			;
+		else if (!strncmp(argv[i], "--output=", 9) && argv[i][9])
+			options->m_output = argv[i] + 9;
+		else if (!strncmp(argv[i], "--sort=", 7) && argv[i][7])
+			options->m_tools[ToolSort] = argv[i] + 7;
+		else if (!strncmp(argv[i], "--png=", 6) && argv[i][6])
+			options->m_tools[ToolPng] = argv[i] + 6;
+		else if (!strncmp(argv[i], "--equations=", 12) && argv[i][12])
+			options->m_tools[ToolEquations] = argv[i] + 12;
+		else
+		{
+			fprintf(stderr, "Unknown option %s", argv[i]);
+			return ERROR_INVALID_PARAMETER;
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+// the input of workload w, generated into directory; the output of the one before if it has none
+static int prepare_input(const workload_t *workload, int64_t size, const char *directory, int w, char *input, size_t length)
+{
+	if (workload->m_generate == NULL)
+	{
+		snprintf(input, length, "%s/%d.out", directory, w - 1);
+		return ERROR_SUCCESS;
+	}
+	snprintf(input, length, "%s/%d.in", directory, w);
+	output_file_t file;
+	int code = open_output(&file, input, "wb");
+	if (code)
+	{
+		fprintf(stderr, "cannot create %s", input);
+		return code;
+	}
+	code = workload->m_generate(file.m_file, size);
+	if (close_output(&file) && !code)
+	{
+		fprintf(stderr, "cannot write %s", input);
+		code = ERROR_UNKNOWN;
+	}
+	return code;
+}
+
+// a warm-up run, which also leaves the output for the next workload, then runs for the medians
+static int measure_workload(const workload_t *workload, const options_t *options, const char *directory, int w, FILE *out)
+{
+	int64_t size = (int64_t)(workload->m_size * options->m_scale);
+	size = size > 1 ? size : 1;
+	char input[4096];
+	char output[4096];
+	int code = prepare_input(workload, size, directory, w, input, sizeof(input));
+	if (code)
+		return code;
+	snprintf(output, sizeof(output), "%s/%d.out", directory, w);
+
+	char *argv[MAX_ARGUMENTS] = { (char *)options->m_tools[workload->m_tool], input, output };
+	for (int k = 0; k < 2 && workload->m_options[k]; k++)
+	{
+		argv[3 + k] = (char *)workload->m_options[k];
+	}
+
+	double walls[MAX_RUNS];
+	int64_t counts[COUNTERS][MAX_RUNS];
+	int exit_code;
+	double wall;
+	int64_t run_counts[COUNTERS];
+	code = run_tool(argv, &wall, run_counts, &exit_code);
+	for (int r = 0; r < options->m_runs && !code && !exit_code; r++)
+	{
+		code = run_tool(argv, &walls[r], run_counts, &exit_code);
+		for (int c = 0; c < COUNTERS; c++)
+		{
+			counts[c][r] = run_counts[c];
+		}
+	}
+	if (code)
+		return code;
+	if (exit_code)
+		fprintf(stderr, "%s: %s exited with %d\n", workload->m_name, argv[0], exit_code);
+
+	fprintf(out, "%s\n    {\"name\": \"%s\", \"tool\": \"%s\", \"measures\": ", w ? "," : "", workload->m_name, tool_names[workload->m_tool]);
+	print_json_string(out, workload->m_what);
+	fprintf(out, ", \"size\": %lld, \"exit_code\": %d", (long long)size, exit_code);
+	if (exit_code)
+	{
+		fprintf(out, "}");
+		return ERROR_SUCCESS;
+	}
+	qsort(walls, options->m_runs, sizeof(double), compare_doubles);
+	fprintf(out, ", \"wall_seconds\": %.6f", walls[options->m_runs / 2]);
+	for (int c = 0; c < COUNTERS; c++)
+	{
+		int64_t median = get_median_count(counts[c], options->m_runs);
+		if (median < 0)
+			fprintf(out, ", \"%s\": null", counter_names[c]);
+		else
+			fprintf(out, ", \"%s\": %lld", counter_names[c], (long long)median);
+	}
+	fprintf(out, "}");
+	fflush(out);
+	return ERROR_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	options_t options;
+	if (parse_options(argc - 1, argv + 1, &options))
+		return ERROR_INVALID_PARAMETER;
+	for (int t = 0; t < TOOLS; t++)
+	{
+		if (options.m_tools[t] == NULL || access(options.m_tools[t], X_OK))
+		{
+			fprintf(stderr, "no %s tool, give it with --%s=path", tool_names[t], tool_names[t]);
+			return ERROR_FILE_NOT_FOUND;
+		}
+	}
+
+	char directory[] = "/tmp/perf_bench_XXXXXX";
+	if (mkdtemp(directory) == NULL)
+	{
+		fprintf(stderr, "cannot create a temporary directory");
+		return get_io_error(errno);
+	}
+	output_file_t output = { stdout, NULL };
+	int code = options.m_output ? open_output(&output, options.m_output, "w") : ERROR_SUCCESS;
+	if (code)
+		fprintf(stderr, "cannot open %s", options.m_output);
+
+	if (!code)
+	{
+		FILE *out = output.m_file;
+		fprintf(out, "{\n  \"compiler\": ");
+		print_json_string(out, __VERSION__);
+#if defined BUILD_TYPE
+		fprintf(out, ",\n  \"build\": ");
+		print_json_string(out, BUILD_TYPE);
+#endif
+		fprintf(out, ",\n  \"runs\": %d,\n  \"scale\": %g,\n  \"workloads\": [", options.m_runs, options.m_scale);
+		for (int w = 0; w < WORKLOADS && !code; w++)
+		{
+			code = measure_workload(&workloads[w], &options, directory, w, out);
+		}
+		fprintf(out, "\n  ]\n}\n");
+	}
+	if (options.m_output && close_output(&output) && !code)
+	{
+		fprintf(stderr, "cannot write %s", options.m_output);
+		code = ERROR_UNKNOWN;
+	}
+	else if (!options.m_output)
+		fflush(stdout);
+
+	for (int w = 0; w < WORKLOADS; w++)
+	{
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%d.in", directory, w);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%d.out", directory, w);
+		unlink(path);
+	}
+	rmdir(directory);
+	return code;
+}
@@ -0,0 +1,463 @@
+#include "file_io.h"
+
+#include "return_codes.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined POSIX_IO
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+#if defined IO_URING
+#	include <linux/io_uring.h>
+#	include <sys/syscall.h>
+#endif
+
+#define READ_BLOCK (1 << 16)	// growth of the copy of a file that cannot be mapped
+#define TOKEN_LENGTH 128	// longest number the strtof fallback takes
+
+int get_io_error(int error)
+{
+	switch (error)
+	{
+	case ENOENT:
+	case ENOTDIR:
+	case EACCES:
+	case EISDIR:
+	case ENAMETOOLONG:
+		return ERROR_FILE_NOT_FOUND;
+	case ENOMEM:
+		return ERROR_NOT_ENOUGH_MEMORY;
+	case EINVAL:
+		return ERROR_INVALID_PARAMETER;
+	default:
+		return ERROR_UNKNOWN;
+	}
+}
+
+// one more READ_BLOCK for the copy of a file, keeping its alignment
+static int grow_copy(mapped_file_t *file, size_t *capacity)
+{
+	char *data = aligned_alloc(FILE_ALIGNMENT, *capacity + READ_BLOCK);
+	if (data == NULL)
+		return ERROR_NOT_ENOUGH_MEMORY;
+	if (file->m_length)
+		memcpy(data, file->m_data, file->m_length);
+	free(file->m_data);
+	file->m_data = data;
+	*capacity += READ_BLOCK;
+	return ERROR_SUCCESS;
+}
+
+#if defined POSIX_IO
+int map_descriptor(mapped_file_t *file, int descriptor)
+{
+	memset(file, 0, sizeof(*file));
+	struct stat info;
+	if (!fstat(descriptor, &info) && S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+		if (data != MAP_FAILED)
+		{
+			madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+			file->m_data = data;
+			file->m_length = (size_t)info.st_size;
+			file->m_mapped = 1;
+			return ERROR_SUCCESS;
+		}
+	}
+
+	// pipes, empty files: read all of it
+	size_t capacity = 0;
+	for (;;)
+	{
+		if (file->m_length == capacity && grow_copy(file, &capacity))
+		{
+			unmap_file(file);
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		ssize_t length = read(descriptor, file->m_data + file->m_length, capacity - file->m_length);
+		if (length < 0 && errno == EINTR)
+			continue;
+		if (length < 0)
+		{
+			int code = get_io_error(errno);
+			unmap_file(file);
+			return code;
+		}
+		if (length == 0)
+			return ERROR_SUCCESS;
+		file->m_length += (size_t)length;
+	}
+}
+
+int map_file(mapped_file_t *file, const char *path)
+{
+	memset(file, 0, sizeof(*file));
+	int descriptor = open(path, O_RDONLY);
+	if (descriptor < 0)
+		return get_io_error(errno);
+	int code = map_descriptor(file, descriptor);
+	close(descriptor);
+	return code;
+}
+#else
+int map_file(mapped_file_t *file, const char *path)
+{
+	memset(file, 0, sizeof(*file));
+	FILE *in = fopen(path, "rb");
+	if (in == NULL)
+		return get_io_error(errno);
+	size_t capacity = 0;
+	for (;;)
+	{
+		if (file->m_length == capacity && grow_copy(file, &capacity))
+		{
+			fclose(in);
+			unmap_file(file);
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+		size_t length = fread(file->m_data + file->m_length, 1, capacity - file->m_length, in);
+		file->m_length += length;
+		if (length == 0)
+			break;
+	}
+	int code = ferror(in) ? ERROR_UNKNOWN : ERROR_SUCCESS;
+	fclose(in);
+	if (code)
+		unmap_file(file);
+	return code;
+}
+#endif
+
+void unmap_file(mapped_file_t *file)
+{
+#if defined POSIX_IO
+	if (file->m_mapped)
+		munmap(file->m_data, file->m_length);
+	else
+#endif
+		free(file->m_data);
+	memset(file, 0, sizeof(*file));
+}
+
+#if defined IO_URING
+#	define PREFETCH_ENTRIES 4
+
+// A ring of its own through the raw system calls, liburing is not needed for one kind of request.
+// Kernels without io_uring or with separate ring mappings (before 5.4) leave m_ring at -1.
+static void setup_ring(prefetch_t *prefetch)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	prefetch->m_ring = (int)syscall(__NR_io_uring_setup, PREFETCH_ENTRIES, &params);
+	if (prefetch->m_ring < 0)
+		return;
+	size_t sq_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	prefetch->m_rings_length = sq_length > cq_length ? sq_length : cq_length;
+	prefetch->m_entries_length = params.sq_entries * sizeof(struct io_uring_sqe);
+	prefetch->m_rings = MAP_FAILED;
+	prefetch->m_entries = MAP_FAILED;
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		prefetch->m_rings = mmap(NULL, prefetch->m_rings_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, prefetch->m_ring, IORING_OFF_SQ_RING);
+		prefetch->m_entries = mmap(NULL, prefetch->m_entries_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, prefetch->m_ring, IORING_OFF_SQES);
+	}
+	if (prefetch->m_rings == MAP_FAILED || prefetch->m_entries == MAP_FAILED)
+	{
+		if (prefetch->m_rings != MAP_FAILED)
+			munmap(prefetch->m_rings, prefetch->m_rings_length);
+		if (prefetch->m_entries != MAP_FAILED)
+			munmap(prefetch->m_entries, prefetch->m_entries_length);
+		close(prefetch->m_ring);
+		prefetch->m_ring = -1;
+		return;
+	}
+	char *rings = prefetch->m_rings;
+	prefetch->m_sq_tail = (unsigned *)(rings + params.sq_off.tail);
+	prefetch->m_sq_mask = (unsigned *)(rings + params.sq_off.ring_mask);
+	prefetch->m_sq_array = (unsigned *)(rings + params.sq_off.array);
+	prefetch->m_cq_head = (unsigned *)(rings + params.cq_off.head);
+	prefetch->m_cq_tail = (unsigned *)(rings + params.cq_off.tail);
+}
+
+// WILLNEED advice for the file, always handed to a kernel worker, so the caller goes on at once
+static void submit_advice(prefetch_t *prefetch, int descriptor, size_t length)
+{
+	unsigned tail = *prefetch->m_sq_tail;
+	unsigned index = tail & *prefetch->m_sq_mask;
+	struct io_uring_sqe *entry = (struct io_uring_sqe *)prefetch->m_entries + index;
+	memset(entry, 0, sizeof(*entry));
+	entry->opcode = IORING_OP_FADVISE;
+	entry->fd = descriptor;
+	entry->len = length > UINT32_MAX ? 0 : (uint32_t)length;	// 0 to the end of the file
+	entry->fadvise_advice = POSIX_FADV_WILLNEED;
+	prefetch->m_sq_array[index] = index;
+	__atomic_store_n(prefetch->m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	syscall(__NR_io_uring_enter, prefetch->m_ring, 1, 0, 0, NULL, 0);
+}
+
+// the completion of the one advice in flight; its result does not matter
+static void wait_advice(prefetch_t *prefetch)
+{
+	unsigned head = *prefetch->m_cq_head;
+	while (head == __atomic_load_n(prefetch->m_cq_tail, __ATOMIC_ACQUIRE))
+	{
+		if (syscall(__NR_io_uring_enter, prefetch->m_ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+			break;
+	}
+	__atomic_store_n(prefetch->m_cq_head, head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+void init_prefetch(prefetch_t *prefetch)
+{
+	memset(prefetch, 0, sizeof(*prefetch));
+	prefetch->m_descriptor = -1;
+#if defined IO_URING
+	setup_ring(prefetch);
+#endif
+}
+
+// the file of the last prefetch_file() stays open until its advice completed
+static void finish_prefetch(prefetch_t *prefetch)
+{
+#if defined POSIX_IO
+	if (prefetch->m_descriptor < 0)
+		return;
+#	if defined IO_URING
+	wait_advice(prefetch);
+#	endif
+	close(prefetch->m_descriptor);
+	prefetch->m_descriptor = -1;
+#else
+	(void)prefetch;
+#endif
+}
+
+void prefetch_file(prefetch_t *prefetch, const char *path, size_t length)
+{
+	finish_prefetch(prefetch);
+#if defined POSIX_IO
+	int descriptor = open(path, O_RDONLY);
+	if (descriptor < 0)
+		return;	   // the caller finds out when it opens the file
+#	if defined IO_URING
+	if (prefetch->m_ring >= 0)
+	{
+		submit_advice(prefetch, descriptor, length);
+		prefetch->m_descriptor = descriptor;
+		return;
+	}
+#	endif
+#	if defined POSIX_FADV_WILLNEED
+	posix_fadvise(descriptor, 0, (off_t)length, POSIX_FADV_WILLNEED);
+#	endif
+	close(descriptor);
+#else
+	(void)path;
+	(void)length;
+#endif
+}
+
+void close_prefetch(prefetch_t *prefetch)
+{
+	finish_prefetch(prefetch);
+#if defined IO_URING
+	if (prefetch->m_ring >= 0)
+	{
+		munmap(prefetch->m_rings, prefetch->m_rings_length);
+		munmap(prefetch->m_entries, prefetch->m_entries_length);
+		close(prefetch->m_ring);
+		prefetch->m_ring = -1;
+	}
+#endif
+}
+
+const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+const char *skip_token(const char *p, const char *end)
+{
+	while (p < end && !is_space(*p))
+		p++;
+	return p;
+}
+
+// inf, nan, hexadecimal and the numbers the fast path cannot round correctly
+static const char *parse_float_slow(const char *p, const char *end, float *value)
+{
+	char token[TOKEN_LENGTH];
+	size_t length = (size_t)(skip_token(p, end) - p);
+	if (!length || length >= TOKEN_LENGTH)
+		return NULL;
+	memcpy(token, p, length);
+	token[length] = 0;
+	char *stop;
+	*value = strtof(token, &stop);
+	return stop == token + length ? p + length : NULL;
+}
+
+// Token at p as a float, NULL if it is not one. Up to 19 digits times 10^-22..10^22 are exact
+// operands of one double operation, so its result is the correctly rounded double; rounding that to
+// float rounds twice only when it lands exactly halfway between two floats, those go to strtof.
+const char *parse_float(const char *p, const char *end, float *value)
+{
+	static const double powers[] = { 1e0,	1e1,  1e2,	1e3,  1e4,	1e5,  1e6,	1e7,  1e8,	1e9,  1e10, 1e11,
+									  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *start = p;
+	int negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+'))
+		p++;
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	int inexact = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+	{
+		if (mantissa < UINT64_MAX / 10 - 9)
+			mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+		else
+		{
+			exponent++;
+			inexact |= *p != '0';
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+		{
+			if (mantissa < UINT64_MAX / 10 - 9)
+			{
+				mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+				exponent--;
+			}
+			else
+				inexact |= *p != '0';
+		}
+	}
+	if (!digits)
+		return parse_float_slow(start, end, value);
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p + 1;
+		int exponent_negative = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+'))
+			q++;
+		if (q == end || *q < '0' || *q > '9')
+			return parse_float_slow(start, end, value);
+		int e = 0;
+		for (; q < end && *q >= '0' && *q <= '9'; q++)
+		{
+			e = e < 100000 ? e * 10 + (*q - '0') : e;
+		}
+		exponent += exponent_negative ? -e : e;
+		p = q;
+	}
+	if (p < end && !is_space(*p))
+		return parse_float_slow(start, end, value);
+	if (inexact || mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+		return parse_float_slow(start, end, value);
+
+	double result = exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];
+	uint64_t bits;
+	memcpy(&bits, &result, sizeof(bits));
+	if ((bits & 0x1FFFFFFF) == 0x10000000)	  // halfway between floats: the lower 29 of 52 bits are 100...
+		return parse_float_slow(start, end, value);
+	*value = negative ? -(float)result : (float)result;
+	return p;
+}
+
+int read_word(text_t *text, const char *word)
+{
+	const char *p = skip_space(text->m_cursor, text->m_end);
+	size_t length = strlen(word);
+	if ((size_t)(text->m_end - p) < length || memcmp(p, word, length) || (p + length < text->m_end && !is_space(p[length])))
+		return 0;
+	text->m_cursor = p + length;
+	return 1;
+}
+
+int read_token(text_t *text, const char **token, size_t *length)
+{
+	const char *p = skip_space(text->m_cursor, text->m_end);
+	if (p == text->m_end)
+		return 0;
+	text->m_cursor = skip_token(p, text->m_end);
+	*token = p;
+	*length = (size_t)(text->m_cursor - p);
+	return 1;
+}
+
+int read_int(text_t *text, int *value)
+{
+	const char *p = skip_space(text->m_cursor, text->m_end);
+	int negative = p < text->m_end && *p == '-';
+	if (p < text->m_end && (*p == '-' || *p == '+'))
+		p++;
+	const char *digits = p;
+	int64_t result = 0;
+	for (; p < text->m_end && *p >= '0' && *p <= '9'; p++)
+	{
+		result = result * 10 + (*p - '0');
+		if (result > (int64_t)1 << 31)
+			return 0;
+	}
+	if (p == digits || (p < text->m_end && !is_space(*p)) || result > (negative ? (int64_t)1 << 31 : ((int64_t)1 << 31) - 1))
+		return 0;
+	*value = (int)(negative ? -result : result);
+	text->m_cursor = p;
+	return 1;
+}
+
+int read_float(text_t *text, float *value)
+{
+	const char *p = parse_float(skip_space(text->m_cursor, text->m_end), text->m_end, value);
+	if (p == NULL)
+		return 0;
+	text->m_cursor = p;
+	return 1;
+}
+
+int is_text_end(text_t *text)
+{
+	text->m_cursor = skip_space(text->m_cursor, text->m_end);
+	return text->m_cursor == text->m_end;
+}
+
+
+int open_output(output_file_t *file, const char *path, const char *mode)
+{
+	memset(file, 0, sizeof(*file));
+	file->m_file = fopen(path, mode);
+	if (file->m_file == NULL)
+		return get_io_error(errno);
+	file->m_buffer = malloc(OUTPUT_BUFFER);
+	if (file->m_buffer)	   // without it the default stdio buffer does
+		setvbuf(file->m_file, file->m_buffer, _IOFBF, OUTPUT_BUFFER);
+	return ERROR_SUCCESS;
+}
+
+int close_output(output_file_t *file)
+{
+	int failed = 0;
+	if (file->m_file)
+	{
+		failed = ferror(file->m_file);
+		failed |= fclose(file->m_file) != 0;
+	}
+	free(file->m_buffer);
+	memset(file, 0, sizeof(*file));
+	return failed ? ERROR_UNKNOWN : ERROR_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// Input and output shared by the labs: files mapped into memory, a token reader over them, buffered
+// output files and one mapping of system errors to return_codes.h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if (defined __unix__ || defined __APPLE__) && !defined POSIX_IO
+#	define POSIX_IO
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FILE_ALIGNMENT 64	 // of copies of files that cannot be mapped, enough for any vector
+
+// errno as a return code: ERROR_FILE_NOT_FOUND for paths that cannot be opened, ERROR_NOT_ENOUGH_MEMORY,
+// ERROR_INVALID_PARAMETER, ERROR_UNKNOWN for the rest
+int get_io_error(int error);
+
+// Input file in memory: a private writable mapping (writes stay in this process), or a copy in
+// FILE_ALIGNMENT aligned memory where the file cannot be mapped (pipes, empty files, no mmap)
+typedef struct mapped_file_t_tag
+{
+	char *m_data;
+	size_t m_length;
+	int m_mapped;
+} mapped_file_t;
+
+int map_file(mapped_file_t *file, const char *path);
+#if defined POSIX_IO
+int map_descriptor(mapped_file_t *file, int descriptor);	// the descriptor stays open
+#endif
+void unmap_file(mapped_file_t *file);
+
+// Starts reading a file that is opened next into the page cache while the current one is processed:
+// the first length bytes, all of it for 0. With IO_URING defined the advice goes through an io_uring
+// and never blocks the caller, otherwise through posix_fadvise(); without POSIX it does nothing.
+typedef struct prefetch_t_tag
+{
+	int m_descriptor;	 // of the file in flight, -1 if none
+#if defined IO_URING
+	int m_ring;	   // -1 where the kernel has no io_uring, posix_fadvise() then
+	void *m_rings;	  // submission and completion rings in one mapping
+	size_t m_rings_length;
+	void *m_entries;	// submission queue entries
+	size_t m_entries_length;
+	unsigned *m_sq_tail;
+	unsigned *m_sq_mask;
+	unsigned *m_sq_array;
+	unsigned *m_cq_head;
+	unsigned *m_cq_tail;
+#endif
+} prefetch_t;
+
+void init_prefetch(prefetch_t *prefetch);
+void prefetch_file(prefetch_t *prefetch, const char *path, size_t length);
+void close_prefetch(prefetch_t *prefetch);
+
+// Text cursor over a mapped file
+typedef struct text_t_tag
+{
+	const char *m_cursor;
+	const char *m_end;
+} text_t;
+
+// Each skips the white space before its token and returns 1 if the token is one of its kind; numbers
+// are read like fscanf "%d" and "%f" would, the value is the correctly rounded float
+int read_word(text_t *text, const char *word);
+int read_token(text_t *text, const char **token, size_t *length);	 // any token, in place
+int read_int(text_t *text, int *value);
+int read_float(text_t *text, float *value);
+int is_text_end(text_t *text);	  // only white space left
+
+// The scanning under the text_t functions, for parsers that split a text between threads
+static inline int is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+const char *skip_space(const char *p, const char *end);
+const char *skip_token(const char *p, const char *end);
+const char *parse_float(const char *p, const char *end, float *value);	  // NULL if the token is not a float
+
+// Output file with an OUTPUT_BUFFER stdio buffer, so formatted output reaches the system in few
+// large writes. close_output() reports what fclose() finds, a full disk included.
+#define OUTPUT_BUFFER (1 << 20)
+
+typedef struct output_file_t_tag
+{
+	FILE *m_file;
+	char *m_buffer;
+} output_file_t;
+
+int open_output(output_file_t *file, const char *path, const char *mode);
+int close_output(output_file_t *file);
+
+#ifdef __cplusplus
+}
+#endif